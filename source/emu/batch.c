@@ -0,0 +1,299 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include "timeline.h"
+#include "batch.h"
+#include "dz11.h"
+#include "cpu.h"
+
+
+#define BATCH_MAX_TEXT			256		//per script arg, after escapes
+#define BATCH_OUT_BUF_SZ		4096	//console output kept for "expect", must be at least BATCH_MAX_TEXT
+
+enum BatchOp {
+	BatchOpExpect,
+	BatchOpSend,
+	BatchOpExit,
+};
+
+struct BatchCmd {
+	enum BatchOp op;
+	uint32_t len;			//of text
+	int status;				//BatchOpExit
+	char *text;
+};
+
+static struct BatchConfig mCfg;
+static struct BatchCmd *mCmds;
+static uint32_t mNumCmds, mCurCmd, mSent;	//mSent: chars of the current send typed so far
+static char mOut[BATCH_OUT_BUF_SZ];
+static uint32_t mOutUsed;
+static uint64_t mStartUsec;
+static const char *mExitReason = "exit";
+static int mExitStatus;
+static bool mExitKnown;
+
+
+static uint64_t batchPrvGetTime(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int batchPrvHexDigit(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static int32_t batchPrvUnescape(const char *src, char *dst)	//dst is BATCH_MAX_TEXT long. returns length or -1
+{
+	uint32_t len = 0;
+	int hi, lo;
+	char ch;
+	
+	while ((ch = *src++)) {
+		
+		if (ch == '\\') {
+			switch (ch = *src++) {
+				case 'n':	ch = '\n';	break;
+				case 'r':	ch = '\r';	break;
+				case 't':	ch = '\t';	break;
+				case '\\':				break;
+				case 'x':
+					if ((hi = batchPrvHexDigit(src[0])) < 0 || (lo = batchPrvHexDigit(src[1])) < 0)
+						return -1;
+					ch = hi * 16 + lo;
+					src += 2;
+					break;
+				default:
+					return -1;
+			}
+		}
+		
+		if (len == BATCH_MAX_TEXT)
+			return -1;
+		dst[len++] = ch;
+	}
+	
+	return len;
+}
+
+static bool batchPrvParse(FILE *f)
+{
+	char line[BATCH_MAX_TEXT * 4 + 32], text[BATCH_MAX_TEXT + 1], *cmd, *arg, *end;
+	uint32_t lineNo = 0;
+	struct BatchCmd *c;
+	int32_t len;
+	
+	while (fgets(line, sizeof(line), f)) {
+		
+		lineNo++;
+		line[strcspn(line, "\r\n")] = 0;
+		
+		for (cmd = line; isspace((unsigned char)*cmd); cmd++);
+		if (!*cmd || *cmd == '#')
+			continue;
+		
+		//arg is everything after the one space that ends the command, so that text may start with spaces
+		arg = cmd + strcspn(cmd, " \t");
+		if (*arg)
+			*arg++ = 0;
+		
+		mCmds = realloc(mCmds, sizeof(struct BatchCmd) * (mNumCmds + 1));
+		if (!mCmds)
+			return false;
+		c = &mCmds[mNumCmds];
+		memset(c, 0, sizeof(*c));
+		
+		if (!strcmp(cmd, "exit")) {
+			c->op = BatchOpExit;
+			c->status = strtol(arg, &end, 0);
+			if (end == arg || *end)
+				goto bad;
+		}
+		else {
+			
+			if (!strcmp(cmd, "expect"))
+				c->op = BatchOpExpect;
+			else if (!strcmp(cmd, "send") || !strcmp(cmd, "sendline"))
+				c->op = BatchOpSend;
+			else
+				goto bad;
+			
+			len = batchPrvUnescape(arg, text);
+			if (len < 0 || (c->op == BatchOpExpect && !len))
+				goto bad;
+			if (!strcmp(cmd, "sendline")) {
+				if (len == BATCH_MAX_TEXT)
+					goto bad;
+				text[len++] = '\r';
+			}
+			
+			c->len = len;
+			c->text = malloc(len);
+			if (!c->text)
+				return false;
+			memcpy(c->text, text, len);
+		}
+		
+		mNumCmds++;
+	}
+	
+	return true;
+	
+bad:
+	fprintf(stderr, "batch script line %u: cannot make sense of '%s'\n", (unsigned)lineNo, cmd);
+	return false;
+}
+
+static void batchPrvOutDrop(uint32_t num)
+{
+	memmove(mOut, mOut + num, mOutUsed - num);
+	mOutUsed -= num;
+}
+
+static bool batchPrvExpectFound(void)	//look for it in all we have, drop all up to where it ends
+{
+	const struct BatchCmd *c = &mCmds[mCurCmd];
+	const char *at = memmem(mOut, mOutUsed, c->text, c->len);
+	
+	if (!at)
+		return false;
+	
+	batchPrvOutDrop(at + c->len - mOut);
+	
+	return true;
+}
+
+void batchConsoleOut(uint_fast8_t chr)
+{
+	const struct BatchCmd *c;
+	
+	if (mCurCmd == mNumCmds)		//no script, or it is done
+		return;
+	
+	if (mOutUsed == BATCH_OUT_BUF_SZ)
+		batchPrvOutDrop(BATCH_OUT_BUF_SZ / 2);
+	mOut[mOutUsed++] = chr;
+	
+	//only the tail can be a new match, earlier ones were looked for already. batchPoll() moves on past it
+	if ((c = &mCmds[mCurCmd])->op == BatchOpExpect && mOutUsed >= c->len && !memcmp(mOut + mOutUsed - c->len, c->text, c->len)) {
+		mOutUsed = 0;
+		mCurCmd++;
+	}
+}
+
+void batchPoll(void)
+{
+	const struct BatchCmd *c;
+	uint_fast8_t space;
+	
+	if (mCfg.timeoutUsec && batchPrvGetTime() - mStartUsec >= mCfg.timeoutUsec)
+		batchExit("timeout", BATCH_EXIT_TIMEOUT);
+	if (mCfg.timeoutInstrs && cpuGetInstrCnt() >= mCfg.timeoutInstrs)
+		batchExit("timeout", BATCH_EXIT_TIMEOUT);
+	
+	while (mCurCmd < mNumCmds) {
+		
+		c = &mCmds[mCurCmd];
+		
+		switch (c->op) {
+			case BatchOpExpect:
+				if (!batchPrvExpectFound())
+					return;
+				break;
+			
+			case BatchOpSend:
+				for (space = dz11charRxSpace(BATCH_CONSOLE_LINE); space && mSent < c->len; space--)
+					dz11charRx(BATCH_CONSOLE_LINE, (uint8_t)c->text[mSent++]);
+				if (mSent < c->len)
+					return;
+				mSent = 0;
+				break;
+			
+			case BatchOpExit:
+				batchExit("script", c->status);
+		}
+		mCurCmd++;
+	}
+}
+
+static void batchPrvSummary(void)
+{
+	uint64_t counts[CpuPerfNumEvents];
+	FILE *f;
+	
+	f = fopen(mCfg.summaryPath, "w");
+	if (!f) {
+		fprintf(stderr, "cannot write run summary to '%s'\n", mCfg.summaryPath);
+		return;
+	}
+	
+	cpuGetPerfCounts(counts);
+	
+	fprintf(f, "{\n\t\"reason\": \"%s\",\n", mExitReason);
+	if (mExitKnown)
+		fprintf(f, "\t\"status\": %d,\n", mExitStatus);
+	else
+		fprintf(f, "\t\"status\": null,\n");
+	fprintf(f, "\t\"wallSec\": %.6f,\n\t\"instrs\": %llu,\n\t\"exceptions\": %llu,\n\t\"tlbRefills\": %llu,\n\t\"icacheMisses\": %llu,\n\t\"hypercalls\": %llu,\n",
+		(batchPrvGetTime() - mStartUsec) / 1e6, (unsigned long long)counts[CpuPerfInstrs], (unsigned long long)counts[CpuPerfExceptions],
+		(unsigned long long)counts[CpuPerfTlbRefills], (unsigned long long)counts[CpuPerfIcacheMisses], (unsigned long long)counts[CpuPerfHypercalls]);
+	fprintf(f, "\t\"scriptSteps\": %u,\n\t\"scriptStepsDone\": %u,\n\t\"marks\": ", (unsigned)mNumCmds, (unsigned)mCurCmd);
+	timelineJson(f);
+	fprintf(f, "\n}\n");
+	fclose(f);
+}
+
+bool batchInit(const struct BatchConfig *cfg)
+{
+	FILE *f;
+	bool ret;
+	
+	mCfg = *cfg;
+	mStartUsec = batchPrvGetTime();
+	
+	if (cfg->script) {
+		
+		f = fopen(cfg->script, "r");
+		if (!f) {
+			fprintf(stderr, "cannot open batch script '%s'\n", cfg->script);
+			return false;
+		}
+		ret = batchPrvParse(f);
+		fclose(f);
+		if (!ret)
+			return false;
+	}
+	
+	if (cfg->summaryPath)
+		atexit(batchPrvSummary);
+	
+	return true;
+}
+
+void batchExit(const char *reason, int status)
+{
+	mExitReason = reason;
+	mExitStatus = status;
+	mExitKnown = true;
+	
+	exit(status);
+}
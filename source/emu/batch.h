@@ -0,0 +1,42 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//unattended runs. a script types into the guest console and waits for what it prints, expect-style, timeouts end runs
+//that hang, and a JSON summary of the run is written at exit. script is a text file, one command per line, text args
+//take C escapes (\n \r \t \\ \xNN), blank lines and lines starting with '#' are skipped:
+//	expect <text>		wait till the console prints text (anything printed since the last match counts)
+//	send <text>			type text
+//	sendline <text>		type text and Enter (\r)
+//	exit <status>		end the run with this status
+//when the script ends without an exit, the run goes on till the guest ends it (H_TERM) or a timeout hits
+
+#define BATCH_CONSOLE_LINE		3		//the serial line the script talks to, as per hostUart.h
+
+#define BATCH_EXIT_TIMEOUT		124		//as timeout(1) does
+#define BATCH_EXIT_SIGNAL		128		//+ signal number, as shells do
+
+struct BatchConfig {
+	const char *script;			//NULL for none
+	const char *summaryPath;	//write the run summary here at exit, NULL for nowhere
+	uint64_t timeoutUsec;		//host time, 0 for none
+	uint64_t timeoutInstrs;		//guest time, 0 for none
+};
+
+
+bool batchInit(const struct BatchConfig *cfg);
+void batchConsoleOut(uint_fast8_t chr);				//what the guest printed on BATCH_CONSOLE_LINE
+void batchPoll(void);								//call often, types script input as the DZ11 has room, checks timeouts
+
+//all planned ends of a run come here, so the summary can say why. others show up there as "exit"
+void __attribute__((noreturn)) batchExit(const char *reason, int status);
+
+
+#endif
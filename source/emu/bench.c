@@ -0,0 +1,590 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+//host-side cpu core microbenchmark. links the cpu core directly, assembles the guest code itself, so no MIPS toolchain is
+//needed. each workload is an endless guest loop that is run for a fixed number of instructions, best of N runs is kept
+
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <time.h>
+#include "decBus.h"
+#include "cpu.h"
+#include "mem.h"
+
+
+#define BENCH_RAM_SZ		(16 << 20)
+#define BENCH_KSEG0(pa)		(0x80000000UL + (pa))
+
+#define BENCH_REFILL_PA		0x00000000UL	//r3000 vectors, with BEV clear
+#define BENCH_GENERAL_PA	0x00000080UL
+#define BENCH_CODE_PA		0x00010000UL
+#define BENCH_DATA_PA		0x00100000UL
+#define BENCH_DATA2_PA		0x00200000UL
+#define BENCH_TLB_VA		0x00400000UL	//kuseg. refill handler maps it 1:1 onto RAM
+#define BENCH_TLB_PAGES		256				//4x the default TLB size, a quarter of the largest (see --tlb)
+
+//registers
+#define ZERO	0
+#define T0		8
+#define T1		9
+#define T2		10
+#define T3		11
+#define T4		12
+#define T5		13
+#define T6		14
+#define T7		15
+#define K0		26
+#define K1		27		//exception handlers count exceptions here
+#define RA		31
+
+//encoders
+#define R_TYPE(rs, rt, rd, sa, fn)	((((uint32_t)(rs)) << 21) | (((uint32_t)(rt)) << 16) | (((uint32_t)(rd)) << 11) | (((uint32_t)(sa)) << 6) | (fn))
+#define I_TYPE(op, rs, rt, imm)		((((uint32_t)(op)) << 26) | (((uint32_t)(rs)) << 21) | (((uint32_t)(rt)) << 16) | ((imm) & 0xffff))
+#define NOP							0
+#define SLL(d, t, sa)				R_TYPE(0, t, d, sa, 0)
+#define SRL(d, t, sa)				R_TYPE(0, t, d, sa, 2)
+#define JR(s)						R_TYPE(s, 0, 0, 0, 8)
+#define SYSCALL						R_TYPE(0, 0, 0, 0, 12)
+#define ADDU(d, s, t)				R_TYPE(s, t, d, 0, 33)
+#define SUBU(d, s, t)				R_TYPE(s, t, d, 0, 35)
+#define AND(d, s, t)				R_TYPE(s, t, d, 0, 36)
+#define OR(d, s, t)					R_TYPE(s, t, d, 0, 37)
+#define XOR(d, s, t)				R_TYPE(s, t, d, 0, 38)
+#define SLT(d, s, t)				R_TYPE(s, t, d, 0, 42)
+#define SLTU(d, s, t)				R_TYPE(s, t, d, 0, 43)
+#define JAL(va)						((3UL << 26) | (((va) >> 2) & 0x03ffffffUL))
+#define BEQ(s, t, ofs)				I_TYPE(4, s, t, ofs)
+#define BNE(s, t, ofs)				I_TYPE(5, s, t, ofs)
+#define ADDIU(t, s, imm)			I_TYPE(9, s, t, imm)
+#define SLTI(t, s, imm)				I_TYPE(10, s, t, imm)
+#define SLTIU(t, s, imm)			I_TYPE(11, s, t, imm)
+#define ANDI(t, s, imm)				I_TYPE(12, s, t, imm)
+#define ORI(t, s, imm)				I_TYPE(13, s, t, imm)
+#define LUI(t, imm)					I_TYPE(15, 0, t, imm)
+#define MFC0(t, cpr)				(0x40000000UL | (((uint32_t)(t)) << 16) | (((uint32_t)(cpr)) << 11))
+#define MTC0(t, cpr)				(0x40800000UL | (((uint32_t)(t)) << 16) | (((uint32_t)(cpr)) << 11))
+#define TLBWR						0x42000006UL
+#define RFE							0x42000010UL
+#define ADD_D(fd, fs, ft)			(0x46200000UL | (((uint32_t)(ft)) << 16) | (((uint32_t)(fs)) << 11) | (((uint32_t)(fd)) << 6) | 0)
+#define MUL_D(fd, fs, ft)			(0x46200000UL | (((uint32_t)(ft)) << 16) | (((uint32_t)(fs)) << 11) | (((uint32_t)(fd)) << 6) | 2)
+#define LWL(t, ofs, b)				I_TYPE(34, b, t, ofs)
+#define LW(t, ofs, b)				I_TYPE(35, b, t, ofs)
+#define LWR(t, ofs, b)				I_TYPE(38, b, t, ofs)
+#define SWL(t, ofs, b)				I_TYPE(42, b, t, ofs)
+#define SW(t, ofs, b)				I_TYPE(43, b, t, ofs)
+#define SWR(t, ofs, b)				I_TYPE(46, b, t, ofs)
+#define LDC1(ft, ofs, b)			I_TYPE(53, b, ft, ofs)
+#define SDC1(ft, ofs, b)			I_TYPE(61, b, ft, ofs)
+
+#define CP0_BADVA		8
+#define CP0_ENTRYHI		10
+#define CP0_ENTRYLO		2
+#define CP0_EPC			14
+
+#define CP0_STATUS_CU1	0x20000000UL
+
+
+struct BenchWorkload {
+	const char *name;
+	void (*gen)(void);
+	bool expectExc;
+};
+
+struct BenchResult {
+	uint64_t instrs, ns, excs;
+	uint64_t fused[CpuFusedNumKinds];	//instr pairs run as one
+};
+
+
+static uint8_t mRam[BENCH_RAM_SZ];
+static uint32_t mEmitPa;
+
+
+//what the core needs from the rest of the SoC
+void decReportBusErrorAddr(uint32_t pa)
+{
+	fprintf(stderr, "bus error at PA 0x%08x\n", (unsigned)pa);
+}
+
+bool cpuExtHypercall(void)
+{
+	return false;
+}
+
+#ifdef GDB_SUPPORT
+	void cpuExtDebugTrap(uint32_t addr, enum CpuWatchType watchType)
+	{
+		(void)addr;
+		(void)watchType;
+	}
+#endif
+
+static bool benchPrvRamAccess(uint32_t pa, uint_fast8_t size, bool write, void* buf, void* userData)
+{
+	(void)userData;
+	
+	if (write)
+		memcpy(mRam + pa, buf, size);
+	else
+		memcpy(buf, mRam + pa, size);
+	
+	return true;
+}
+
+static void benchPrvEmit(uint32_t instr)
+{
+	memcpy(mRam + mEmitPa, &instr, sizeof(instr));
+	mEmitPa += 4;
+}
+
+static uint32_t benchPrvBranchTo(uint32_t targetPa)		//call right before emitting the branch
+{
+	return (uint16_t)(((int32_t)targetPa - (int32_t)(mEmitPa + 4)) / 4);
+}
+
+static void benchPrvEmitLoadImm(uint_fast8_t reg, uint32_t val)
+{
+	benchPrvEmit(LUI(reg, val >> 16));
+	benchPrvEmit(ORI(reg, reg, val));
+}
+
+static void benchPrvEmitVectors(void)
+{
+	//utlb refill: map the faulting kuseg page 1:1 onto RAM (low 24 bits), valid, dirty, global
+	mEmitPa = BENCH_REFILL_PA;
+	benchPrvEmit(MFC0(K0, CP0_ENTRYHI));
+	benchPrvEmit(SRL(K0, K0, 12));
+	benchPrvEmit(ANDI(K0, K0, 0x0fff));
+	benchPrvEmit(SLL(K0, K0, 12));
+	benchPrvEmit(ORI(K0, K0, 0x0700));
+	benchPrvEmit(MTC0(K0, CP0_ENTRYLO));
+	benchPrvEmit(NOP);
+	benchPrvEmit(TLBWR);
+	benchPrvEmit(MFC0(K0, CP0_EPC));
+	benchPrvEmit(ADDIU(K1, K1, 1));
+	benchPrvEmit(JR(K0));
+	benchPrvEmit(RFE);
+	
+	//general exception: only syscalls are expected, skip the instr
+	mEmitPa = BENCH_GENERAL_PA;
+	benchPrvEmit(MFC0(K0, CP0_EPC));
+	benchPrvEmit(ADDIU(K1, K1, 1));
+	benchPrvEmit(ADDIU(K0, K0, 4));
+	benchPrvEmit(JR(K0));
+	benchPrvEmit(RFE);
+	
+	mEmitPa = BENCH_CODE_PA;
+}
+
+static void benchPrvGenAlu(void)
+{
+	static const uint_fast8_t regs[] = {T0, T1, T2, T3, T4, T5, T6, T7};
+	uint32_t loop = mEmitPa;
+	uint_fast8_t i;
+	
+	for (i = 0; i < 32; i++) {
+		
+		uint_fast8_t d = regs[i % 8], s = regs[(i + 3) % 8], t = regs[(i + 5) % 8];
+		
+		switch (i % 8) {
+			case 0:	benchPrvEmit(ADDU(d, s, t));		break;
+			case 1:	benchPrvEmit(XOR(d, s, t));			break;
+			case 2:	benchPrvEmit(SLL(d, s, i % 31));	break;
+			case 3:	benchPrvEmit(SUBU(d, s, t));		break;
+			case 4:	benchPrvEmit(OR(d, s, t));			break;
+			case 5:	benchPrvEmit(SLT(d, s, t));			break;
+			case 6:	benchPrvEmit(ADDIU(d, s, 0x1234));	break;
+			case 7:	benchPrvEmit(AND(d, s, t));			break;
+		}
+	}
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenLoadStore(void)
+{
+	uint32_t outer, loop;
+	
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(BENCH_DATA_PA));
+	benchPrvEmitLoadImm(T1, BENCH_KSEG0(BENCH_DATA_PA + 65536));
+	loop = mEmitPa;
+	benchPrvEmit(LW(T2, 0, T0));
+	benchPrvEmit(LW(T3, 4, T0));
+	benchPrvEmit(ADDU(T2, T2, T3));
+	benchPrvEmit(SW(T2, 8, T0));
+	benchPrvEmit(SW(T3, 12, T0));
+	benchPrvEmit(ADDIU(T0, T0, 16));
+	benchPrvEmit(BNE(T0, T1, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenBranchy(void)
+{
+	uint32_t loop, skipBranch, skip, func;
+	
+	loop = mEmitPa;
+	benchPrvEmit(ANDI(T1, T0, 1));
+	skipBranch = mEmitPa;
+	benchPrvEmit(0);						//patched below
+	benchPrvEmit(ADDIU(T0, T0, 1));
+	benchPrvEmit(ADDIU(T2, T2, 1));
+	skip = mEmitPa;
+	func = mEmitPa + 16;
+	benchPrvEmit(JAL(BENCH_KSEG0(func)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(JR(RA));
+	benchPrvEmit(ADDIU(T3, T3, 1));
+	
+	mEmitPa = skipBranch;
+	benchPrvEmit(BEQ(T1, ZERO, benchPrvBranchTo(skip)));
+}
+
+static void benchPrvGenTlbStorm(void)
+{
+	uint32_t outer, loop;
+	
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_TLB_VA);
+	benchPrvEmitLoadImm(T1, BENCH_TLB_VA + BENCH_TLB_PAGES * 4096);
+	loop = mEmitPa;
+	benchPrvEmit(LW(T2, 0, T0));
+	benchPrvEmit(ADDIU(T0, T0, 4096));
+	benchPrvEmit(BNE(T0, T1, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenSyscall(void)
+{
+	uint32_t loop = mEmitPa;
+	
+	benchPrvEmit(SYSCALL);
+	benchPrvEmit(ADDIU(T0, T0, 1));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenFpu(void)
+{
+	const uint32_t n = 4096, xPa = BENCH_DATA_PA, yPa = BENCH_DATA2_PA, aPa = BENCH_DATA2_PA - 8;
+	uint32_t outer, loop, i;
+	double v;
+	
+	//daxpy: y += a * x
+	for (i = 0; i < n; i++) {
+		v = i;
+		memcpy(mRam + xPa + i * 8, &v, sizeof(v));
+		v = 1.0 / (i + 1);
+		memcpy(mRam + yPa + i * 8, &v, sizeof(v));
+	}
+	v = 0.001;
+	memcpy(mRam + aPa, &v, sizeof(v));
+	
+	cpuSetRegExternal(MIPS_EXT_REG_STATUS, cpuGetRegExternal(MIPS_EXT_REG_STATUS) | CP0_STATUS_CU1);
+	
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(aPa));
+	benchPrvEmit(LDC1(6, 0, T0));
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(xPa));
+	benchPrvEmitLoadImm(T1, BENCH_KSEG0(yPa));
+	benchPrvEmitLoadImm(T2, BENCH_KSEG0(xPa + n * 8));
+	loop = mEmitPa;
+	benchPrvEmit(LDC1(0, 0, T0));
+	benchPrvEmit(LDC1(2, 0, T1));
+	benchPrvEmit(MUL_D(4, 0, 6));
+	benchPrvEmit(ADD_D(4, 4, 2));
+	benchPrvEmit(SDC1(4, 0, T1));
+	benchPrvEmit(ADDIU(T0, T0, 8));
+	benchPrvEmit(BNE(T0, T2, benchPrvBranchTo(loop)));
+	benchPrvEmit(ADDIU(T1, T1, 8));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenUnaligned(void)
+{
+	uint32_t outer, loop, i;
+	
+	for (i = 0; i < 16384; i++)
+		mRam[BENCH_DATA_PA + i] = i * 7;
+	
+	//memcpy with misaligned src and dst, the way gcc does it
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(BENCH_DATA_PA + 1));
+	benchPrvEmitLoadImm(T1, BENCH_KSEG0(BENCH_DATA2_PA + 3));
+	benchPrvEmitLoadImm(T3, BENCH_KSEG0(BENCH_DATA_PA + 1 + 16384));
+	loop = mEmitPa;
+	benchPrvEmit(LWR(T2, 0, T0));
+	benchPrvEmit(LWL(T2, 3, T0));
+	benchPrvEmit(SWR(T2, 0, T1));
+	benchPrvEmit(SWL(T2, 3, T1));
+	benchPrvEmit(ADDIU(T0, T0, 4));
+	benchPrvEmit(BNE(T0, T3, benchPrvBranchTo(loop)));
+	benchPrvEmit(ADDIU(T1, T1, 4));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenMemset(void)
+{
+	uint32_t outer, loop;
+	
+	//unrolled, pointer bumped first, the way the kernel's memset does it
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(BENCH_DATA_PA));
+	benchPrvEmitLoadImm(T1, BENCH_KSEG0(BENCH_DATA_PA + 65536));
+	loop = mEmitPa;
+	benchPrvEmit(ADDIU(T0, T0, 16));
+	benchPrvEmit(SW(ZERO, -16, T0));
+	benchPrvEmit(SW(ZERO, -12, T0));
+	benchPrvEmit(SW(ZERO, -8, T0));
+	benchPrvEmit(BNE(T0, T1, benchPrvBranchTo(loop)));
+	benchPrvEmit(SW(ZERO, -4, T0));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenMemcpy(void)
+{
+	uint32_t outer, loop;
+	
+	//word copy, store in the delay slot, the way gcc does it
+	outer = mEmitPa;
+	benchPrvEmitLoadImm(T0, BENCH_KSEG0(BENCH_DATA_PA));
+	benchPrvEmitLoadImm(T1, BENCH_KSEG0(BENCH_DATA2_PA));
+	benchPrvEmitLoadImm(T3, BENCH_KSEG0(BENCH_DATA_PA + 16384));
+	loop = mEmitPa;
+	benchPrvEmit(LW(T2, 0, T0));
+	benchPrvEmit(ADDIU(T0, T0, 4));
+	benchPrvEmit(ADDIU(T1, T1, 4));
+	benchPrvEmit(BNE(T0, T3, benchPrvBranchTo(loop)));
+	benchPrvEmit(SW(T2, -4, T1));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(outer)));
+	benchPrvEmit(NOP);
+}
+
+static void benchPrvGenPairs(void)	//what compiled code is full of: globals, constants, compares, load delay slots
+{
+	uint32_t loop, skip1, skip2;
+	
+	benchPrvEmitLoadImm(T4, BENCH_KSEG0(BENCH_DATA2_PA));
+	loop = mEmitPa;
+	benchPrvEmit(LUI(T0, BENCH_KSEG0(BENCH_DATA_PA) >> 16));
+	benchPrvEmit(LW(T1, 0x10, T0));
+	benchPrvEmit(LUI(T2, 0x1234));
+	benchPrvEmit(ORI(T2, T2, 0x5678));
+	benchPrvEmit(ADDU(T1, T1, T2));
+	benchPrvEmit(LUI(T0, BENCH_KSEG0(BENCH_DATA_PA) >> 16));
+	benchPrvEmit(SW(T1, 0x10, T0));
+	benchPrvEmit(LW(T3, 4, T4));
+	benchPrvEmit(NOP);
+	benchPrvEmit(SLT(T5, T3, T1));
+	skip1 = mEmitPa + 16;
+	benchPrvEmit(BEQ(T5, ZERO, benchPrvBranchTo(skip1)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(ADDIU(T3, T3, 1));
+	benchPrvEmit(SW(T3, 4, T4));
+	benchPrvEmit(SLTIU(T6, T1, 100));
+	skip2 = mEmitPa + 16;
+	benchPrvEmit(BNE(T6, ZERO, benchPrvBranchTo(skip2)));
+	benchPrvEmit(NOP);
+	benchPrvEmit(LUI(T7, 0x8000));
+	benchPrvEmit(ADDIU(T7, T7, -4));
+	benchPrvEmit(BEQ(ZERO, ZERO, benchPrvBranchTo(loop)));
+	benchPrvEmit(NOP);
+}
+
+static const struct BenchWorkload mWorkloads[] = {
+	{"alu",			benchPrvGenAlu,			false,	},
+	{"loadstore",	benchPrvGenLoadStore,	false,	},
+	{"branch",		benchPrvGenBranchy,		false,	},
+	{"tlbmiss",		benchPrvGenTlbStorm,	true,	},
+	{"syscall",		benchPrvGenSyscall,		true,	},
+	{"fpu",			benchPrvGenFpu,			false,	},
+	{"unaligned",	benchPrvGenUnaligned,	false,	},
+	{"memset",		benchPrvGenMemset,		false,	},
+	{"memcpy",		benchPrvGenMemcpy,		false,	},
+	{"pairs",		benchPrvGenPairs,		false,	},
+};
+
+static uint64_t benchPrvNow(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void benchPrvRunOnce(const struct BenchWorkload *w, uint64_t numInstrs, struct BenchResult *res)
+{
+	uint64_t startInstrs, startTime;
+	uint_fast16_t i;
+	
+	memset(mRam, 0, sizeof(mRam));
+	cpuInit();
+	benchPrvEmitVectors();
+	w->gen();
+	cpuSetRegExternal(MIPS_EXT_REG_PC, BENCH_KSEG0(BENCH_CODE_PA));
+	
+	startInstrs = cpuGetInstrCnt();
+	startTime = benchPrvNow();
+	do {
+		for (i = 0; i < 1024; i++)
+			cpuCycle();
+	} while (cpuGetInstrCnt() - startInstrs < numInstrs);
+	
+	res->ns = benchPrvNow() - startTime;
+	res->instrs = cpuGetInstrCnt() - startInstrs;
+	res->excs = cpuGetRegExternal(K1);
+	cpuGetFusionStats(res->fused);
+}
+
+static void usage(const char *self)
+{
+	uint_fast8_t i;
+	
+	fprintf(stderr, "USAGE: %s [--instrs <N>] [--repeat <N>] [--tlb <entries>] [--json <file>] [workload ...]\n\tworkloads:", self);
+	for (i = 0; i < sizeof(mWorkloads) / sizeof(*mWorkloads); i++)
+		fprintf(stderr, " %s", mWorkloads[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv)
+{
+	static const struct option opts[] = {
+		{"instrs",	required_argument,	NULL,	'n'},
+		{"repeat",	required_argument,	NULL,	'r'},
+		{"tlb",		required_argument,	NULL,	't'},
+		{"json",	required_argument,	NULL,	'j'},
+		{"help",	no_argument,		NULL,	'h'},
+		{},
+	};
+	uint64_t numInstrs = 50000000;
+	uint32_t repeat = 3, tlbEntries = 64, r;
+	const char *jsonPath = NULL;
+	bool first = true, ret = true;
+	FILE *json = NULL;
+	uint_fast8_t i;
+	int opt, j;
+	
+	while ((opt = getopt_long(argc, argv, "n:r:t:j:h", opts, NULL)) != -1) {
+		switch (opt) {
+			case 'n':
+				numInstrs = strtoull(optarg, NULL, 0);
+				break;
+			
+			case 'r':
+				repeat = strtoul(optarg, NULL, 0);
+				break;
+			
+			case 't':	//every run does a cpuInit(), which applies it
+				tlbEntries = strtoul(optarg, NULL, 0);
+				if (!cpuSetTlbSize(tlbEntries)) {
+					usage(argv[0]);
+					return -1;
+				}
+				break;
+			
+			case 'j':
+				jsonPath = optarg;
+				break;
+			
+			default:
+				usage(argv[0]);
+				return -1;
+		}
+	}
+	
+	if (!numInstrs || !repeat) {
+		usage(argv[0]);
+		return -1;
+	}
+	
+	for (j = optind; j < argc; j++) {
+		for (i = 0; i < sizeof(mWorkloads) / sizeof(*mWorkloads) && strcmp(argv[j], mWorkloads[i].name); i++);
+		if (i == sizeof(mWorkloads) / sizeof(*mWorkloads)) {
+			fprintf(stderr, "unknown workload '%s'\n", argv[j]);
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	
+	if (!memRegionAddDirect(0, sizeof(mRam), benchPrvRamAccess, NULL, mRam)) {
+		fprintf(stderr, "cannot add RAM\n");
+		return -2;
+	}
+	
+	if (jsonPath) {
+		json = fopen(jsonPath, "w");
+		if (!json) {
+			fprintf(stderr, "cannot open '%s'\n", jsonPath);
+			return -2;
+		}
+		fprintf(json, "{\n\t\"instrsPerRun\": %llu,\n\t\"repeat\": %u,\n\t\"tlbEntries\": %u,\n\t\"compiler\": \"%s\",\n\t\"results\": [", (unsigned long long)numInstrs, repeat, (unsigned)tlbEntries, __VERSION__);
+	}
+	
+	fprintf(stderr, "%-12s %10s %10s %12s %12s %8s\n", "workload", "MIPS", "ns/instr", "exceptions", "ns/exc", "fused%");
+	
+	for (i = 0; i < sizeof(mWorkloads) / sizeof(*mWorkloads); i++) {
+		
+		const struct BenchWorkload *w = &mWorkloads[i];
+		struct BenchResult best = {}, cur;
+		double mips, nsPerInstr, nsPerExc, fusedPct;
+		uint64_t numFused = 0;
+		uint_fast8_t k;
+		
+		if (optind != argc) {
+			for (j = optind; j < argc && strcmp(argv[j], w->name); j++);
+			if (j == argc)
+				continue;
+		}
+		
+		for (r = 0; r < repeat; r++) {
+			
+			benchPrvRunOnce(w, numInstrs, &cur);
+			if (!r || cur.ns * best.instrs < best.ns * cur.instrs)
+				best = cur;
+		}
+		
+		if (w->expectExc != !!best.excs) {
+			fprintf(stderr, "workload '%s' took %llu exceptions, which is not expected\n", w->name, (unsigned long long)best.excs);
+			ret = false;
+		}
+		
+		mips = best.instrs * 1000.0 / best.ns;
+		nsPerInstr = (double)best.ns / best.instrs;
+		nsPerExc = best.excs ? (double)best.ns / best.excs : 0;
+		for (k = 0; k < CpuFusedNumKinds; k++)
+			numFused += best.fused[k];
+		fusedPct = numFused * 200.0 / best.instrs;		//of instrs that ran as half of a pair
+		
+		fprintf(stderr, "%-12s %10.2f %10.3f %12llu %12.1f %8.1f\n", w->name, mips, nsPerInstr, (unsigned long long)best.excs, nsPerExc, fusedPct);
+		
+		if (json) {
+			fprintf(json, "%s\n\t\t{\"name\": \"%s\", \"instrs\": %llu, \"ns\": %llu, \"mips\": %.3f, \"nsPerInstr\": %.4f, \"exceptions\": %llu, \"nsPerException\": %.2f, "
+				"\"fusedPct\": %.2f, \"fused\": {\"luiAlu\": %llu, \"luiMem\": %llu, \"cmpBranch\": %llu, \"loadNop\": %llu}}",
+				first ? "" : ",", w->name, (unsigned long long)best.instrs, (unsigned long long)best.ns, mips, nsPerInstr, (unsigned long long)best.excs, nsPerExc,
+				fusedPct, (unsigned long long)best.fused[CpuFusedLuiAlu], (unsigned long long)best.fused[CpuFusedLuiMem],
+				(unsigned long long)best.fused[CpuFusedCmpBranch], (unsigned long long)best.fused[CpuFusedLoadNop]);
+			first = false;
+		}
+	}
+	
+	if (json) {
+		fprintf(json, "\n\t]\n}\n");
+		fclose(json);
+	}
+	
+	return ret ? 0 : -3;
+}
@@ -13,28 +13,42 @@
 
 //#define R4000
 #define SUPPORT_LIKELY_BRANCHES	//sert to enable BxxL even on non-R4000
-//#define SUPPORT_MOVCC			//set to enable MOVN/MOVZ. technically part of MIPS IV, but our busysbox seems to need them
+#define SUPPORT_MOVCC			//set to build in MOVN/MOVZ. technically part of MIPS IV, but our busysbox seems to need them
 #define SUPPORT_TRAPCC			//set to eable Tcc/Tcci instrs  even for R3000
-//#define SUPPORT_MUL				//set to enable MUL. technically not even present in R4000, but....
-//#define SUPPORT_MAC				//set to enable MADD/MADDU/MSUB/MSUBU, even though lacking in R4000
-//#define SUPPORT_CLZ				//set to enable CLZ/CLO, even though lacking in R4000
-//#define SUPPORT_BITFIELD_OPS	//set to enable INS/EXT, even though lacking in R4000
-//#define SUPPORT_EXTEND_OPS		//set to enable SEH/SEB, even though lacking in R4000
-//#define SUPPORT_BYTESWAP		//set to enable WSBH, even though lacking in R4000
+#define SUPPORT_MUL				//set to build in MUL. technically not even present in R4000, but....
+#define SUPPORT_MAC				//set to build in MADD/MADDU/MSUB/MSUBU, even though lacking in R4000
+#define SUPPORT_CLZ				//set to build in CLZ/CLO, even though lacking in R4000
+#define SUPPORT_BITFIELD_OPS	//set to build in INS/EXT, even though lacking in R4000
+#define SUPPORT_EXTEND_OPS		//set to build in SEH/SEB, even though lacking in R4000
+#define SUPPORT_BYTESWAP		//set to build in WSBH, even though lacking in R4000
+								//(built in ones are still off until enabled by cpuSetIsaExts())
 #define SUPPORT_LL_SC
 #define SUPPORT_FPU
+#define SUPPORT_LOOP_IDIOMS		//set to run memset/memcpy-like guest loops as host memset/memcpy
+#define SUPPORT_FUSION			//set to run common instr pairs (lui+ori, slt+bne, lw+nop...) in one go
+
+#ifdef CPU_REFERENCE			//the reference engine does everything the slow way
+	#undef SUPPORT_LOOP_IDIOMS
+	#undef SUPPORT_FUSION
+#endif
 
 
 #include "cpu.h"
 #include "mem.h"
 #include "decBus.h"
+#ifdef SUPPORT_TRACE
+	#include "trace.h"
+#endif
 
-#define NUM_TLB_ENTRIES			64
+#define NUM_TLB_ENTRIES			64		//as on a real R3000, and the default
+#define MAX_TLB_ENTRIES			1024	//cpuSetTlbSize() may go up to this many. Index and Random have 10 bits for it
 #define NUM_WIRED_TLB_ENTRIES	8
 #define NUM_IRQS				8		//lower 2 are sw irqs
+#define TIMER_IRQ				7		//Count/Compare raises this one, as on R4000
 
-#define TLB_HASH_ENTRIES		128
-#define TLB_HASH(x)				((((x) >> 24) ^ ((x) >> 12)) % (TLB_HASH_ENTRIES))
+#define TLB_HASH_ENTRIES		(MAX_TLB_ENTRIES * 2)	//of which the first mTlbHashMask + 1 are used
+#define TLB_HASH(x)				((((x) >> 24) ^ ((x) >> 12)) & mTlbHashMask)
+#define TLB_INDEX(x)			(((x) >> 8) & 0x3ff)	//from Index and Random. bits 13..8 on an R3000, the rest are 0 there
 
 #ifdef R4000
 	#define PRID_VALUE				0x0400	//R4000
@@ -65,10 +79,16 @@ static struct {
 	uint8_t inDelaySlot	: 1;
 	uint8_t llbit		: 1;
 	
+	uint64_t instrCnt;		//instrs fetched and executed (or attempted)
+	
 	//this is CP0
 	uint32_t randomSeed;
 	uint32_t index, cause, status, epc, badva, entryHi, entryLo, context;
 	
+	//Count is instrCnt + countOfst (it ticks once per instr). timerIrqAt is the instrCnt at which it next equals Compare
+	uint32_t countOfst, compare;
+	uint64_t timerIrqAt;
+	
 	struct {
 		uint32_t va;	//top-aligned, bottom zero
 		uint32_t pa;	//top-aligned, bottom zero
@@ -86,14 +106,19 @@ static struct {
 		};
 		
 		//hashtable
-		int8_t prevIdx, nextIdx;
+		int16_t prevIdx, nextIdx;
 		
-	} tlb[NUM_TLB_ENTRIES];
+	} tlb[MAX_TLB_ENTRIES];
 	
-	int8_t tlbHash[TLB_HASH_ENTRIES];
+	int16_t tlbHash[TLB_HASH_ENTRIES];
 	
 } cpu;
 
+//not in "cpu", so that cpuInit() leaves the config be. it applies it, see cpuSetTlbSize()
+static uint_fast16_t mTlbEntriesCfg = NUM_TLB_ENTRIES, mTlbEntries = NUM_TLB_ENTRIES, mTlbHashMask = NUM_TLB_ENTRIES * 2 - 1;
+
+static uint64_t mPerf[CpuPerfNumEvents];	//see cpuGetPerfCounts(). instrs are not kept here
+
 #define TLB_ENTRYHI_VA_MASK		0xfffff000
 #define TLB_ENTRYHI_ASID_MASK	0x00000fc0
 #define TLB_ENTRYHI_ASID_SHIFT	6
@@ -333,6 +358,11 @@ void cpuIrq(uint_fast8_t idx, bool raise)
 static void cpuPrvTakeException(uint_fast8_t excCode)
 {
 	uint32_t vector = 0x80000000;
+#ifdef SUPPORT_TRACE
+	uint32_t excPc = cpu.pc;
+#endif
+	
+	mPerf[CpuPerfExceptions]++;
 #ifdef R4000
 	if (cpu.status & CP0_STATUS_EXL)
 		vector += EXC_OFST_EXL;
@@ -345,12 +375,14 @@ static void cpuPrvTakeException(uint_fast8_t excCode)
 		
 		case CP0_EXC_COD_REFILL_REQ | CP0_EXC_COD_TLBL:
 		case CP0_EXC_COD_REFILL_REQ | CP0_EXC_COD_TLBS:
+			mPerf[CpuPerfTlbRefills]++;
 			excCode &=~ CP0_EXC_COD_REFILL_REQ;
 			vector += EXC_OFST_NON_KU_TLB_REFILL;
 			break;
 		
 		case CP0_EXC_COD_REFILL_REQ | CP0_EXC_COD_KU | CP0_EXC_COD_TLBL:
 		case CP0_EXC_COD_REFILL_REQ | CP0_EXC_COD_KU | CP0_EXC_COD_TLBS:
+			mPerf[CpuPerfTlbRefills]++;
 			excCode &=~ (CP0_EXC_COD_REFILL_REQ | CP0_EXC_COD_KU);
 			vector += EXC_OFST_KU_TLB_REFILL;
 			break;
@@ -396,6 +428,11 @@ static void cpuPrvTakeException(uint_fast8_t excCode)
 	cpu.inDelaySlot = false;
 	cpu.pc = vector;
 	cpu.npc = vector + 4;
+
+#ifdef SUPPORT_TRACE
+	if (gTraceActive)
+		traceExc(excPc, cpu.cause, vector, cpu.badva);
+#endif
 }
 
 
@@ -525,8 +562,11 @@ void cpuSetRegExternal(uint8_t reg, uint32_t val)
 		err_str("Reg 0 external write");
 	else if (reg < MIPS_NUM_REGS)
 		cpu.regs[reg] = val;
-	else if (reg == MIPS_EXT_REG_PC)
+	else if (reg == MIPS_EXT_REG_PC) {
 		cpu.pc = val;
+		cpu.npc = val + 4;
+		cpu.inDelaySlot = false;
+	}
 	else if (reg == MIPS_EXT_REG_HI)
 		cpu.hi = val;
 	else if (reg == MIPS_EXT_REG_LO)
@@ -597,21 +637,21 @@ static inline int32_t cpuGetSImm(uint32_t instr)
 	return (int32_t)(int16_t)instr;
 }
 
-static void cpuPrvTlbHashRemove(uint_fast8_t idx)
+static void cpuPrvTlbHashRemove(uint_fast16_t idx)
 {
 	if (cpu.tlb[idx].nextIdx >= 0)
 		cpu.tlb[cpu.tlb[idx].nextIdx].prevIdx = cpu.tlb[idx].prevIdx;
 	
 	if (cpu.tlb[idx].prevIdx >= 0)
 		cpu.tlb[cpu.tlb[idx].prevIdx].nextIdx = cpu.tlb[idx].nextIdx;
-	else
+	else if (cpu.tlbHash[TLB_HASH(cpu.tlb[idx].va)] == (int_fast16_t)idx)	//never written ones are in no list
 		cpu.tlbHash[TLB_HASH(cpu.tlb[idx].va)] = cpu.tlb[idx].nextIdx;
 }
 
-static void cpuPrvTlbHashAdd(uint_fast8_t idx)
+static void cpuPrvTlbHashAdd(uint_fast16_t idx)
 {
-	uint_fast8_t bucket = TLB_HASH(cpu.tlb[idx].va);
-	int_fast8_t curPtr;
+	uint_fast16_t bucket = TLB_HASH(cpu.tlb[idx].va);
+	int_fast16_t curPtr;
 	
 	cpu.tlb[idx].nextIdx = curPtr = cpu.tlbHash[bucket];
 	cpu.tlb[idx].prevIdx = -1;
@@ -620,10 +660,10 @@ static void cpuPrvTlbHashAdd(uint_fast8_t idx)
 		cpu.tlb[curPtr].prevIdx = idx;
 }
 
-static int_fast8_t cpuPrvTlbHashSearch(uint32_t pageVa)
+static int_fast16_t cpuPrvTlbHashSearch(uint32_t pageVa)
 {
 	uint_fast8_t curAsid = (cpu.entryHi & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
-	int_fast8_t idx;
+	int_fast16_t idx;
 	
 	for (idx = cpu.tlbHash[TLB_HASH(pageVa)]; idx >= 0; idx = cpu.tlb[idx].nextIdx) {
 		
@@ -653,7 +693,7 @@ static void cpuPrvMaybeAsidChanded(uint32_t prevVal)
 
 static void cpuPrvTlbr(void)
 {
-	uint_fast8_t index = ((cpu.index >> 8) & 0x3f) % NUM_TLB_ENTRIES;
+	uint_fast16_t index = TLB_INDEX(cpu.index) % mTlbEntries;
 	uint32_t prevVal = cpu.entryHi;
 	
 	cpu.entryHi = cpu.tlb[index].va | (((uint32_t)cpu.tlb[index].asid) << TLB_ENTRYHI_ASID_SHIFT);
@@ -662,7 +702,7 @@ static void cpuPrvTlbr(void)
 	cpuPrvMaybeAsidChanded(prevVal);
 }
 
-static void cpuPrvTlbWrite(uint_fast8_t index)
+static void cpuPrvTlbWrite(uint_fast16_t index)
 {
 //	cpuPrvIcacheFlushPage(cpu.tlb[index].va);
 		
@@ -682,20 +722,42 @@ static void cpuPrvTlbWrite(uint_fast8_t index)
 
 static void cpuPrvTlbwi(void)
 {
-	uint_fast8_t index = ((cpu.index >> 8) & 0x3f) % NUM_TLB_ENTRIES;
+	uint_fast16_t index = TLB_INDEX(cpu.index) % mTlbEntries;
 	
 	cpuPrvTlbWrite(index);
 }
 
-static uint_fast8_t cpuPrvRefreshRandom(void)
+static uint32_t cpuPrvGetCount(void)
+{
+	return (uint32_t)cpu.instrCnt + cpu.countOfst;
+}
+
+static void cpuPrvTimerRecalc(void)
+{
+	uint64_t delta = (uint32_t)(cpu.compare - cpuPrvGetCount());
+	
+	//equal right now means it already fired (or was just set so), so next match is a full wrap away
+	if (!delta)
+		delta = 1ull << 32;
+	
+	cpu.timerIrqAt = cpu.instrCnt + delta;
+}
+
+static void cpuPrvTimerExpired(void)
+{
+	cpu.cause |= CP0_CAUSE_IP(TIMER_IRQ);
+	cpu.timerIrqAt += 1ull << 32;
+}
+
+static uint_fast16_t cpuPrvRefreshRandom(void)
 {
 	uint32_t rnd = cpu.randomSeed;
 	rnd *= 214013;
 	rnd += 2531011;
 	cpu.randomSeed = rnd;
 	
-	rnd >>= 24;
-	rnd %= (NUM_TLB_ENTRIES - NUM_WIRED_TLB_ENTRIES);
+	rnd >>= 16;		//enough bits to spread over MAX_TLB_ENTRIES evenly
+	rnd %= (mTlbEntries - NUM_WIRED_TLB_ENTRIES);
 	rnd += NUM_WIRED_TLB_ENTRIES;
 	
 	return rnd;
@@ -708,7 +770,7 @@ static void cpuPrvTlbwr(void)
 
 static void cpuPrvTlbp(void)
 {
-	int_fast8_t idx = cpuPrvTlbHashSearch(cpu.entryHi & TLB_ENTRYHI_VA_MASK);
+	int_fast16_t idx = cpuPrvTlbHashSearch(cpu.entryHi & TLB_ENTRYHI_VA_MASK);
 	
 	if (idx < 0)
 		cpu.index = 0x80000000;
@@ -728,7 +790,7 @@ static bool cpuPrvIsInKernelMode(void)
 
 static bool cpuPrvMemTranslate(uint32_t *paP, uint32_t va, bool write)
 {
-	int_fast8_t idx;
+	int_fast16_t idx;
 	
 	switch (va >> 29) {
 		case 0:
@@ -794,19 +856,279 @@ static bool cpuPrvMemTranslate(uint32_t *paP, uint32_t va, bool write)
 #define ICACHE_NUM_SETS	32
 #define ICACHE_NUM_WAYS	2
 
+#define INSTR_SLICE		1024	//a cpuCycle() that retires more than one instr never crosses a multiple of this many, so
+								//that things paced by the instr count (the RTC, see socRun()) happen exactly where they would
 
 
-struct IcacheLine {
+
+static struct IcacheLine {
 	uint32_t addr;	//kept as LSRed by ICACHE_LINE_SIZE, so 0xfffffffe is a valid "empty "sentinel
+#ifdef GDB_SUPPORT
+	bool hasBkpt;	//some instr in this line has a breakpoint, check before executing from it
+#endif
+#ifdef SUPPORT_FUSION
+	uint8_t fused;		//which instrs in icache[] are FUSED_OPCODE pseudo-instrs, see cpuPrvFusionScanLine()
+#endif
 	uint8_t icache[ICACHE_LINE_SZ];
+#ifdef SUPPORT_FUSION
+	uint32_t orig[ICACHE_LINE_SZ / 4];	//as they are in memory
+#endif
 } mIcache[ICACHE_NUM_SETS][ICACHE_NUM_WAYS];
 
+#ifdef SUPPORT_LOOP_IDIOMS
+
+	#define LOOP_MAX_INSTRS		24		//in the rotated body, see cpuPrvLoopAnalyze()
+	#define LOOP_MAX_MEM_OPS	16		//of each kind
+	#define LOOP_MAX_STEPS		4		//induction regs
+	#define LOOP_MAX_STEP		256		//bytes per pass
+	#define LOOP_CACHE_SZ		64
+	
+	enum LoopKind {
+		LoopNone,					//not something we do in bulk
+		LoopFill,					//stores of regs the loop does not change
+		LoopCopy,					//every load is stored once, unchanged
+	};
+	
+	struct LoopMemOp {
+		int16_t rel;				//from the base reg as it is at the start of a pass
+		uint8_t size;
+		uint8_t reg;				//stored or loaded into
+		bool signExt;				//loads
+		bool prevPass;				//stores of copies: of what was loaded in the previous pass
+	};
+	
+	//analyses are only valid for as long as the icache contents they were made from, so they are dropped together
+	static struct LoopIdiom {
+		uint32_t branchVa;
+		uint32_t gen;
+		uint8_t kind;
+		uint8_t numInstrs;			//rotated body, without the BNE
+		uint8_t dstReg, srcReg;
+		uint8_t cmpReg, limitReg;	//loop goes on while these differ. cmpReg steps, limitReg does not change
+		uint8_t numSteps, numStores, numLoads;
+		uint16_t step;				//bytes per pass, for both pointers
+		int16_t dstRel;				//a pass writes [dstReg + dstRel, + step)
+		int16_t srcRel;				//copies: from [srcReg + srcRel, + step)
+		uint16_t srcSpan;			//copies: bytes from srcReg + srcRel that the loads of a pass touch
+		struct {
+			uint8_t reg;
+			int16_t by;
+		} steps[LOOP_MAX_STEPS];
+		struct LoopMemOp stores[LOOP_MAX_MEM_OPS], loads[LOOP_MAX_MEM_OPS];
+	} mLoops[LOOP_CACHE_SZ];
+	static uint32_t mLoopGen = 1;
+	
+	static void cpuPrvLoopsForget(void)
+	{
+		if (!++mLoopGen) {
+			memset(mLoops, 0, sizeof(mLoops));
+			mLoopGen = 1;
+		}
+	}
+
+#endif
+
+#ifdef SUPPORT_FUSION
+	static uint64_t mFused[CpuFusedNumKinds];
+	#define FUSED_OPCODE	63		//SD, which we do not have. stands in for the first instr of a pair in the icache
+	
+	static struct IcacheLine *mFetchedFrom;
+#endif
+
+static uint32_t mIsaExts;		//CPU_ISA_*, see cpuSetIsaExts(). not in "cpu", so that cpuInit() leaves it be
+
+#ifdef SUPPORT_FPU
+	static uint8_t *mFpuDirect;			//see cpuPrvFpuDataAccess()
+	static uint32_t mFpuDirectPa, mFpuDirectSz;
+#endif
+
+#ifdef GDB_SUPPORT
+
+	#define DBG_MAX_BKPTS			64
+	#define DBG_MAX_WATCHPTS		8
+	#define DBG_WATCH_PAGE_HASH_SZ	256
+	
+	static struct {
+		uint32_t bkpts[DBG_MAX_BKPTS];
+		struct {
+			uint32_t va, len;
+			enum CpuWatchType type;
+		} watch[DBG_MAX_WATCHPTS];
+		uint8_t watchPageHash[DBG_WATCH_PAGE_HASH_SZ];	//how many watchpoints cover pages hashing here
+		uint8_t numBkpts, numWatches;
+		uint64_t noTrapInstrCnt;						//value instrCnt has while executing the instr we resume at
+	} mDbg;
+	
+	static bool cpuPrvDebugBkptInLine(uint32_t lineVa)
+	{
+		uint_fast8_t i;
+		
+		for (i = 0; i < mDbg.numBkpts; i++) {
+			if (mDbg.bkpts[i] / ICACHE_LINE_SZ == lineVa / ICACHE_LINE_SZ)
+				return true;
+		}
+		
+		return false;
+	}
+	
+	static bool __attribute__((noinline)) cpuPrvDebugBkptHit(uint32_t va)	//called before instrCnt is incremented for this instr
+	{
+		uint_fast8_t i;
+		
+		if (cpu.instrCnt + 1 == mDbg.noTrapInstrCnt)
+			return false;
+		
+		for (i = 0; i < mDbg.numBkpts; i++) {
+			if (mDbg.bkpts[i] == va) {
+				cpuExtDebugTrap(va, CpuWatchNone);
+				return true;
+			}
+		}
+		
+		return false;
+	}
+	
+	static bool __attribute__((noinline)) cpuPrvDebugWatchHit(uint32_t va, uint_fast8_t sz, bool write)
+	{
+		enum CpuWatchType need = write ? CpuWatchWrite : CpuWatchRead;
+		uint_fast8_t i;
+		
+		if (!mDbg.watchPageHash[(va >> 12) % DBG_WATCH_PAGE_HASH_SZ] || cpu.instrCnt == mDbg.noTrapInstrCnt)
+			return false;
+		
+		for (i = 0; i < mDbg.numWatches; i++) {
+			
+			if (!(mDbg.watch[i].type & need) || va + sz <= mDbg.watch[i].va || va - mDbg.watch[i].va >= mDbg.watch[i].len)
+				continue;
+			
+			cpuExtDebugTrap(mDbg.watch[i].va, mDbg.watch[i].type);
+			return true;
+		}
+		
+		return false;
+	}
+	
+	static void cpuPrvDebugWatchPagesAdjust(uint32_t va, uint32_t len, int_fast8_t by)
+	{
+		uint32_t page = va >> 12, lastPage = (va + len - 1) >> 12;
+		uint_fast16_t i;
+		
+		for (i = 0; i < DBG_WATCH_PAGE_HASH_SZ && page + i <= lastPage; i++)
+			mDbg.watchPageHash[(page + i) % DBG_WATCH_PAGE_HASH_SZ] += by;
+	}
+	
+	bool cpuDebugBkptSet(uint32_t va, bool set)
+	{
+		uint_fast8_t i;
+		
+		for (i = 0; i < mDbg.numBkpts && mDbg.bkpts[i] != va; i++);
+		
+		if (set && i == mDbg.numBkpts) {
+			if (mDbg.numBkpts == DBG_MAX_BKPTS)
+				return false;
+			mDbg.bkpts[mDbg.numBkpts++] = va;
+		}
+		else if (!set && i != mDbg.numBkpts)
+			mDbg.bkpts[i] = mDbg.bkpts[--mDbg.numBkpts];
+		
+		//lines get re-flagged as they are refilled
+		cpuPrvIcacheFlushEntire();
+		
+		return true;
+	}
+	
+	bool cpuDebugWatchSet(uint32_t va, uint32_t len, enum CpuWatchType type, bool set)
+	{
+		uint_fast8_t i;
+		
+		if (!len || !type)
+			return false;
+		
+		for (i = 0; i < mDbg.numWatches && (mDbg.watch[i].va != va || mDbg.watch[i].len != len || mDbg.watch[i].type != type); i++);
+		
+		if (set && i == mDbg.numWatches) {
+			if (mDbg.numWatches == DBG_MAX_WATCHPTS)
+				return false;
+			mDbg.watch[i].va = va;
+			mDbg.watch[i].len = len;
+			mDbg.watch[i].type = type;
+			mDbg.numWatches++;
+			cpuPrvDebugWatchPagesAdjust(va, len, 1);
+		}
+		else if (!set && i != mDbg.numWatches) {
+			cpuPrvDebugWatchPagesAdjust(va, len, -1);
+			mDbg.watch[i] = mDbg.watch[--mDbg.numWatches];
+		}
+		
+		return true;
+	}
+	
+	void cpuDebugClearAll(void)
+	{
+		uint64_t noTrapInstrCnt = mDbg.noTrapInstrCnt;
+		
+		memset(&mDbg, 0, sizeof(mDbg));
+		mDbg.noTrapInstrCnt = noTrapInstrCnt;
+		cpuPrvIcacheFlushEntire();
+	}
+	
+	void cpuDebugSkipTrapsOnce(void)
+	{
+		mDbg.noTrapInstrCnt = cpu.instrCnt + 1;
+	}
+	
+	void cpuDebugCodeChanged(void)
+	{
+		cpuPrvIcacheFlushEntire();
+	}
+
+#endif
+
+
+#if defined(SUPPORT_LOOP_IDIOMS) || defined(SUPPORT_FUSION)
+
+	static struct IcacheLine* cpuPrvIcacheFind(uint32_t va)	//only if cached, no fills
+	{
+		struct IcacheLine *line = mIcache[(va / ICACHE_LINE_SZ) % ICACHE_NUM_SETS];
+		uint_fast8_t i;
+		
+		for (i = 0; i < ICACHE_NUM_WAYS; i++, line++) {
+			
+			if (line->addr == va / ICACHE_LINE_SZ)
+				return line;
+		}
+		
+		return NULL;
+	}
+
+#endif
+
+#ifdef SUPPORT_LOOP_IDIOMS
+
+	static bool cpuPrvIcachePeek(uint32_t va, uint32_t *instrP)	//only if cached, no fills
+	{
+		struct IcacheLine *line = cpuPrvIcacheFind(va);
+		
+		if (!line)
+			return false;
+	#ifdef SUPPORT_FUSION
+		*instrP = line->orig[(va % ICACHE_LINE_SZ) / 4];
+	#else
+		*instrP = *(uint32_t*)(&line->icache[(va % ICACHE_LINE_SZ)]);
+	#endif
+		return true;
+	}
+
+#endif
 
 static void __attribute__((used)) cpuPrvIcacheFlushEntire(void)
 {
 	uint_fast16_t i, j;
 	
 	memset(mIcache, 0xff, sizeof(mIcache));
+#ifdef SUPPORT_LOOP_IDIOMS
+	cpuPrvLoopsForget();
+#endif
 }
 
 static void __attribute__((used)) cpuPrvIcacheFlushPage(uint32_t va)
@@ -821,14 +1143,88 @@ static void __attribute__((used)) cpuPrvIcacheFlushPage(uint32_t va)
 		if (line->addr == va / ICACHE_LINE_SZ)
 			line->addr = 0xffffffff;
 	}
+#ifdef SUPPORT_LOOP_IDIOMS
+	cpuPrvLoopsForget();
+#endif
 }
 
+#ifdef SUPPORT_FUSION
+
+	//pairs are found once, as lines are filled. all of them are in one icache line, so in one page
+	static uint_fast8_t cpuPrvFusionPairOf(uint32_t instr, uint32_t next)	//CpuFusedPair + 1, or 0 if no pair
+	{
+		uint_fast8_t rd;
+		
+		switch (instr >> 26) {
+			case 0:		//SLT, SLTU
+				if ((instr & 0x3f) != 42 && (instr & 0x3f) != 43)
+					return 0;
+				rd = cpuGetRegNumD(instr);
+				break;
+			
+			case 10:	//SLTI
+			case 11:	//SLTIU
+				rd = cpuGetRegNumT(instr);
+				break;
+			
+			case 15:	//LUI, then ADDIU/ORI/LW/SW off that reg
+				rd = cpuGetRegNumT(instr);
+				if (!rd || cpuGetRegNumS(next) != rd)
+					return 0;
+				switch (next >> 26) {
+					case 9:
+					case 13:
+						return CpuFusedLuiAlu + 1;
+					
+					case 35:
+					case 43:
+						return CpuFusedLuiMem + 1;
+					
+					default:
+						return 0;
+				}
+			
+			case 35:	//LW, then NOP
+				return next ? 0 : CpuFusedLoadNop + 1;
+			
+			default:
+				return 0;
+		}
+		
+		//compares, then BEQ/BNE of the result against $zero
+		if (!rd || (next >> 27) != (4 >> 1) || (cpuGetRegNumS(next) | cpuGetRegNumT(next)) != rd || (cpuGetRegNumS(next) && cpuGetRegNumT(next)))
+			return 0;
+		
+		return CpuFusedCmpBranch + 1;
+	}
+	
+	//the first instr of each pair is replaced, so that cpuCycle() gets to pairs through its usual dispatch, at no cost
+	//to other instrs. the pair kind is kept in the pseudo-instr
+	static void cpuPrvFusionScanLine(struct IcacheLine *line)
+	{
+		uint32_t *instrs = (uint32_t*)line->icache;
+		uint_fast8_t i, kind;
+		
+		memcpy(line->orig, line->icache, sizeof(line->orig));
+		line->fused = 0;
+		for (i = 0; i < ICACHE_LINE_SZ / 4 - 1; i++) {
+			
+			kind = cpuPrvFusionPairOf(line->orig[i], line->orig[i + 1]);
+			if (kind) {
+				instrs[i] = (((uint32_t)FUSED_OPCODE) << 26) | (kind - 1);
+				line->fused |= 1 << i;
+			}
+		}
+	}
+
+#endif
+
 static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if false, do nothing, all has been handled
 {
 	uint32_t va = cpu.pc, pa;
 	struct IcacheLine *line;
 	uint_fast16_t i, set;
-	static int rng = 1;
+	static uint32_t rng = 1;
 
 //pretty hard to do this, so let's not check
 //	if (va & 3) {
@@ -849,6 +1245,7 @@ static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if
 	}
 	
 	//miss
+	mPerf[CpuPerfIcacheMisses]++;
 	line = mIcache[set];
 	
 	rng *= 214013;
@@ -866,8 +1263,21 @@ static bool __attribute__((used)) cpuPrvInstrFetchCached(uint32_t *instrP)	//if
 		return false;
 	}
 	line->addr = va / ICACHE_LINE_SZ;
+#ifdef GDB_SUPPORT
+	line->hasBkpt = mDbg.numBkpts && cpuPrvDebugBkptInLine(va);
+#endif
+#ifdef SUPPORT_FUSION
+	cpuPrvFusionScanLine(line);
+#endif
 	
 hit:
+#ifdef GDB_SUPPORT
+	if (line->hasBkpt && cpuPrvDebugBkptHit(va))
+		return false;
+#endif
+#ifdef SUPPORT_FUSION
+	mFetchedFrom = line;
+#endif
 	*instrP = *(uint32_t*)(&line->icache[(va % ICACHE_LINE_SZ)]);	//god, i hope gcc optimizes this wel...
 	return true;
 }
@@ -876,6 +1286,11 @@ static bool __attribute__((used)) cpuPrvInstrFetch(uint32_t *instrP)	//if false,
 {
 	uint32_t va = cpu.pc, pa;
 	
+#ifdef GDB_SUPPORT
+	if (mDbg.numBkpts && cpuPrvDebugBkptHit(va))
+		return false;
+#endif
+	
 	if (!cpuPrvMemTranslate(&pa, va, false))
 		return false;
 	
@@ -899,6 +1314,11 @@ static bool cpuPrvDataAccess(void* buf, uint32_t va, uint_fast8_t sz, bool write
 		return false;
 	}
 	
+#ifdef GDB_SUPPORT
+	if (mDbg.numWatches && cpuPrvDebugWatchHit(va, sz, write))
+		return false;
+#endif
+	
 	if (!cpuPrvMemTranslate(&pa, va, write))
 		return false;
 
@@ -931,17 +1351,74 @@ static bool cpuPrvDataAccess(void* buf, uint32_t va, uint_fast8_t sz, bool write
 		return true;
 	}
 
-	if (memAccess(pa, sz, write, buf))
+	if (memAccess(pa, sz, write, buf)) {
+		
+	#ifdef SUPPORT_TRACE
+		if (gTraceActive)
+			traceMem(va, buf, sz, write);
+	#endif
 		return true;
+	}
 	
 	cpuPrvTakeBusError(pa, false);
 
 	return false;
 }
 
+#ifdef SUPPORT_FPU
+
+	//FP code is mostly FPU loads and stores, and they all go to RAM, so they skip memAccess() and its walk over
+	//the regions: the direct region last used is remembered, from the page it was found through onwards. anything
+	//unusual (misaligned, ISC, watchpoints, tracing, not plain memory) goes the usual way
+	static bool cpuPrvFpuDataAccess(void *buf, uint32_t va, uint_fast8_t sz, bool write)
+	{
+		uint32_t pa;
+		
+		if ((va & (sz - 1)) || (cpu.status & CP0_STATUS_ISC))
+			return cpuPrvDataAccess(buf, va, sz, write);
+	#ifdef GDB_SUPPORT
+		if (mDbg.numWatches)
+			return cpuPrvDataAccess(buf, va, sz, write);
+	#endif
+	#ifdef SUPPORT_TRACE
+		if (gTraceActive)
+			return cpuPrvDataAccess(buf, va, sz, write);
+	#endif
+		
+		if (!cpuPrvMemTranslate(&pa, va, write))
+			return false;
+		
+		if (pa - mFpuDirectPa >= mFpuDirectSz) {
+			
+			mFpuDirectPa = pa &~ 4095;
+			mFpuDirect = memGetDirectPtr(mFpuDirectPa, 4096);
+			mFpuDirectSz = mFpuDirect ? memGetDirectSz(mFpuDirectPa) : 0;
+			
+			if (!mFpuDirect) {
+				
+				if (memAccess(pa, sz, write, buf))
+					return true;
+				
+				cpuPrvTakeBusError(pa, false);
+				return false;
+			}
+		}
+		
+		//aligned, so never straddles the end
+		if (write)
+			memcpy(mFpuDirect + (pa - mFpuDirectPa), buf, sz);
+		else
+			memcpy(buf, mFpuDirect + (pa - mFpuDirectPa), sz);
+		
+		return true;
+	}
+
+#endif
+
 bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type)
 {
-	uint_fast8_t i, curAsid;
+	uint_fast8_t curAsid;
+	uint_fast16_t i;
 	uint32_t pageVa, pa;
 		
 	
@@ -980,7 +1457,7 @@ bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, e
 	pageVa = va & TLB_ENTRYHI_VA_MASK;
 	curAsid = (cpu.entryHi & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT;
 	
-	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+	for (i = 0; i < mTlbEntries; i++) {
 		
 		//VA must match
 		if (cpu.tlb[i].va != pageVa)
@@ -1045,13 +1522,599 @@ static void cpuPrvBranchTo(uint32_t to)
 	}
 #endif
 
-static bool report = 0;
+#ifdef SUPPORT_LOOP_IDIOMS
 
-void cpuReportCy(void)
+	static bool cpuPrvMemTranslateQuiet(uint32_t *paP, uint32_t va, bool write)	//false where cpuPrvMemTranslate() would take an exception
+	{
+		int_fast16_t idx;
+		
+		if ((va >> 31) && !cpuPrvIsInKernelMode())
+			return false;
+		
+		if ((va >> 30) == 2) {	//kseg0, kseg1
+			*paP = va &~ 0xe0000000;
+			return true;
+		}
+	#ifdef R4000
+		if (!(va >> 31) && (cpu.status & CP0_STATUS_ERL)) {
+			*paP = va;
+			return true;
+		}
+	#endif
+		
+		idx = cpuPrvTlbHashSearch(va & TLB_ENTRYHI_VA_MASK);
+		if (idx < 0 || !cpu.tlb[idx].v || (write && !cpu.tlb[idx].d))
+			return false;
+		
+		*paP = cpu.tlb[idx].pa | (va &~ TLB_ENTRYHI_VA_MASK);
+		return true;
+	}
+	
+	static bool cpuPrvLoopMemOpsCover(const struct LoopMemOp *ops, uint_fast8_t numOps, int_fast16_t from, uint_fast16_t len)	//each byte of [from, from + len) exactly once
+	{
+		uint8_t covered[LOOP_MAX_STEP] = {0, };
+		uint_fast16_t i, j, total = 0;
+		
+		for (i = 0; i < numOps; i++) {
+			
+			if (ops[i].rel < from || ops[i].rel - from + ops[i].size > (int_fast16_t)len)
+				return false;
+			
+			for (j = 0; j < ops[i].size; j++) {
+				if (covered[ops[i].rel - from + j]++)
+					return false;
+			}
+			total += ops[i].size;
+		}
+		
+		return total == len;
+	}
+	
+	/*
+		we look at a loop when the BNE closing it is taken. the pass we analyze starts with the BNE's delay slot and goes
+		on from the branch target up to the BNE, so that it takes us from one execution of the BNE to the next. allowed in
+		it: nops, "addiu rX, rX, imm" (induction regs, once each), and loads and stores based on induction regs. either
+		all stores are of regs the loop does not change (memset-like), or each store is of a reg loaded in the pass
+		(or in the previous one, as gcc likes to put the store in the delay slot), and together they copy a block
+	*/
+	static void cpuPrvLoopAnalyze(struct LoopIdiom *li, uint32_t branchInstr, uint32_t branchVa)
+	{
+		uint32_t instrs[LOOP_MAX_INSTRS], stepped = 0, steppedSoFar = 0, written, loaded = 0, stored = 0, va;
+		uint_fast8_t i, j, rs, rt, size, opc, storePos[LOOP_MAX_MEM_OPS], loadPos[LOOP_MAX_MEM_OPS];
+		int_fast16_t by[MIPS_NUM_REGS] = {0, }, minRel, srcSpan = 0, cRel = 0, thisCRel;
+		int_fast32_t n = -(int16_t)branchInstr;
+		struct LoopMemOp *op;
+		
+		memset(li, 0, sizeof(*li));
+		li->branchVa = branchVa;
+		li->gen = mLoopGen;
+		li->kind = LoopNone;
+		
+		if (n > LOOP_MAX_INSTRS)
+			return;
+		li->numInstrs = n;
+		
+		//delay slot, then the body
+		for (i = 0; i < n; i++) {
+			va = i ? branchVa - 4 * (n - i) : branchVa + 4;
+			if (!cpuPrvIcachePeek(va, &instrs[i])) {
+				li->gen = 0;	//do not remember this, it may work once all of it is cached
+				return;
+			}
+		}
+		
+		for (i = 0; i < n; i++) {
+			
+			if ((instrs[i] >> 26) != 9)	//ADDIU
+				continue;
+			rs = cpuGetRegNumS(instrs[i]);
+			if (!rs || rs != cpuGetRegNumT(instrs[i]) || !cpuGetSImm(instrs[i]) || (stepped & (1UL << rs)) || li->numSteps == LOOP_MAX_STEPS)
+				return;
+			stepped |= 1UL << rs;
+			by[rs] = cpuGetSImm(instrs[i]);
+			li->steps[li->numSteps].reg = rs;
+			li->steps[li->numSteps++].by = by[rs];
+		}
+		
+		for (i = 0; i < n; i++) {
+			
+			opc = instrs[i] >> 26;
+			rs = cpuGetRegNumS(instrs[i]);
+			rt = cpuGetRegNumT(instrs[i]);
+			
+			if (!instrs[i])
+				continue;
+			
+			if (opc == 9) {
+				steppedSoFar |= 1UL << rs;
+				continue;
+			}
+			
+			switch (opc) {
+				case 32:	//LB
+				case 36:	//LBU
+				case 40:	//SB
+					size = 1;
+					break;
+				
+				case 33:	//LH
+				case 37:	//LHU
+				case 41:	//SH
+					size = 2;
+					break;
+				
+				case 35:	//LW
+				case 43:	//SW
+					size = 4;
+					break;
+				
+				default:
+					return;
+			}
+			
+			if (!(stepped & (1UL << rs)))
+				return;
+			
+			if (opc < 40) {		//load: into a reg nothing else writes, once, from the one source pointer
+				
+				if (!rt || ((stepped | loaded) & (1UL << rt)) || li->numLoads == LOOP_MAX_MEM_OPS || (li->srcReg && li->srcReg != rs))
+					return;
+				li->srcReg = rs;
+				loaded |= 1UL << rt;
+				loadPos[li->numLoads] = i;
+				op = &li->loads[li->numLoads++];
+				op->signExt = opc < 35;		//LB, LH
+			}
+			else {				//store: to the one destination pointer
+				
+				if (li->numStores == LOOP_MAX_MEM_OPS || (li->dstReg && li->dstReg != rs))
+					return;
+				li->dstReg = rs;
+				storePos[li->numStores] = i;
+				op = &li->stores[li->numStores++];
+			}
+			op->rel = cpuGetSImm(instrs[i]) + ((steppedSoFar & (1UL << rs)) ? by[rs] : 0);
+			op->size = size;
+			op->reg = rt;
+		}
+		written = stepped | loaded;
+		
+		//the pointers step forward by the same amount
+		if (!li->numStores || li->srcReg == li->dstReg || by[li->dstReg] <= 0 || by[li->dstReg] > LOOP_MAX_STEP || (li->numLoads && by[li->srcReg] != by[li->dstReg]))
+			return;
+		li->step = by[li->dstReg];
+		
+		//the BNE compares an induction reg to a reg the loop does not change
+		rs = cpuGetRegNumS(branchInstr);
+		rt = cpuGetRegNumT(branchInstr);
+		if ((stepped & (1UL << rt)) && !(written & (1UL << rs))) {
+			li->cmpReg = rt;
+			li->limitReg = rs;
+		}
+		else if ((stepped & (1UL << rs)) && !(written & (1UL << rt))) {
+			li->cmpReg = rs;
+			li->limitReg = rt;
+		}
+		else
+			return;
+		
+		//stores write each byte of a block of step bytes once, with naturally aligned accesses
+		for (minRel = 0x7fff, i = 0; i < li->numStores; i++) {
+			if (li->step % li->stores[i].size)
+				return;
+			if (li->stores[i].rel < minRel)
+				minRel = li->stores[i].rel;
+		}
+		if (!cpuPrvLoopMemOpsCover(li->stores, li->numStores, minRel, li->step))
+			return;
+		li->dstRel = minRel;
+		
+		if (!li->numLoads) {
+			
+			for (i = 0; i < li->numStores; i++) {
+				if (written & (1UL << li->stores[i].reg))
+					return;
+			}
+			li->kind = LoopFill;
+			return;
+		}
+		
+		//each load is stored exactly once, and byte x of the destination block comes from byte x of the source block
+		for (i = 0; i < li->numStores; i++) {
+			
+			for (j = 0; j < li->numLoads && li->loads[j].reg != li->stores[i].reg; j++);
+			if (j == li->numLoads || li->loads[j].size != li->stores[i].size || (stored & (1UL << li->stores[i].reg)))
+				return;
+			stored |= 1UL << li->stores[i].reg;
+			
+			//loaded after the store means it is stored one pass later
+			li->stores[i].prevPass = loadPos[j] > storePos[i];
+			thisCRel = li->stores[i].rel - li->loads[j].rel + (li->stores[i].prevPass ? li->step : 0);
+			if (i && thisCRel != cRel)
+				return;
+			cRel = thisCRel;
+		}
+		if (stored != loaded)
+			return;
+		li->srcRel = li->dstRel - cRel;
+		
+		for (i = 0; i < li->numLoads; i++) {
+			if (li->loads[i].rel < li->srcRel)
+				return;
+			if (li->loads[i].rel + li->loads[i].size - li->srcRel > srcSpan)
+				srcSpan = li->loads[i].rel + li->loads[i].size - li->srcRel;
+		}
+		li->srcSpan = srcSpan > li->step ? srcSpan : li->step;
+		li->kind = LoopCopy;
+	}
+	
+	static bool cpuPrvLoopRangeOk(uint8_t **hostP, uint32_t *paP, uint32_t va, uint32_t len, bool write)		//one page, plain RAM
+	{
+		if ((va % 4096) + len > 4096 || !cpuPrvMemTranslateQuiet(paP, va, write))
+			return false;
+		
+		*hostP = memGetDirectPtr(*paP, len);
+		return !!*hostP;
+	}
+	
+	static bool cpuPrvLoopOverlaps(uint32_t aPa, uint32_t aLen, uint32_t bPa, uint32_t bLen)
+	{
+		return aPa - bPa < bLen || bPa - aPa < aLen;
+	}
+	
+	//called for a taken BNE going backwards. if it closes a loop we can do in bulk, do as many passes as is safe and
+	//leave pc on the BNE, as if we had just gotten there. the guest cannot tell, except by how long it took
+	static bool cpuPrvLoopIdiom(uint32_t branchInstr)
+	{
+		uint32_t branchVa = cpu.pc, cmpBy, dist, numPasses, instrsLeft, dstVa, srcVa = 0, dstPa, srcPa, codePa, val;
+		struct LoopIdiom *li = &mLoops[(branchVa / 4) % LOOP_CACHE_SZ];
+		uint8_t *dst, *src = NULL, pattern[LOOP_MAX_STEP];
+		const struct LoopMemOp *op;
+		uint_fast16_t i;
+		
+		if (li->branchVa != branchVa || li->gen != mLoopGen)
+			cpuPrvLoopAnalyze(li, branchInstr, branchVa);
+		if (li->kind == LoopNone)
+			return false;
+		
+		//things that need every instr or access to be seen, an irq that would be taken at the top of the loop
+		if (cpu.inDelaySlot || (cpu.status & CP0_STATUS_ISC))
+			return false;
+	#ifdef SUPPORT_TRACE
+		if (gTraceActive)
+			return false;
+	#endif
+	#ifdef GDB_SUPPORT
+		if (mDbg.numBkpts || mDbg.numWatches)
+			return false;
+	#endif
+		if ((cpu.status & CP0_STATUS_IE) &&
+	#ifdef R4000
+			!(cpu.status & CP0_STATUS_EXL) &&
+	#endif
+			cpuPrvIrqsPending())
+			return false;
+		
+		//passes till the BNE falls through
+		for (i = 0; i < li->numSteps && li->steps[i].reg != li->cmpReg; i++);
+		dist = cpu.regs[li->limitReg] - cpu.regs[li->cmpReg];
+		if (li->steps[i].by < 0) {
+			cmpBy = -li->steps[i].by;
+			dist = -dist;
+		}
+		else
+			cmpBy = li->steps[i].by;
+		if (dist % cmpBy)
+			return false;
+		numPasses = dist / cmpBy;
+		
+		//a pass is numInstrs + the BNE, the last BNE is left to the interpreter. stop short of the timer and slice ends
+		instrsLeft = INSTR_SLICE - cpu.instrCnt % INSTR_SLICE;
+		if (cpu.timerIrqAt - cpu.instrCnt <= instrsLeft)
+			instrsLeft = cpu.timerIrqAt - cpu.instrCnt - 1;
+		if (numPasses > (instrsLeft + 1) / (li->numInstrs + 1))
+			numPasses = (instrsLeft + 1) / (li->numInstrs + 1);
+		
+		//within the pages the first pass touches
+		dstVa = cpu.regs[li->dstReg] + li->dstRel;
+		if (numPasses > (4096 - dstVa % 4096) / li->step)
+			numPasses = (4096 - dstVa % 4096) / li->step;
+		if (li->kind == LoopCopy) {
+			srcVa = cpu.regs[li->srcReg] + li->srcRel;
+			if (4096 - srcVa % 4096 < li->srcSpan)
+				return false;
+			if (numPasses > (4096 - srcVa % 4096 - li->srcSpan) / li->step + 1)
+				numPasses = (4096 - srcVa % 4096 - li->srcSpan) / li->step + 1;
+		}
+		if (numPasses < 2)
+			return false;
+		
+		//aligned, mapped, plain RAM, not the loop itself, and copies do not overlap
+		for (i = 0, op = li->stores; i < li->numStores; i++, op++) {
+			if ((cpu.regs[li->dstReg] + op->rel) % op->size)
+				return false;
+		}
+		for (i = 0, op = li->loads; i < li->numLoads; i++, op++) {
+			if ((cpu.regs[li->srcReg] + op->rel) % op->size)
+				return false;
+		}
+		if (!cpuPrvLoopRangeOk(&dst, &dstPa, dstVa, numPasses * li->step, true))
+			return false;
+		if (li->kind == LoopCopy && (!cpuPrvLoopRangeOk(&src, &srcPa, srcVa, (numPasses - 1) * li->step + li->srcSpan, false) ||
+				cpuPrvLoopOverlaps(dstPa, numPasses * li->step, srcPa, (numPasses - 1) * li->step + li->srcSpan)))
+			return false;
+		for (i = 0; i < 2; i++) {		//first and last instr, the loop may span a page boundary
+			if (!cpuPrvMemTranslateQuiet(&codePa, i ? branchVa + 4 : branchVa - 4 * (li->numInstrs - 1), false) ||
+					cpuPrvLoopOverlaps(dstPa, numPasses * li->step, codePa - 4 * li->numInstrs, 8 * li->numInstrs + 4))
+				return false;
+		}
+		
+		if (li->kind == LoopFill) {
+			
+			for (i = 0, op = li->stores; i < li->numStores; i++, op++)
+				memcpy(pattern + op->rel - li->dstRel, &cpu.regs[op->reg], op->size);	//LE host, low bytes first
+			
+			for (i = 1; i < li->step && pattern[i] == pattern[0]; i++);
+			if (i == li->step)
+				memset(dst, pattern[0], numPasses * li->step);
+			else for (i = 0; i < numPasses; i++)
+				memcpy(dst + i * li->step, pattern, li->step);
+		}
+		else {
+			
+			memcpy(dst, src, numPasses * li->step);
+			
+			//what the first pass stores from the previous one is in regs. we may have come in at the bottom of the loop
+			for (i = 0, op = li->stores; i < li->numStores; i++, op++) {
+				if (op->prevPass)
+					memcpy(dst + op->rel - li->dstRel, &cpu.regs[op->reg], op->size);
+			}
+			
+			//regs loaded in the last pass
+			for (i = 0, op = li->loads; i < li->numLoads; i++, op++) {
+				
+				val = 0;
+				memcpy(&val, src + (numPasses - 1) * li->step + op->rel - li->srcRel, op->size);
+				if (op->signExt)
+					val = op->size == 1 ? (uint32_t)(int32_t)(int8_t)val : (uint32_t)(int32_t)(int16_t)val;
+				cpu.regs[op->reg] = val;
+			}
+		}
+		
+		for (i = 0; i < li->numSteps; i++)
+			cpu.regs[li->steps[i].reg] += numPasses * li->steps[i].by;
+		
+		cpu.instrCnt += numPasses * (li->numInstrs + 1) - 1;
+		cpu.pc = branchVa;
+		cpu.npc = branchVa + 4;
+		cpu.inDelaySlot = false;
+		
+		return true;
+	}
+
+#endif
+
+#ifdef SUPPORT_FUSION
+
+	//nothing could happen between the two instrs of a pair that would be seen: no irq would be taken, no tracing or
+	//debugger stepping is going on, and no slice boundary (see INSTR_SLICE) is crossed
+	static inline bool cpuPrvFusionAllowed(void)
+	{
+		if (!(cpu.instrCnt % INSTR_SLICE))
+			return false;
+	#ifdef SUPPORT_TRACE
+		if (gTraceActive)
+			return false;
+	#endif
+	#ifdef GDB_SUPPORT
+		if (mDbg.numBkpts || cpu.instrCnt == mDbg.noTrapInstrCnt)
+			return false;
+	#endif
+		
+		return !((cpu.status & CP0_STATUS_IE) &&
+	#ifdef R4000
+			!(cpu.status & CP0_STATUS_EXL) &&
+	#endif
+			cpuPrvIrqsPending());
+	}
+	
+	static inline void cpuPrvFusionRetireFirst(enum CpuFusedPair kind)	//the second instr now is the current one
+	{
+		mFused[kind]++;
+		cpuPrvNoBranchTaken();
+		if (++cpu.instrCnt == cpu.timerIrqAt)
+			cpuPrvTimerExpired();
+	}
+	
+	//run a FUSED_OPCODE pseudo-instr: the pair (see cpuPrvFusionPairOf()) in one go, or return false to have
+	//*instrP run alone. it is then the real first instr, or left alone if it was a real SD. the second instr of a pair
+	//can fault only in LUI+LW/SW, and by then the LUI is retired and pc is on the access, exactly as if they ran one
+	//at a time
+	static bool cpuPrvFusedPair(uint32_t *instrP)
+	{
+		struct IcacheLine *line = mFetchedFrom;
+		uint_fast8_t slot = (cpu.pc % ICACHE_LINE_SZ) / 4, rd;
+		enum CpuFusedPair kind = (enum CpuFusedPair)(*instrP & 0xff);
+		uint32_t instr, next, val;
+		
+		if (!line || !(line->fused & (1 << slot)))
+			return false;
+		instr = *instrP = line->orig[slot];
+		next = line->orig[slot + 1];
+		
+		//a delay slot instr is followed by the branch target, not by what is next in the line
+		if (cpu.inDelaySlot)
+			return false;
+		
+		switch (kind) {
+			case CpuFusedLuiAlu:
+			case CpuFusedLuiMem:
+				if (!cpuPrvFusionAllowed())
+					return false;
+				val = cpuGetUImm(instr) << 16;
+				cpu.regs[cpuGetRegNumT(instr)] = val;
+				cpuPrvFusionRetireFirst(kind);
+				
+				switch (next >> 26) {
+					case 9:		//ADDIU
+						cpuSetRegT(next, val + cpuGetSImm(next));
+						break;
+					
+					case 13:	//ORI
+						cpuSetRegT(next, val | cpuGetUImm(next));
+						break;
+					
+					case 35:	//LW
+						if (!cpuPrvDataAccess(&val, val + cpuGetSImm(next), 4, false))
+							return true;
+						cpuSetRegT(next, val);
+						break;
+					
+					default:	//SW
+						val = cpuGetRegT(next);
+						if (!cpuPrvDataAccess(&val, cpuGetRegS(next) + cpuGetSImm(next), 4, true))
+							return true;
+						break;
+				}
+				break;
+			
+			case CpuFusedCmpBranch:
+				if (!cpuPrvFusionAllowed())
+					return false;
+				switch (instr >> 26) {
+					case 0:		//SLT, SLTU
+						rd = cpuGetRegNumD(instr);
+						val = (instr & 1) ? cpuGetRegS(instr) < cpuGetRegT(instr) : (int32_t)cpuGetRegS(instr) < (int32_t)cpuGetRegT(instr);
+						break;
+					
+					case 10:	//SLTI
+						rd = cpuGetRegNumT(instr);
+						val = (int32_t)cpuGetRegS(instr) < cpuGetSImm(instr);
+						break;
+					
+					default:	//SLTIU
+						rd = cpuGetRegNumT(instr);
+						val = cpuGetRegS(instr) < (uint32_t)cpuGetSImm(instr);
+						break;
+				}
+				cpu.regs[rd] = val;
+				cpuPrvFusionRetireFirst(kind);
+				
+				if (!val == !((next >> 26) & 1)) {		//BEQ (opcode 4) is taken when val is 0, BNE (5) when it is not
+					cpuPrvBranchTo(cpu.npc + (cpuGetSImm(next) << 2));
+					return true;
+				}
+				break;
+			
+			default:	//LW, NOP. the load may have side effects (irqs), so whether we go on is decided after it
+				if (!cpuPrvDataAccess(&val, cpuGetRegS(instr) + cpuGetSImm(instr), 4, false))
+					return true;
+				cpuSetRegT(instr, val);
+				if (cpuPrvFusionAllowed())
+					cpuPrvFusionRetireFirst(kind);
+				break;
+		}
+		
+		cpuPrvNoBranchTaken();
+		return true;
+	}
+
+#endif
+
+#ifdef SUPPORT_TRACE
+
+	static uint32_t cpuPrvTracedInstr(uint32_t instr)		//as it is in memory
+	{
+	#ifdef SUPPORT_FUSION
+		struct IcacheLine *line;
+		
+		if ((instr >> 26) == FUSED_OPCODE && (line = cpuPrvIcacheFind(cpu.pc)) && (line->fused & (1 << ((cpu.pc % ICACHE_LINE_SZ) / 4))))
+			return line->orig[(cpu.pc % ICACHE_LINE_SZ) / 4];
+	#endif
+		return instr;
+	}
+
+#endif
+
+uint32_t cpuGetCyCnt(void)
+{
+	return cpu.instrCnt;
+}
+
+uint64_t cpuGetInstrCnt(void)
+{
+	return cpu.instrCnt;
+}
+
+void cpuSetIsaExts(uint32_t exts)
+{
+	uint32_t have = 0;
+	
+#ifdef SUPPORT_MOVCC
+	have |= CPU_ISA_MOVCC;
+#endif
+#ifdef SUPPORT_MUL
+	have |= CPU_ISA_MUL;
+#endif
+#ifdef SUPPORT_MAC
+	have |= CPU_ISA_MAC;
+#endif
+#ifdef SUPPORT_CLZ
+	have |= CPU_ISA_CLZ;
+#endif
+#ifdef SUPPORT_BITFIELD_OPS
+	have |= CPU_ISA_BITFIELD;
+#endif
+#ifdef SUPPORT_EXTEND_OPS
+	have |= CPU_ISA_EXTEND;
+#endif
+#ifdef SUPPORT_BYTESWAP
+	have |= CPU_ISA_BYTESWAP;
+#endif
+	
+	mIsaExts = exts & have;
+}
+
+uint32_t cpuGetIsaExts(void)
+{
+	return mIsaExts;
+}
+
+bool cpuSetTlbSize(uint32_t entries)
+{
+	if (entries < NUM_TLB_ENTRIES || entries > MAX_TLB_ENTRIES)
+		return false;
+	
+	mTlbEntriesCfg = entries;
+	
+	return true;
+}
+
+uint32_t cpuGetTlbSize(void)
+{
+	return mTlbEntries;
+}
+
+void cpuGetFusionStats(uint64_t counts[CpuFusedNumKinds])
+{
+#ifdef SUPPORT_FUSION
+	memcpy(counts, mFused, sizeof(mFused));
+#else
+	memset(counts, 0, sizeof(uint64_t) * CpuFusedNumKinds);
+#endif
+}
+
+void cpuGetPerfCounts(uint64_t counts[CpuPerfNumEvents])
 {
-	report = 1 - report;
+	memcpy(counts, mPerf, sizeof(mPerf));
+	counts[CpuPerfInstrs] = cpu.instrCnt;
 }
 
+void cpuHostRamWritten(uint32_t pa, uint32_t len)	//nothing caches RAM contents here
+{
+	(void)pa;
+	(void)len;
+}
 
 void cpuCycle(void)
 {
@@ -1073,20 +2136,27 @@ void cpuCycle(void)
 		return cpuPrvTakeIrq();
 	}
 	
+#ifdef CPU_REFERENCE
+	if (!cpuPrvInstrFetch(&instr))
+		return;
+#else
 	if (!cpuPrvInstrFetchCached(&instr))
 		return;
-		
-	if (report) {
-		int i;
-		fprintf(stderr, "[%08X]=%08X {", cpu.pc, instr);
-		for (i = 0; i < 32; i++) {
-			if (!(i & 7))
-				fprintf(stderr, "%u: ", i);
-			fprintf(stderr, " %08X", cpu.regs[i]);
-		}
-		fprintf(stderr, "}\n");
-	}
+#endif
+	
+	cpu.instrCnt++;
+	
+	if (cpu.instrCnt == cpu.timerIrqAt)
+		cpuPrvTimerExpired();
+	
+#ifdef SUPPORT_TRACE
+	if (gTraceActive)
+		traceInstr(cpu.instrCnt, cpu.pc, cpuPrvTracedInstr(instr), (cpu.entryHi & TLB_ENTRYHI_ASID_MASK) >> TLB_ENTRYHI_ASID_SHIFT, cpu.regs);
+#endif
 	
+#ifdef SUPPORT_FUSION
+dispatch:
+#endif
 	switch (instr >> 26) {
 		case 0:
 			switch (instr & 0x3f) {
@@ -1124,11 +2194,15 @@ void cpuCycle(void)
 					return cpuPrvBranchTo(i32a);
 	#ifdef SUPPORT_MOVCC
 				case 10: //MOVZ
+					if (!(mIsaExts & CPU_ISA_MOVCC))
+						goto invalid;
 					if (!cpuGetRegT(instr))
 						cpuSetRegD(instr, cpuGetRegS(instr));
 					break;
 	
 				case 11: //MOVN
+					if (!(mIsaExts & CPU_ISA_MOVCC))
+						goto invalid;
 					if (cpuGetRegT(instr))
 						cpuSetRegD(instr, cpuGetRegS(instr));
 					break;			
@@ -1375,8 +2449,13 @@ void cpuCycle(void)
 			break;
 
 		case 5:	//BNE
-			if (cpuGetRegS(instr) != cpuGetRegT(instr))
+			if (cpuGetRegS(instr) != cpuGetRegT(instr)) {
+	#ifdef SUPPORT_LOOP_IDIOMS
+				if ((int16_t)instr < 0 && cpuPrvLoopIdiom(instr))
+					return;
+	#endif
 				return cpuPrvBranchTo(cpu.npc + (cpuGetSImm(instr) << 2));
+			}
 			break;
 		
 		case 6:	//BLEZ
@@ -1459,10 +2538,18 @@ void cpuCycle(void)
 							cpuSetRegT(instr, cpu.badva);
 							break;
 						
+						case 9:
+							cpuSetRegT(instr, cpuPrvGetCount());
+							break;
+						
 						case 10:
 							cpuSetRegT(instr, cpu.entryHi);
 							break;
 						
+						case 11:
+							cpuSetRegT(instr, cpu.compare);
+							break;
+						
 						case 12:
 							cpuSetRegT(instr, cpu.status);
 							break;
@@ -1506,11 +2593,22 @@ void cpuCycle(void)
 							cpu.badva = cpuGetRegT(instr);
 							break;
 						
+						case 9:
+							cpu.countOfst = cpuGetRegT(instr) - (uint32_t)cpu.instrCnt;
+							cpuPrvTimerRecalc();
+							break;
+						
 						case 10:
 							i32a = cpu.entryHi;
 							cpu.entryHi = cpuGetRegT(instr);
 							cpuPrvMaybeAsidChanded(i32a);
 							break;
+						
+						case 11:	//also acks the timer irq
+							cpu.compare = cpuGetRegT(instr);
+							cpu.cause &=~ CP0_CAUSE_IP(TIMER_IRQ);
+							cpuPrvTimerRecalc();
+							break;
 
 						case 12:
 							//what CAN we write?
@@ -1632,6 +2730,7 @@ void cpuCycle(void)
 				goto invalid;
 			if (!cpuExtHypercall())
 				goto invalid;
+			mPerf[CpuPerfHypercalls]++;
 			break;
 	
 	#if defined(R4000) || defined(SUPPORT_LIKELY_BRANCHES)
@@ -1656,35 +2755,47 @@ void cpuCycle(void)
 	
 	#ifdef SUPPORT_MUL		
 				case 2: //MUL
-					if (instr & 0x7C0)
+					if ((instr & 0x7C0) || !(mIsaExts & CPU_ISA_MUL))
 						goto invalid;
 					cpuSetRegD(instr, cpuGetRegS(instr) * cpuGetRegT(instr));
 					break;
 	#endif		
 	#ifdef SUPPORT_MAC
 				case 0: //MADD
+					if (!(mIsaExts & CPU_ISA_MAC))
+						goto invalid;
 					cpu.hilo64 += (int64_t)(int32_t)cpuGetRegS(instr) * (int64_t)(int32_t)cpuGetRegT(instr);
 					break;
 					
 				case 1: //MADDU
+					if (!(mIsaExts & CPU_ISA_MAC))
+						goto invalid;
 					cpu.hilo64 += (uint64_t)(uint32_t)cpuGetRegS(instr) * (uint64_t)(uint32_t)cpuGetRegT(instr);
 					break;
 				
 				case 4: //MSUB
+					if (!(mIsaExts & CPU_ISA_MAC))
+						goto invalid;
 					cpu.hilo64 -= (int64_t)(int32_t)cpuGetRegS(instr) * (int64_t)(int32_t)cpuGetRegT(instr);
 					break;
 				
 				case 5: //MSUBU
+					if (!(mIsaExts & CPU_ISA_MAC))
+						goto invalid;
 					cpu.hilo64 -= (uint64_t)(uint32_t)cpuGetRegS(instr) * (uint64_t)(uint32_t)cpuGetRegT(instr);
 					break;
 	#endif
 	#ifdef SUPPORT_CLZ
 				case 32: //CLZ
+					if (!(mIsaExts & CPU_ISA_CLZ))
+						goto invalid;
 					i32a = cpuGetRegS(instr);
 					cpuSetRegD(instr, i32a ? __builtin_clz(i32a) : 32);
 					break;
 					
 				case 33: //CLO
+					if (!(mIsaExts & CPU_ISA_CLZ))
+						goto invalid;
 					i32a = ~cpuGetRegS(instr);
 					cpuSetRegD(instr, i32a ? __builtin_clz(i32a) : 32);
 					break;
@@ -1706,6 +2817,9 @@ void cpuCycle(void)
 					uint32_t lsl = 32 - bitlen - lsb;
 					uint32_t lsr = 32 - bitlen;
 					
+					if (!(mIsaExts & CPU_ISA_BITFIELD) || lsb + bitlen > 32)	//the latter is UNPREDICTABLE
+						goto invalid;
+					
 					i32a = cpuGetRegS(instr);
 					i32a <<= lsl;
 					i32a >>= lsr;
@@ -1719,7 +2833,10 @@ void cpuCycle(void)
 					uint32_t lsb = (instr >> 6) & 0x1f;
 					uint32_t msb = (instr >> 11) & 0x1f;
 					uint32_t bitlen = msb - lsb + 1;
-					uint32_t mask = ((1 << bitlen) - 1) << lsb;
+					uint32_t mask = (0xffffffffUL >> (32 - bitlen)) << lsb;	//bitlen may be 32
+					
+					if (!(mIsaExts & CPU_ISA_BITFIELD) || msb < lsb)		//the latter is UNPREDICTABLE
+						goto invalid;
 					
 					i32a = cpuGetRegT(instr);
 					i32b = cpuGetRegS(instr);
@@ -1736,6 +2853,8 @@ void cpuCycle(void)
 						
 	#ifdef SUPPORT_BYTESWAP
 						case 2: //WSBH
+							if (!(mIsaExts & CPU_ISA_BYTESWAP))
+								goto invalid;
 							i32a = cpuGetRegT(instr);
 							i32a = ((i32a & 0xff00ff00) >> 8) | ((i32a << 8) & 0xff00ff00);
 							cpuSetRegD(instr, i32a);
@@ -1743,11 +2862,15 @@ void cpuCycle(void)
 	#endif
 	#ifdef SUPPORT_EXTEND_OPS
 						case 16: //SEB
-							cpuSetRegD(instr, (int32_t)(int16_t)cpuGetRegT(instr));
+							if (!(mIsaExts & CPU_ISA_EXTEND))
+								goto invalid;
+							cpuSetRegD(instr, (int32_t)(int8_t)cpuGetRegT(instr));
 							break;
 						
 						case 24: //SEH
-							cpuSetRegD(instr, (int32_t)(int8_t)cpuGetRegT(instr));
+							if (!(mIsaExts & CPU_ISA_EXTEND))
+								goto invalid;
+							cpuSetRegD(instr, (int32_t)(int16_t)cpuGetRegT(instr));
 							break;
 	#endif
 						
@@ -1926,7 +3049,7 @@ void cpuCycle(void)
 				return;
 	#ifdef SUPPORT_FPU
 	
-			if (!cpuPrvDataAccess(&cpu.fpu.i[cpuGetRegNumT(instr)], cpuGetRegS(instr) + cpuGetSImm(instr), 4, false))
+			if (!cpuPrvFpuDataAccess(&cpu.fpu.i[cpuGetRegNumT(instr)], cpuGetRegS(instr) + cpuGetSImm(instr), 4, false))
 				return;
 		//	LOG("LDR %08x (%f) [0x%08x] -> f%02u\r\n", cpu.fpu.i[cpuGetRegNumT(instr)], cpu.fpu.f[cpuGetRegNumT(instr)], cpuGetRegS(instr) + cpuGetSImm(instr), cpuGetRegNumT(instr));
 			break;
@@ -1941,7 +3064,7 @@ void cpuCycle(void)
 	#ifdef SUPPORT_FPU
 			
 		//	LOG("STR %08x (%f) f%02u -> [0x%08x]\r\n", cpu.fpu.i[cpuGetRegNumT(instr)], cpu.fpu.f[cpuGetRegNumT(instr)], cpuGetRegNumT(instr), cpuGetRegS(instr) + cpuGetSImm(instr));
-			if (!cpuPrvDataAccess(&cpu.fpu.i[cpuGetRegNumT(instr)], cpuGetRegS(instr) + cpuGetSImm(instr), 4, true))
+			if (!cpuPrvFpuDataAccess(&cpu.fpu.i[cpuGetRegNumT(instr)], cpuGetRegS(instr) + cpuGetSImm(instr), 4, true))
 				return;
 			break;
 			
@@ -1964,7 +3087,7 @@ void cpuCycle(void)
 				return;
 	#ifdef SUPPORT_FPU
 	
-			if (!cpuPrvDataAccess(&cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegS(instr) + cpuGetSImm(instr), 8, false))
+			if (!cpuPrvFpuDataAccess(&cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegS(instr) + cpuGetSImm(instr), 8, false))
 				return;
 		//	LOG("LDD %08x%08x (%f) [0x%08x] -> d%02u\r\n", cpu.fpu.i[cpuGetRegNumT(instr) + 1], cpu.fpu.i[cpuGetRegNumT(instr)], cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegS(instr) + cpuGetSImm(instr), cpuGetRegNumT(instr) / 2);
 			break;
@@ -1979,7 +3102,7 @@ void cpuCycle(void)
 	#ifdef SUPPORT_FPU
 	
 		//	LOG("STD %08x%08x (%f) d%02u -> [0x%08x]\r\n", cpu.fpu.i[cpuGetRegNumT(instr) + 1], cpu.fpu.i[cpuGetRegNumT(instr)], cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegNumT(instr) / 2, cpuGetRegS(instr) + cpuGetSImm(instr));
-			if (!cpuPrvDataAccess(&cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegS(instr) + cpuGetSImm(instr), 8, true))
+			if (!cpuPrvFpuDataAccess(&cpu.fpu.d[cpuGetRegNumT(instr) / 2], cpuGetRegS(instr) + cpuGetSImm(instr), 8, true))
 				return;
 			break;
 			
@@ -1990,6 +3113,14 @@ void cpuCycle(void)
 		case 54: //LDC2
 		case 62: //SDC2
 			goto invalid;
+	#ifdef SUPPORT_FUSION
+		case FUSED_OPCODE:	//first instr of a pair, see cpuPrvFusionScanLine()
+			if (cpuPrvFusedPair(&instr))
+				return;
+			if ((instr >> 26) != FUSED_OPCODE)
+				goto dispatch;
+			goto invalid;
+	#endif
 		
 		default:
 			goto invalid;
@@ -2004,9 +3135,43 @@ invalid_nowarn:
 	return cpuPrvTakeReservedInstrExc();
 }
 
+void cpuGetArchState(struct CpuArchState *st)
+{
+	uint_fast16_t i;
+	
+	memset(st, 0, sizeof(*st));
+	memcpy(st->regs, cpu.regs, sizeof(st->regs));
+	st->pc = cpu.pc;
+	st->npc = cpu.npc;
+	st->hi = cpu.hi;
+	st->lo = cpu.lo;
+	st->index = cpu.index;
+	st->entryLo = cpu.entryLo;
+	st->context = cpu.context;
+	st->badva = cpu.badva;
+	st->entryHi = cpu.entryHi;
+	st->status = cpu.status;
+	st->cause = cpu.cause;
+	st->epc = cpu.epc;
+	st->randomSeed = cpu.randomSeed;
+	st->count = cpuPrvGetCount();
+	st->compare = cpu.compare;
+	for (i = 0; i < mTlbEntries && i < CPU_ARCH_STATE_TLB_ENTRIES; i++) {
+		st->tlbHi[i] = cpu.tlb[i].va | (((uint32_t)cpu.tlb[i].asid) << TLB_ENTRYHI_ASID_SHIFT);
+		st->tlbLo[i] = cpu.tlb[i].pa | (((uint32_t)cpu.tlb[i].flagsAsByte) << TLB_ENTRYLO_FLAGS_SHIFT);
+	}
+#ifdef SUPPORT_FPU
+	memcpy(st->fpr, cpu.fpu.i, sizeof(st->fpr));
+	st->fcr = cpu.fpu.fcr;
+#endif
+	st->instrCnt = cpu.instrCnt;
+	st->inDelaySlot = cpu.inDelaySlot;
+	st->llbit = cpu.llbit;
+}
+
 void cpuInit(void)
 {
-	uint_fast8_t i;
+	uint_fast16_t i;
 	
 	memset(&cpu, 0, sizeof(cpu));
 #ifdef R4000
@@ -2014,12 +3179,22 @@ void cpuInit(void)
 #endif
 	cpu.pc = 0xBFC00000UL;	/* mips gets reset to this addr */
 	cpu.npc = cpu.pc + 4;
+	cpuPrvTimerRecalc();
 	cpuPrvIcacheFlushEntire();
+#ifdef SUPPORT_FUSION
+	memset(mFused, 0, sizeof(mFused));
+#endif
+	memset(mPerf, 0, sizeof(mPerf));
+	
+	//hash has at least twice as many buckets as there are entries, as it always did
+	mTlbEntries = mTlbEntriesCfg;
+	for (mTlbHashMask = 1; mTlbHashMask < mTlbEntries * 2; mTlbHashMask <<= 1);
+	mTlbHashMask--;
 	
 	for (i = 0; i < TLB_HASH_ENTRIES; i++)
 		cpu.tlbHash[i] = -1;
 	
-	for (i = 0; i < NUM_TLB_ENTRIES; i++) {
+	for (i = 0; i < MAX_TLB_ENTRIES; i++) {
 		cpu.tlb[i].prevIdx = -1;
 		cpu.tlb[i].nextIdx = -1;
 	}
@@ -77,11 +77,90 @@ enum CpuMemAccessType {
 uint32_t cpuGetRegExternal(uint8_t reg);
 void cpuSetRegExternal(uint8_t reg, uint32_t val);
 bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type);
+void cpuHostRamWritten(uint32_t pa, uint32_t len);	//devices and hypercalls that write RAM directly, not via cpuMemAccessExternal, say so here
 
 uint32_t cpuGetCyCnt(void);
+uint64_t cpuGetInstrCnt(void);
+
+//MIPS32 instrs beyond what an R3000 has. off unless enabled, the guest gets reserved instr exceptions for them then.
+//same values as the H_ISA_* bits in hypercall.h, which is how the guest finds out
+#define CPU_ISA_MOVCC		0x00000001	//MOVN, MOVZ
+#define CPU_ISA_MUL			0x00000002	//MUL
+#define CPU_ISA_MAC			0x00000004	//MADD, MADDU, MSUB, MSUBU
+#define CPU_ISA_CLZ			0x00000008	//CLZ, CLO
+#define CPU_ISA_BITFIELD	0x00000010	//EXT, INS
+#define CPU_ISA_EXTEND		0x00000020	//SEB, SEH
+#define CPU_ISA_BYTESWAP	0x00000040	//WSBH
+
+void cpuSetIsaExts(uint32_t exts);	//any time, survives cpuInit(). ones this engine lacks are dropped
+uint32_t cpuGetIsaExts(void);
+
+//TLB entries, 64 (as on an R3000, and the default) to 1024. the first 8 are always the wired ones. takes effect at the
+//next cpuInit(), false if out of range. the guest finds out by H_GET_TLB_SIZE, PRID still says R3000
+bool cpuSetTlbSize(uint32_t entries);
+uint32_t cpuGetTlbSize(void);
+
+//instr pairs run as one since cpuInit(), by kind, for coverage stats. all zero from engines that do not fuse
+enum CpuFusedPair {
+	CpuFusedLuiAlu,			//lui + ori/addiu of the same reg
+	CpuFusedLuiMem,			//lui + lw/sw based off it
+	CpuFusedCmpBranch,		//slt/sltu/slti/sltiu + beq/bne of the result against $zero
+	CpuFusedLoadNop,		//lw + nop in its delay slot
+	CpuFusedNumKinds,
+};
+
+void cpuGetFusionStats(uint64_t counts[CpuFusedNumKinds]);
+
+//events since cpuInit(), for the guest-visible perf counters (see pmu.c). values are part of the guest interface
+enum CpuPerfEvent {
+	CpuPerfInstrs,			//retired, or attempted and faulted
+	CpuPerfExceptions,		//all taken, irqs and tlb refills included
+	CpuPerfTlbRefills,
+	CpuPerfIcacheMisses,	//line fills
+	CpuPerfHypercalls,
+	CpuPerfNumEvents,
+};
+
+void cpuGetPerfCounts(uint64_t counts[CpuPerfNumEvents]);
+
+//complete architectural state, for comparing cpu engines (see cpuLockstep.c)
+#define CPU_ARCH_STATE_TLB_ENTRIES	1024	//past cpuGetTlbSize() these are zero
+
+struct CpuArchState {
+	uint32_t regs[MIPS_NUM_REGS];
+	uint32_t pc, npc, hi, lo;
+	uint32_t index, entryLo, context, badva, entryHi, status, cause, epc, randomSeed, count, compare;
+	uint32_t tlbHi[CPU_ARCH_STATE_TLB_ENTRIES], tlbLo[CPU_ARCH_STATE_TLB_ENTRIES];	//as TLBR would produce
+	uint32_t fpr[32], fcr;
+	uint64_t instrCnt;
+	uint8_t inDelaySlot, llbit;
+};
+
+void cpuGetArchState(struct CpuArchState *st);
+
+#ifdef GDB_SUPPORT
+	//debugger support. an instr fetched from a breakpoint, or one doing a data access that hits a watchpoint, is not
+	//executed. cpuExtDebugTrap() is called instead and pc stays on it (mips watchpoints trigger before the access).
+	//breakpoints are flagged on icache lines and watchpoints are filtered by page, so with none set this costs nothing
+	enum CpuWatchType {
+		CpuWatchNone = 0,		//how cpuExtDebugTrap() reports breakpoints
+		CpuWatchWrite = 1,
+		CpuWatchRead = 2,
+		CpuWatchAccess = CpuWatchWrite | CpuWatchRead,
+	};
+	
+	bool cpuDebugBkptSet(uint32_t va, bool set);
+	bool cpuDebugWatchSet(uint32_t va, uint32_t len, enum CpuWatchType type, bool set);
+	void cpuDebugClearAll(void);
+	void cpuDebugSkipTrapsOnce(void);	//next instr runs even if it would trap, to resume from one
+	void cpuDebugCodeChanged(void);		//debugger wrote guest memory, drop cached instrs
+#endif
 
 //provided externally
 bool cpuExtHypercall(void);
+#ifdef GDB_SUPPORT
+	void cpuExtDebugTrap(uint32_t addr, enum CpuWatchType watchType);	//addr is the breakpoint or start of the watched range
+#endif
 
 
 #endif
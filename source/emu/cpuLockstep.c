@@ -0,0 +1,589 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+//lockstep mode (make LOCKSTEP=1). cpu.c is built twice: as the "fast" engine (what we normally ship) and as the
+//"reference" engine (CPU_REFERENCE: no icache, no shortcuts). this file provides the usual cpu API on top of both.
+//the fast engine is the real one: it talks to the real devices and the real RAM. the reference engine gets its own copy
+//of RAM and replays MMIO results the fast engine got. after every step both must agree on all architectural state and
+//on the contents of every RAM page either of them wrote, else we stop with a report
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "mipsDis.h"
+#include "cpu.h"
+#include "mem.h"
+#include "soc.h"
+
+
+#define LOCKSTEP_MAX_MMIO		64		//per step
+#define LOCKSTEP_MAX_DIRTY		64		//per step, more causes a compare of all of RAM
+#define LOCKSTEP_MAX_HOST_WR	16		//per step, more causes a copy of all of RAM
+#define LOCKSTEP_HISTORY		32
+#define LOCKSTEP_PAGE_SZ		4096
+#define LOCKSTEP_MAX_REF_CY		0x04000000	//reference engine cycles per step before we call it a hang
+
+
+//the two engines
+void cpuFastInit(void);
+void cpuFastCycle(void);
+void cpuFastIrq(uint_fast8_t idx, bool raise);
+uint32_t cpuFastGetRegExternal(uint8_t reg);
+void cpuFastSetRegExternal(uint8_t reg, uint32_t val);
+bool cpuFastMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type);
+uint32_t cpuFastGetCyCnt(void);
+uint64_t cpuFastGetInstrCnt(void);
+void cpuFastGetArchState(struct CpuArchState *st);
+void cpuFastGetFusionStats(uint64_t counts[CpuFusedNumKinds]);
+void cpuFastSetIsaExts(uint32_t exts);
+uint32_t cpuFastGetIsaExts(void);
+bool cpuFastSetTlbSize(uint32_t entries);
+uint32_t cpuFastGetTlbSize(void);
+void cpuFastGetPerfCounts(uint64_t counts[CpuPerfNumEvents]);
+
+void cpuRefInit(void);
+void cpuRefCycle(void);
+void cpuRefIrq(uint_fast8_t idx, bool raise);
+void cpuRefSetRegExternal(uint8_t reg, uint32_t val);
+bool cpuRefMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type);
+uint64_t cpuRefGetInstrCnt(void);
+void cpuRefGetArchState(struct CpuArchState *st);
+void cpuRefSetIsaExts(uint32_t exts);
+bool cpuRefSetTlbSize(uint32_t entries);
+
+
+struct LockstepMmio {
+	uint32_t pa;
+	uint8_t size;
+	bool write;
+	bool ret;
+	uint8_t data[8];
+};
+
+struct LockstepHostWrite {
+	uint32_t ofst, len;
+};
+
+
+static struct LockstepMmio mMmio[LOCKSTEP_MAX_MMIO];
+static uint_fast8_t mNumMmio, mNumMmioReplayed;
+static bool mMmioOverflow;
+
+static uint8_t *mRam, *mShadowRam;			//real RAM (fast engine), copy of it that the reference engine uses
+static uint32_t mDirtyPages[LOCKSTEP_MAX_DIRTY];
+static uint_fast8_t mNumDirty;
+static bool mDirtyOverflow;
+static struct LockstepHostWrite mHostWrites[LOCKSTEP_MAX_HOST_WR];	//RAM the host wrote during the fast step
+static uint_fast8_t mNumHostWrites;
+static bool mHostWritesOverflow;
+
+static bool mSynced, mExternalAccess;
+static uint32_t mRamAmount;
+static bool mFastHypercalled, mFastHypercallRet, mRefHypercalled;
+static bool mInFastStep;
+static uint32_t mIrqsMoved, mIrqLevels;	//irq lines devices moved during the fast step, and where to
+
+static struct {
+	uint32_t pc, instr;
+	bool haveInstr;
+} mHistory[LOCKSTEP_HISTORY];
+static uint32_t mHistoryPos;
+
+
+static void __attribute__((noreturn)) lockstepPrvDiverged(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+
+static bool lockstepPrvIsRam(uint32_t pa, uint_fast8_t size)
+{
+	return pa - RAM_BASE < mRamAmount && mRamAmount - (pa - RAM_BASE) >= size;
+}
+
+static void lockstepPrvMarkDirty(uint32_t pa)
+{
+	uint32_t page = (pa - RAM_BASE) / LOCKSTEP_PAGE_SZ;
+	
+	if (mNumDirty && mDirtyPages[mNumDirty - 1] == page)
+		return;
+	
+	if (mNumDirty == LOCKSTEP_MAX_DIRTY)
+		mDirtyOverflow = true;
+	else
+		mDirtyPages[mNumDirty++] = page;
+}
+
+bool cpuFastMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* buf)
+{
+	struct LockstepMmio *e;
+	bool ret;
+	
+	if (lockstepPrvIsRam(pa, size)) {
+		
+		if (write)
+			lockstepPrvMarkDirty(pa);
+		return memAccess(pa, size, write, buf);
+	}
+	
+	ret = memAccess(pa, size, write, buf);
+	
+	//ROM and such have no side effects, the reference engine reads them itself
+	if (mExternalAccess || memGetDirectPtr(pa, size))
+		return ret;
+	
+	if (mNumMmio == LOCKSTEP_MAX_MMIO)
+		mMmioOverflow = true;
+	else {
+		e = &mMmio[mNumMmio++];
+		e->pa = pa;
+		e->size = size;
+		e->write = write;
+		e->ret = ret;
+		memcpy(e->data, buf, size > sizeof(e->data) ? sizeof(e->data) : size);
+	}
+	
+	return ret;
+}
+
+bool cpuRefMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* buf)
+{
+	struct LockstepMmio *e;
+	
+	if (lockstepPrvIsRam(pa, size)) {
+		
+		if (write) {
+			memcpy(mShadowRam + pa - RAM_BASE, buf, size);
+			lockstepPrvMarkDirty(pa);
+		}
+		else
+			memcpy(buf, mShadowRam + pa - RAM_BASE, size);
+		
+		return true;
+	}
+	
+	if (memGetDirectPtr(pa, size))
+		return write ? true : memAccess(pa, size, false, buf);
+	
+	if (mExternalAccess)	//already done by the fast engine
+		return true;
+	
+	if (mNumMmioReplayed == mNumMmio)
+		lockstepPrvDiverged("reference engine did an MMIO %s of %u bytes at PA 0x%08x, fast engine did not", write ? "write" : "read", size, (unsigned)pa);
+	
+	e = &mMmio[mNumMmioReplayed++];
+	if (e->pa != pa || e->size != size || e->write != write || (write && memcmp(e->data, buf, size > sizeof(e->data) ? sizeof(e->data) : size)))
+		lockstepPrvDiverged("MMIO mismatch: fast engine did a %s of %u bytes at PA 0x%08x, reference engine did a %s of %u bytes at PA 0x%08x",
+			e->write ? "write" : "read", e->size, (unsigned)e->pa, write ? "write" : "read", size, (unsigned)pa);
+	
+	if (!write)
+		memcpy(buf, e->data, size > sizeof(e->data) ? sizeof(e->data) : size);
+	
+	return e->ret;
+}
+
+bool cpuFastExtHypercall(void)
+{
+	mFastHypercalled = true;
+	mFastHypercallRet = cpuExtHypercall();
+	
+	return mFastHypercallRet;
+}
+
+bool cpuRefExtHypercall(void)		//never run twice, take the fast engine's result
+{
+	mRefHypercalled = true;
+	
+	return mFastHypercallRet;
+}
+
+void cpuRefReportBusErrorAddr(uint32_t pa)
+{
+	(void)pa;
+}
+
+static void lockstepPrvSync(void)
+{
+	mRamAmount = memGetDirectSz(RAM_BASE);
+	mRam = memGetDirectPtr(RAM_BASE, mRamAmount);
+	if (!mRam) {
+		fprintf(stderr, "lockstep: RAM is not directly accessible\n");
+		abort();
+	}
+	
+	if (!mShadowRam) {
+		mShadowRam = malloc(mRamAmount);
+		if (!mShadowRam) {
+			fprintf(stderr, "lockstep: cannot allocate shadow RAM\n");
+			abort();
+		}
+	}
+	memcpy(mShadowRam, mRam, mRamAmount);
+	mSynced = true;
+}
+
+static void lockstepPrvApplyHostWrites(void)
+{
+	uint_fast8_t i;
+	
+	if (mHostWritesOverflow)
+		memcpy(mShadowRam, mRam, mRamAmount);
+	else for (i = 0; i < mNumHostWrites; i++)
+		memcpy(mShadowRam + mHostWrites[i].ofst, mRam + mHostWrites[i].ofst, mHostWrites[i].len);
+	
+	mNumHostWrites = 0;
+	mHostWritesOverflow = false;
+}
+
+static void lockstepPrvPrintMemDiffs(uint32_t pageFrom, uint32_t pageTo)
+{
+	uint_fast8_t numShown = 0;
+	uint32_t ofst, fastVal, refVal;
+	
+	for (ofst = pageFrom * LOCKSTEP_PAGE_SZ; ofst < pageTo * LOCKSTEP_PAGE_SZ && numShown < 16; ofst += 4) {
+		
+		memcpy(&fastVal, mRam + ofst, sizeof(uint32_t));
+		memcpy(&refVal, mShadowRam + ofst, sizeof(uint32_t));
+		if (fastVal == refVal)
+			continue;
+		
+		fprintf(stderr, "  [PA 0x%08x] fast 0x%08x ref 0x%08x\n", (unsigned)(RAM_BASE + ofst), (unsigned)fastVal, (unsigned)refVal);
+		numShown++;
+	}
+}
+
+static void lockstepPrvPrintStateDiffs(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t ofst;
+	} fields[] = {
+		#define FIELD(nm)	{#nm, offsetof(struct CpuArchState, nm)}
+		FIELD(pc), FIELD(npc), FIELD(hi), FIELD(lo), FIELD(index), FIELD(entryLo), FIELD(context), FIELD(badva),
+		FIELD(entryHi), FIELD(status), FIELD(cause), FIELD(epc), FIELD(randomSeed), FIELD(count), FIELD(compare), FIELD(fcr),
+		#undef FIELD
+	};
+	struct CpuArchState fast, ref;
+	uint32_t fastVal, refVal;
+	uint_fast16_t i;
+	
+	cpuFastGetArchState(&fast);
+	cpuRefGetArchState(&ref);
+	
+	if (fast.instrCnt != ref.instrCnt)
+		fprintf(stderr, "  instr count: fast %llu ref %llu\n", (unsigned long long)fast.instrCnt, (unsigned long long)ref.instrCnt);
+	if (fast.inDelaySlot != ref.inDelaySlot || fast.llbit != ref.llbit)
+		fprintf(stderr, "  inDelaySlot: fast %u ref %u, llbit: fast %u ref %u\n", fast.inDelaySlot, ref.inDelaySlot, fast.llbit, ref.llbit);
+	
+	for (i = 0; i < MIPS_NUM_REGS; i++) {
+		if (fast.regs[i] != ref.regs[i])
+			fprintf(stderr, "  %-10s fast 0x%08x ref 0x%08x\n", mipsRegName(i), (unsigned)fast.regs[i], (unsigned)ref.regs[i]);
+	}
+	
+	for (i = 0; i < sizeof(fields) / sizeof(*fields); i++) {
+		memcpy(&fastVal, ((const uint8_t*)&fast) + fields[i].ofst, sizeof(uint32_t));
+		memcpy(&refVal, ((const uint8_t*)&ref) + fields[i].ofst, sizeof(uint32_t));
+		if (fastVal != refVal)
+			fprintf(stderr, "  %-10s fast 0x%08x ref 0x%08x\n", fields[i].name, (unsigned)fastVal, (unsigned)refVal);
+	}
+	
+	for (i = 0; i < CPU_ARCH_STATE_TLB_ENTRIES; i++) {
+		if (fast.tlbHi[i] != ref.tlbHi[i] || fast.tlbLo[i] != ref.tlbLo[i])
+			fprintf(stderr, "  tlb[%4u]  fast 0x%08x/0x%08x ref 0x%08x/0x%08x\n", (unsigned)i, (unsigned)fast.tlbHi[i], (unsigned)fast.tlbLo[i], (unsigned)ref.tlbHi[i], (unsigned)ref.tlbLo[i]);
+	}
+	
+	for (i = 0; i < 32; i++) {
+		if (fast.fpr[i] != ref.fpr[i])
+			fprintf(stderr, "  $f%-8u fast 0x%08x ref 0x%08x\n", (unsigned)i, (unsigned)fast.fpr[i], (unsigned)ref.fpr[i]);
+	}
+}
+
+static void lockstepPrvDiverged(const char *fmt, ...)
+{
+	char dis[64];
+	uint32_t i, idx;
+	va_list vl;
+	
+	fprintf(stderr, "\r\n\nLOCKSTEP: engines diverged after %llu instrs: ", (unsigned long long)cpuFastGetInstrCnt());
+	va_start(vl, fmt);
+	vfprintf(stderr, fmt, vl);
+	va_end(vl);
+	
+	fprintf(stderr, "\nrecent steps, oldest first:\n");
+	for (i = 0; i < LOCKSTEP_HISTORY; i++) {
+		
+		idx = (mHistoryPos + i) % LOCKSTEP_HISTORY;
+		if (!mHistory[idx].pc)
+			continue;
+		if (mHistory[idx].haveInstr)
+			mipsDisasm(dis, sizeof(dis), mHistory[idx].instr, mHistory[idx].pc);
+		else
+			strcpy(dis, "<not mapped>");
+		fprintf(stderr, "  [%08x] %08x  %s\n", (unsigned)mHistory[idx].pc, (unsigned)mHistory[idx].instr, dis);
+	}
+	
+	fprintf(stderr, "state differences:\n");
+	lockstepPrvPrintStateDiffs();
+	
+	exit(-10);
+}
+
+static void lockstepPrvCompareRam(void)
+{
+	uint_fast8_t i;
+	uint32_t page;
+	
+	if (mDirtyOverflow) {
+		
+		for (page = 0; page < mRamAmount / LOCKSTEP_PAGE_SZ; page++) {
+			if (memcmp(mRam + page * LOCKSTEP_PAGE_SZ, mShadowRam + page * LOCKSTEP_PAGE_SZ, LOCKSTEP_PAGE_SZ)) {
+				lockstepPrvPrintMemDiffs(page, page + 1);
+				lockstepPrvDiverged("RAM contents differ");
+			}
+		}
+	}
+	else for (i = 0; i < mNumDirty; i++) {
+		
+		page = mDirtyPages[i];
+		if (memcmp(mRam + page * LOCKSTEP_PAGE_SZ, mShadowRam + page * LOCKSTEP_PAGE_SZ, LOCKSTEP_PAGE_SZ)) {
+			lockstepPrvPrintMemDiffs(page, page + 1);
+			lockstepPrvDiverged("RAM contents differ");
+		}
+	}
+	
+	mNumDirty = 0;
+	mDirtyOverflow = false;
+}
+
+void cpuCycle(void)
+{
+	struct CpuArchState fast, ref;
+	uint64_t target;
+	uint32_t cy = 0;
+	uint_fast8_t i;
+	
+	if (!mSynced)
+		lockstepPrvSync();
+	
+	mHistory[mHistoryPos].pc = cpuFastGetRegExternal(MIPS_EXT_REG_PC);
+	mExternalAccess = true;
+	mHistory[mHistoryPos].haveInstr = cpuFastMemAccessExternal(&mHistory[mHistoryPos].instr, mHistory[mHistoryPos].pc, 4, false, CpuAccessAsCurrent);
+	mExternalAccess = false;
+	mHistoryPos = (mHistoryPos + 1) % LOCKSTEP_HISTORY;
+	
+	mNumMmio = 0;
+	mNumMmioReplayed = 0;
+	mMmioOverflow = false;
+	mFastHypercalled = false;
+	mRefHypercalled = false;
+	mIrqsMoved = 0;
+	
+	mInFastStep = true;
+	cpuFastCycle();
+	mInFastStep = false;
+	
+	//a step of the fast engine may retire any number of instrs (or none, if it took an exception)
+	target = cpuFastGetInstrCnt();
+	do {
+		cpuRefCycle();
+		if (++cy == LOCKSTEP_MAX_REF_CY)
+			lockstepPrvDiverged("reference engine did not catch up in %u cycles", (unsigned)cy);
+	} while (cpuRefGetInstrCnt() < target);
+	
+	lockstepPrvApplyHostWrites();
+	
+	for (i = 0; mIrqsMoved >> i; i++) {
+		if ((mIrqsMoved >> i) & 1)
+			cpuRefIrq(i, (mIrqLevels >> i) & 1);
+	}
+	
+	if (mMmioOverflow)
+		lockstepPrvDiverged("too many MMIO accesses in one step to check");
+	
+	if (mNumMmioReplayed != mNumMmio)
+		lockstepPrvDiverged("fast engine did %u MMIO accesses, reference engine did %u (first missed: %s of PA 0x%08x)",
+			mNumMmio, mNumMmioReplayed, mMmio[mNumMmioReplayed].write ? "write" : "read", (unsigned)mMmio[mNumMmioReplayed].pa);
+	
+	if (mFastHypercalled != mRefHypercalled)
+		lockstepPrvDiverged("only the %s engine did a hypercall", mFastHypercalled ? "fast" : "reference");
+	
+	if (mFastHypercalled) {
+		
+		//hypercalls run once, on the fast engine. they may change any reg. RAM they write they report, see cpuHostRamWritten()
+		for (i = 1; i < MIPS_NUM_REGS; i++)
+			cpuRefSetRegExternal(i, cpuFastGetRegExternal(i));
+		cpuRefSetRegExternal(MIPS_EXT_REG_HI, cpuFastGetRegExternal(MIPS_EXT_REG_HI));
+		cpuRefSetRegExternal(MIPS_EXT_REG_LO, cpuFastGetRegExternal(MIPS_EXT_REG_LO));
+	}
+	
+	cpuFastGetArchState(&fast);
+	cpuRefGetArchState(&ref);
+	if (memcmp(&fast, &ref, sizeof(fast)))
+		lockstepPrvDiverged("architectural state differs");
+	
+	lockstepPrvCompareRam();
+}
+
+void cpuInit(void)
+{
+	static bool announced = false;
+	
+	if (!announced) {
+		fprintf(stderr, "LOCKSTEP: running reference cpu engine alongside the fast one\n");
+		announced = true;
+	}
+	
+	cpuFastInit();
+	cpuRefInit();
+	mSynced = false;
+	mNumDirty = 0;
+	mDirtyOverflow = false;
+	mNumHostWrites = 0;
+	mHostWritesOverflow = false;
+	memset(mHistory, 0, sizeof(mHistory));
+}
+
+void cpuIrq(uint_fast8_t idx, bool raise)
+{
+	cpuFastIrq(idx, raise);
+	
+	//an MMIO access or hypercall of this step did it, and the reference engine has yet to get there. were it to see
+	//the irq now, it could take it before doing that very access
+	if (mInFastStep && idx < 32) {
+		mIrqsMoved |= 1UL << idx;
+		if (raise)
+			mIrqLevels |= 1UL << idx;
+		else
+			mIrqLevels &=~ (1UL << idx);
+	}
+	else
+		cpuRefIrq(idx, raise);
+}
+
+uint32_t cpuGetRegExternal(uint8_t reg)
+{
+	return cpuFastGetRegExternal(reg);
+}
+
+void cpuSetRegExternal(uint8_t reg, uint32_t val)
+{
+	cpuFastSetRegExternal(reg, val);
+	cpuRefSetRegExternal(reg, val);
+}
+
+bool cpuMemAccessExternal(void *buf, uint32_t va, uint_fast8_t sz, bool write, enum CpuMemAccessType type)
+{
+	bool ret;
+	
+	mExternalAccess = true;
+	ret = cpuFastMemAccessExternal(buf, va, sz, write, type);
+	if (ret && write && mSynced)
+		cpuRefMemAccessExternal(buf, va, sz, true, type);
+	mExternalAccess = false;
+	
+	return ret;
+}
+
+void cpuHostRamWritten(uint32_t pa, uint32_t len)
+{
+	uint32_t ofst = pa - RAM_BASE;
+	struct LockstepHostWrite *w;
+	
+	//before the first step, the sync copies it all anyway
+	if (!mSynced || ofst >= mRamAmount || !len)
+		return;
+	if (len > mRamAmount - ofst)
+		len = mRamAmount - ofst;
+	
+	//between steps (device polls) the reference engine can have it at once. during one (hypercalls), not till it catches
+	//up to where the fast engine was, else it could read the new data before the instr that caused it
+	if (!mInFastStep)
+		memcpy(mShadowRam + ofst, mRam + ofst, len);
+	else if (mNumHostWrites == LOCKSTEP_MAX_HOST_WR)
+		mHostWritesOverflow = true;
+	else {
+		w = &mHostWrites[mNumHostWrites++];
+		w->ofst = ofst;
+		w->len = len;
+	}
+}
+
+uint32_t cpuGetCyCnt(void)
+{
+	return cpuFastGetCyCnt();
+}
+
+uint64_t cpuGetInstrCnt(void)
+{
+	return cpuFastGetInstrCnt();
+}
+
+void cpuGetArchState(struct CpuArchState *st)
+{
+	cpuFastGetArchState(st);
+}
+
+void cpuGetFusionStats(uint64_t counts[CpuFusedNumKinds])
+{
+	cpuFastGetFusionStats(counts);
+}
+
+void cpuSetIsaExts(uint32_t exts)
+{
+	cpuFastSetIsaExts(exts);
+	cpuRefSetIsaExts(exts);
+}
+
+uint32_t cpuGetIsaExts(void)
+{
+	return cpuFastGetIsaExts();
+}
+
+bool cpuSetTlbSize(uint32_t entries)
+{
+	return cpuFastSetTlbSize(entries) && cpuRefSetTlbSize(entries);
+}
+
+uint32_t cpuGetTlbSize(void)
+{
+	return cpuFastGetTlbSize();
+}
+
+void cpuGetPerfCounts(uint64_t counts[CpuPerfNumEvents])
+{
+	cpuFastGetPerfCounts(counts);
+}
+
+#ifdef GDB_SUPPORT
+
+	bool cpuDebugBkptSet(uint32_t va, bool set)
+	{
+		(void)va;
+		
+		return !set;
+	}
+	
+	bool cpuDebugWatchSet(uint32_t va, uint32_t len, enum CpuWatchType type, bool set)
+	{
+		(void)va;
+		(void)len;
+		(void)type;
+		
+		return !set;
+	}
+	
+	void cpuDebugClearAll(void)
+	{
+	}
+	
+	void cpuDebugSkipTrapsOnce(void)
+	{
+	}
+	
+	void cpuDebugCodeChanged(void)
+	{
+		//not exported by the engines. the fast one may run stale cached instrs (and diverge) until the lines are refilled
+	}
+
+#endif
@@ -4,6 +4,7 @@
 */
 
 #include <stdint.h>
+#include <time.h>
 #include "ds1287.h"
 #include "mem.h"
 #include "soc.h"
@@ -33,6 +34,21 @@
 
 #define RTC_CTRLD_VRT		0x80
 
+#define RTC_DEC_YEAR		0x3f	//where DEC firmware (and linux) keeps the real year, as an offset from 2000 - 72 + reg value
+
+#define RTC_MAX_OWED_PERIODS	1024	//do not try to catch up forever after a long host stall
+
+//emulator extension past the chip's 128 regs: a free-running 8192Hz counter and a one-shot compare on the same irq
+//32-bit regs, offsets are from the RTC base. discoverable via H_GET_FEATURES & H_FEAT_RTC_ONESHOT
+#define RTC_EXT_BASE		0x200
+#define RTC_EXT_COUNT		0x200	//RO: counts 1/8192 sec ticks, wraps
+#define RTC_EXT_DEADLINE	0x204	//RW: absolute COUNT value at which the timer fires
+#define RTC_EXT_CTRL		0x208	//RW: see below
+#define RTC_EXT_END			0x20c
+
+#define RTC_EXT_CTRL_ARM	0x01	//write 1 to arm (fires at once if DEADLINE already passed), self-clears when it fires
+#define RTC_EXT_CTRL_FIRED	0x02	//set when it fires, drives the irq. write 1 to clear
+
 //internally our data is always binary. we change format on read/write
 struct {
 	union {
@@ -47,6 +63,61 @@ struct {
 	uint16_t tickCtr;
 } gRTC;
 
+static enum Ds1287LostTickPolicy mLostTickPolicy = Ds1287LostTicksCoalesce;
+static uint32_t mOwedPeriods;		//periodic irqs not yet delivered, for Ds1287LostTicksDeliverAll
+static uint32_t mExtCount, mExtDeadline;
+static uint8_t mExtCtrl;
+
+static void ds1287prvIrqUpdate(void)
+{
+	cpuIrq(SOC_IRQNO_RTC, (gRTC.ctrlC & RTC_CTRLC_IRQF) || (mExtCtrl & RTC_EXT_CTRL_FIRED));
+}
+
+static void ds1287prvExtCheckDeadline(void)
+{
+	if ((mExtCtrl & RTC_EXT_CTRL_ARM) && (int32_t)(mExtCount - mExtDeadline) >= 0) {
+		mExtCtrl = (mExtCtrl &~ RTC_EXT_CTRL_ARM) | RTC_EXT_CTRL_FIRED;
+		cpuIrq(SOC_IRQNO_RTC, true);
+	}
+}
+
+static bool ds1287prvExtAccess(uint32_t ofst, uint_fast8_t size, bool write, uint32_t *buf)
+{
+	if (size != 4)
+		return false;
+	
+	switch (ofst) {
+		case RTC_EXT_COUNT:
+			if (!write)
+				*buf = mExtCount;
+			break;
+		
+		case RTC_EXT_DEADLINE:
+			if (write)
+				mExtDeadline = *buf;
+			else
+				*buf = mExtDeadline;
+			break;
+		
+		case RTC_EXT_CTRL:
+			if (!write)
+				*buf = mExtCtrl;
+			else {
+				if (*buf & RTC_EXT_CTRL_FIRED)
+					mExtCtrl &=~ RTC_EXT_CTRL_FIRED;
+				mExtCtrl = (mExtCtrl &~ RTC_EXT_CTRL_ARM) | (*buf & RTC_EXT_CTRL_ARM);
+				ds1287prvExtCheckDeadline();
+				ds1287prvIrqUpdate();
+			}
+			break;
+		
+		default:
+			return false;
+	}
+	
+	return true;
+}
+
 static void ds1286prvPossiblyBcdRegOp(uint8_t *regP, uint8_t *buf, bool write, uint8_t min, uint8_t max)
 {
 	if (write) {
@@ -142,6 +213,8 @@ static bool ds1287prvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 	(void)userData;
 	
 	pa &= 0x00ffffff;
+	if (pa >= RTC_EXT_BASE && pa < RTC_EXT_END)
+		return ds1287prvExtAccess(pa, size, write, buf);
 	if (size != 1 || (pa & 3))
 		return false;
 	pa /= 4;
@@ -175,7 +248,15 @@ static bool ds1287prvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 				recalc = true;
 				*(uint8_t*)buf = gRTC.ctrlC;
 				gRTC.ctrlC = 0;
-				cpuIrq(SOC_IRQNO_RTC, false);
+				
+				//catching up on lost periodic irqs? next one is due right away
+				if (mOwedPeriods && (gRTC.ctrlB & RTC_CTRLB_PIE) && (gRTC.ctrlA & RTC_CTRLA_RS_MASK)) {
+					mOwedPeriods--;
+					gRTC.ctrlC = RTC_CTRLC_PF | RTC_CTRLC_IRQF;
+				}
+				else
+					mOwedPeriods = 0;
+				ds1287prvIrqUpdate();
 			}
 			break;
 		
@@ -207,95 +288,108 @@ static bool ds1287prvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void*
 	return true;
 }
 
-void ds1287step(uint_fast16_t nTicks)
+static bool ds1287prvSecondTick(void)		//returns true if an irq is due
 {
-	static const uint8_t tickDivRate[] = {0, 5, 6, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
-	uint_fast8_t tickRateIdx = (gRTC.ctrlA & RTC_CTRLA_RS_MASK) >> RTC_CTRLA_RS_SHIFT;
-	uint_fast16_t prevTickCtr, newTickCtr, newTickCtrRounded;
-	bool doIrq = false, rtcUpdate;
-	
-	//this func can NEVER clear irq - only host ack can do that, so the IRQ logic here is simple :)
-	
-	prevTickCtr = gRTC.tickCtr;
-	newTickCtr = prevTickCtr + nTicks;
-	newTickCtrRounded = newTickCtr % 8192;
-	gRTC.tickCtr = newTickCtrRounded;
-	rtcUpdate = newTickCtrRounded < prevTickCtr;
-	
-	//(x >> 13) is same as (x >= 8192) but gcc makes better code
-	
-	if (rtcUpdate && !(gRTC.ctrlB & RTC_CTRLB_SET)) {	//UIP bit
-		
-		gRTC.ctrlA |= RTC_CTRLA_UIP;
-	}
-	
-	if (tickRateIdx && (prevTickCtr >> tickDivRate[tickRateIdx]) != (newTickCtr >> tickDivRate[tickRateIdx])) {	//tick
-		
-		gRTC.ctrlC |= RTC_CTRLC_PF;
-		if (gRTC.ctrlB & RTC_CTRLB_PIE)
-			doIrq = true;
-	}
+	bool doIrq = false;
 	
-	if (rtcUpdate) {
-		
-		gRTC.ctrlA &=~ RTC_CTRLA_UIP;
+	if (!(gRTC.ctrlB & RTC_CTRLB_SET)) {
 		
-		if (!(gRTC.ctrlB & RTC_CTRLB_SET)) {
-			
-			if (++gRTC.sec == 60) {
-				gRTC.sec = 0;
-				if (++gRTC.min == 60) {
-					gRTC.min = 0;
-					if (++gRTC.hr == 24) {
-						
-						static const uint8_t daysPerMonthNormal[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-						static const uint8_t daysPerMonthLeap[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-						uint16_t curYear = (1900 + gRTC.year);
-						uint8_t daysPerMonth;
-						bool isLeap;
-						
-						if (curYear % 3)
-							isLeap = false;
-						else if (curYear % 100)
-							isLeap = true;
-						else if (curYear % 400)
-							isLeap = false;
-						else
-							isLeap = true;
-						
-						daysPerMonth = (isLeap ? daysPerMonthLeap : daysPerMonthNormal)[gRTC.month - 1];
-						
-						gRTC.hr = 0;
+		if (++gRTC.sec == 60) {
+			gRTC.sec = 0;
+			if (++gRTC.min == 60) {
+				gRTC.min = 0;
+				if (++gRTC.hr == 24) {
+					
+					static const uint8_t daysPerMonthNormal[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+					static const uint8_t daysPerMonthLeap[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+					uint16_t curYear = (1900 + gRTC.year);
+					uint8_t daysPerMonth;
+					bool isLeap;
+					
+					if (curYear % 4)
+						isLeap = false;
+					else if (curYear % 100)
+						isLeap = true;
+					else if (curYear % 400)
+						isLeap = false;
+					else
+						isLeap = true;
+					
+					daysPerMonth = (isLeap ? daysPerMonthLeap : daysPerMonthNormal)[gRTC.month - 1];
+					
+					gRTC.hr = 0;
+					
+					if (++gRTC.day == 8)
+						gRTC.day = 1;
+					
+					if (gRTC.date++ == daysPerMonth) {
 						
-						if (++gRTC.day == 8)
-							gRTC.day = 1;
+						gRTC.date = 1;
 						
-						if (gRTC.date++ == daysPerMonth) {
+						if (++gRTC.month == 13) {
 							
-							gRTC.date = 1;
+							gRTC.month = 1;
 							
-							if (++gRTC.month == 13) {
-								
-								gRTC.month = 1;
-								
-								if (++gRTC.year == 99)
-									gRTC.year = 0;
-							}
+							if (++gRTC.year == 100)
+								gRTC.year = 0;
 						}
 					}
 				}
 			}
-			gRTC.ctrlC |= RTC_CTRLC_UF;
-			if (gRTC.ctrlB & RTC_CTRLB_UIE)
-				doIrq = true;
 		}
+		gRTC.ctrlC |= RTC_CTRLC_UF;
+		if (gRTC.ctrlB & RTC_CTRLB_UIE)
+			doIrq = true;
+	}
+		
+	if (gRTC.sec == gRTC.almSec && gRTC.min == gRTC.almMin && gRTC.hr == gRTC.almHr) {
 			
-		if (gRTC.sec == gRTC.almSec && gRTC.min == gRTC.almMin && gRTC.hr == gRTC.almHr) {
-				
-			gRTC.ctrlC |= RTC_CTRLC_AF;
-			if (gRTC.ctrlB & RTC_CTRLB_AIE)
-				doIrq = true;
+		gRTC.ctrlC |= RTC_CTRLC_AF;
+		if (gRTC.ctrlB & RTC_CTRLB_AIE)
+			doIrq = true;
+	}
+	
+	return doIrq;
+}
+
+void ds1287step(uint32_t nTicks)
+{
+	static const uint8_t tickDivRate[] = {0, 5, 6, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+	uint_fast8_t tickRateIdx = (gRTC.ctrlA & RTC_CTRLA_RS_MASK) >> RTC_CTRLA_RS_SHIFT;
+	uint32_t prevTickCtr, newTickCtr, nPeriods, nSeconds;
+	bool doIrq = false;
+	
+	//this func can NEVER clear irq - only host ack can do that, so the IRQ logic here is simple :)
+	
+	prevTickCtr = gRTC.tickCtr;
+	newTickCtr = prevTickCtr + nTicks;
+	gRTC.tickCtr = newTickCtr % 8192;
+	nSeconds = newTickCtr / 8192;
+	
+	if (tickRateIdx && (nPeriods = (newTickCtr >> tickDivRate[tickRateIdx]) - (prevTickCtr >> tickDivRate[tickRateIdx])) != 0) {	//tick(s)
+		
+		//more than one period in one step only happens when we are driven by the host clock and fell behind
+		if (nPeriods == 1 || mLostTickPolicy == Ds1287LostTicksCoalesce)
+			gRTC.ctrlC |= RTC_CTRLC_PF;
+		else if (mLostTickPolicy == Ds1287LostTicksDeliverAll) {
+			gRTC.ctrlC |= RTC_CTRLC_PF;
+			mOwedPeriods += nPeriods - 1;
+			if (mOwedPeriods > RTC_MAX_OWED_PERIODS)
+				mOwedPeriods = RTC_MAX_OWED_PERIODS;
 		}
+		//else skip them all, next on-time tick will fire normally
+		
+		if ((gRTC.ctrlC & RTC_CTRLC_PF) && (gRTC.ctrlB & RTC_CTRLB_PIE))
+			doIrq = true;
+	}
+	
+	mExtCount += nTicks;
+	ds1287prvExtCheckDeadline();
+	
+	//UIP is only ever visible between steps if we are mid-update, and we never are
+	while (nSeconds--) {
+		if (ds1287prvSecondTick())
+			doIrq = true;
 	}
 	
 	if (doIrq) {
@@ -305,10 +399,35 @@ void ds1287step(uint_fast16_t nTicks)
 	}
 }
 
+void ds1287setLostTickPolicy(enum Ds1287LostTickPolicy policy)
+{
+	mLostTickPolicy = policy;
+}
+
+static void ds1287prvSeedTime(void)
+{
+	time_t now = time(NULL);
+	struct tm tm;
+	
+	if (!gmtime_r(&now, &tm))
+		return;
+	
+	//DEC keeps the year register at 72..75 (same place in the leap cycle as the real year) and the rest in RAM
+	gRTC.sec = tm.tm_sec > 59 ? 59 : tm.tm_sec;
+	gRTC.min = tm.tm_min;
+	gRTC.hr = tm.tm_hour;
+	gRTC.day = tm.tm_wday + 1;
+	gRTC.date = tm.tm_mday;
+	gRTC.month = tm.tm_mon + 1;
+	gRTC.year = 72 + (1900 + tm.tm_year) % 4;
+	gRTC.direct[RTC_DEC_YEAR] = (1900 + tm.tm_year) - 2000 - (1900 + tm.tm_year) % 4;
+}
+
 bool ds1287init(void)
 {
 	gRTC.ctrlB = RTC_CTRLB_DM | RTC_CTRLB_2412;
 	gRTC.ctrlD = RTC_CTRLD_VRT;
+	ds1287prvSeedTime();
 	
 	return memRegionAdd(0x1d000000, 0x01000000, ds1287prvMemAccess, (void*)0);
 }
@@ -7,11 +7,22 @@
 #define _DS1287_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
-bool ds1287init(void);
+enum Ds1287LostTickPolicy {
+	Ds1287LostTicksCoalesce,		//periodic irqs missed in one step become one (what real hw does if irqs are not acked)
+	Ds1287LostTicksDeliverAll,		//each one is delivered, back to back as the guest acks them
+	Ds1287LostTicksSkip,			//they are dropped
+};
 
-void ds1287step(uint_fast16_t nTicks);	//check for RTC irqs... on pc also tick 1/8192th of a sec
+
+bool ds1287init(void);		//also seeds time of day from the host
+
+void ds1287step(uint32_t nTicks);	//check for RTC irqs... on pc also tick 1/8192th of a sec
+
+//only matters if ds1287step() is ever called with more than one periodic interval's worth of ticks
+void ds1287setLostTickPolicy(enum Ds1287LostTickPolicy policy);
 
 
 #endif
@@ -112,8 +112,8 @@ static void dz11PrvRecalc(void)
 			if (line->nBytesRxedSinceLastRead >= FIFO_ALARM_COUNT)
 				gDZ11.sa = true;
 			
-			//TX?
-			if (gDZ11.tcr & mask) {	//we are always ready to tx
+			//TX? as long as the host side has space. this lets a driver that loops on TRDY send a lot per irq
+			if ((gDZ11.tcr & mask) && dz11charTxReady(i)) {
 				
 				if (!gDZ11.trdy) {
 					
@@ -152,7 +152,7 @@ static void dz11prvTx(uint_fast8_t val)		//assumes it will be followed by recalc
 		err_str("DZ11: write while fisabled");
 	else {
 		
-		dz11charPut(gDZ11.txLine, val);	//our UARTs are instant and never busy
+		dz11charPut(gDZ11.txLine, val);	//busy-ness is handled by dz11charTxReady()
 		gDZ11.trdy = false;
 	}
 }
@@ -192,6 +192,27 @@ static uint_fast16_t dz11prvRx(void)	//assumes it will be followed by recalc
 	return 0;
 }
 
+void dz11txReadyChanged(void)
+{
+	dz11PrvRecalc();
+}
+
+uint_fast8_t dz11charRxSpace(uint_fast8_t lineNo)
+{
+	struct Line *line;
+	
+	if (lineNo >= NUM_UARTS)
+		return 0;
+	
+	line = &gDZ11.line[lineNo];
+	
+	//chars sent to a disabled line are lost, so hold them until the guest is ready
+	if (!gDZ11.enabled || !line->rxEna)
+		return 0;
+	
+	return UART_RX_BUF_SZ - line->rxBytesUsed;
+}
+
 void dz11charRx(uint_fast8_t lineNo, uint_fast8_t chr)
 {
 	struct Line *line;
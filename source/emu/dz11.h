@@ -13,8 +13,13 @@ bool dz11init(void);
 
 //feed chars
 void dz11charRx(uint_fast8_t line, uint_fast8_t chr);
+uint_fast8_t dz11charRxSpace(uint_fast8_t line);	//how many chars dz11charRx() can take without overflowing
+
+//call when a line that was not ready to tx might be now
+void dz11txReadyChanged(void);
 
 //externally provided
 extern void dz11charPut(uint_fast8_t line, uint_fast8_t chr);
+extern bool dz11charTxReady(uint_fast8_t line);		//can this line take another char now?
 
 #endif
@@ -34,6 +34,14 @@
 
 #define SUPPORT_FPU_R4000
 
+#ifndef __FAST_MATH__
+	#define SUPPORT_FPU_HOST_FLAGS	//sticky flags come from the host's fenv (meaningless with -ffast-math)
+#endif
+
+#ifdef SUPPORT_FPU_HOST_FLAGS
+	#include <fenv.h>
+#endif
+
 
 
 //we just do not use these...
@@ -52,6 +60,14 @@
 
 #define FCR_PEROP_FLAGS		(((FCR_INVAL_OP | FCR_CEF_DIV0 | FCR_CEF_OVERFLOW | FCR_CEF_UDERFLOW | FCR_CEF_INEXACT) << FCR_SHIFT_CAUSE) | FCR_UNIMPL)
 
+#define FPU_FMT_S			16
+#define FPU_FMT_D			17
+#define FPU_FMT_W			20
+
+
+typedef enum FpuOpRet (*FpuOpF)(uint32_t instr, struct FpuState *fpu);
+
+
 static inline uint_fast8_t fpuPrvGetFpRegNumT(uint32_t instr)
 {
 	return (instr >> 16) & 0x1f;
@@ -85,24 +101,389 @@ static inline void cpuSetRegT(uint32_t instr, uint32_t val, uint32_t *cpuRegs)
 		cpuRegs[rn] = val;
 }
 
+//sticky flags are not tracked per op. the host's fenv accrues them as we go, and they are folded into the FCR only when
+//the guest looks (CFC). they are dropped as the guest replaces the FCR (CTC), which the kernel does as it switches tasks,
+//so flags end up with the right task. folding leaves them be, so that both lockstep engines see the same ones. nothing
+//else on the host does floating point math while guest code runs
+static void fpuPrvFlagsSync(struct FpuState *fpu)
+{
+#ifdef SUPPORT_FPU_HOST_FLAGS
+	int ex = fetestexcept(FE_ALL_EXCEPT);
+	uint32_t flags = 0;
+	
+	if (ex & FE_INVALID)
+		flags |= FCR_INVAL_OP;
+	if (ex & FE_DIVBYZERO)
+		flags |= FCR_CEF_DIV0;
+	if (ex & FE_OVERFLOW)
+		flags |= FCR_CEF_OVERFLOW;
+	if (ex & FE_UNDERFLOW)
+		flags |= FCR_CEF_UDERFLOW;
+	if (ex & FE_INEXACT)
+		flags |= FCR_CEF_INEXACT;
+	
+	fpu->fcr |= flags << FCR_SHIFT_FLAGS;
+#else
+	(void)fpu;
+#endif
+}
+
+static void fpuPrvFlagsDrop(void)	//what the host accrued so far is not the guest's anymore
+{
+#ifdef SUPPORT_FPU_HOST_FLAGS
+	feclearexcept(FE_ALL_EXCEPT);
+#endif
+}
+
+//cause bits are only kept for ops that trap, since the trap handler is the only one that looks at them
+static enum FpuOpRet fpuPrvTrap(struct FpuState *fpu, uint32_t cause)
+{
+	fpu->fcr = (fpu->fcr &~ FCR_PEROP_FLAGS) | cause;
+	
+	return FpuRetExcTaken;
+}
+
+static enum FpuOpRet fpuPrvUnimpl(uint32_t instr, struct FpuState *fpu)	//for the kernel's fpu emulator to do
+{
+	(void)instr;
+	
+	return fpuPrvTrap(fpu, FCR_UNIMPL);
+}
+
+
+//specialized ops for each (fmt, func). singles live in f[], doubles in d[] (even regs only), words in i[]
+
+#define FPU_BINOP(name, opStr, expr)																			\
+	static enum FpuOpRet fpuPrv##name##S(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		float s = fpu->f[fpuPrvGetFpRegNumS(instr)], t = fpu->f[fpuPrvGetFpRegNumT(instr)], ret = (expr);		\
+																												\
+		LOG("f%02u (%f) " opStr " f%02u (%f) -> f%02u (%f)\r\n",												\
+			fpuPrvGetFpRegNumS(instr), s, fpuPrvGetFpRegNumT(instr), t, fpuPrvGetFpRegNumD(instr), ret);		\
+		fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;																\
+		return FpuRetInstrDone;																					\
+	}																											\
+																												\
+	static enum FpuOpRet fpuPrv##name##D(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2], t = fpu->d[fpuPrvGetFpRegNumT(instr) / 2], ret = (expr);	\
+																												\
+		LOG("d%02u (%f) " opStr " d%02u (%f) -> d%02u (%f)\r\n",												\
+			fpuPrvGetFpRegNumS(instr) / 2, s, fpuPrvGetFpRegNumT(instr) / 2, t, fpuPrvGetFpRegNumD(instr) / 2, ret);\
+		fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;															\
+		return FpuRetInstrDone;																					\
+	}
+
+#define FPU_UNOP(name, opStr, exprS, exprD)																	\
+	static enum FpuOpRet fpuPrv##name##S(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		float s = fpu->f[fpuPrvGetFpRegNumS(instr)], ret = (exprS);												\
+																												\
+		LOG("f%02u (%f) " opStr " -> f%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr), s, fpuPrvGetFpRegNumD(instr), ret);	\
+		fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;																\
+		return FpuRetInstrDone;																					\
+	}																											\
+																												\
+	static enum FpuOpRet fpuPrv##name##D(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2], ret = (exprD);										\
+																												\
+		LOG("d%02u (%f) " opStr " -> d%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr) / 2, s, fpuPrvGetFpRegNumD(instr) / 2, ret);\
+		fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;															\
+		return FpuRetInstrDone;																					\
+	}
+
+#define FPU_TO_WORD(name, opStr, exprS, exprD)																	\
+	static enum FpuOpRet fpuPrv##name##S(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		float s = fpu->f[fpuPrvGetFpRegNumS(instr)];															\
+		int32_t ret = (exprS);																					\
+																												\
+		LOG("f%02u (%f) " opStr " -> f%02u (%d)\r\n", fpuPrvGetFpRegNumS(instr), s, fpuPrvGetFpRegNumD(instr), ret);	\
+		fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;																\
+		return FpuRetInstrDone;																					\
+	}																											\
+																												\
+	static enum FpuOpRet fpuPrv##name##D(uint32_t instr, struct FpuState *fpu)									\
+	{																											\
+		double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];														\
+		int32_t ret = (exprD);																					\
+																												\
+		LOG("d%02u (%f) " opStr " -> f%02u (%d)\r\n", fpuPrvGetFpRegNumS(instr) / 2, s, fpuPrvGetFpRegNumD(instr), ret);	\
+		fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;																\
+		return FpuRetInstrDone;																					\
+	}
+
+FPU_BINOP(Add, "+", s + t)
+FPU_BINOP(Sub, "-", s - t)
+FPU_BINOP(Mul, "*", s * t)
+
+FPU_UNOP(Abs, "ABS", fabsf(s), fabs(s))
+FPU_UNOP(Mov, "MOV", s, s)
+FPU_UNOP(Neg, "NEG", -s, -s)
+
+#ifdef SUPPORT_FPU_R4000
+	FPU_TO_WORD(RoundW, "ROUND", roundf(s), round(s))
+	FPU_TO_WORD(TruncW, "TRUNC", s, s)
+	FPU_TO_WORD(CeilW, "CEIL", ceilf(s), ceil(s))
+	FPU_TO_WORD(FloorW, "FLOOR", floorf(s), floor(s))
+#endif
+
+//the only trap we do ourselves. we get here only if the others are all disabled, see fpuOp()
+static enum FpuOpRet fpuPrvDivS(uint32_t instr, struct FpuState *fpu)
+{
+	float s = fpu->f[fpuPrvGetFpRegNumS(instr)], t = fpu->f[fpuPrvGetFpRegNumT(instr)], ret;
+	
+	if (!t && s && isfinite(s) && (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES)))
+		return fpuPrvTrap(fpu, (FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
+	
+	ret = s / t;
+	LOG("f%02u (%f) / f%02u (%f) -> f%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr), s, fpuPrvGetFpRegNumT(instr), t, fpuPrvGetFpRegNumD(instr), ret);
+	fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvDivD(uint32_t instr, struct FpuState *fpu)
+{
+	double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2], t = fpu->d[fpuPrvGetFpRegNumT(instr) / 2], ret;
+	
+	if (!t && s && isfinite(s) && (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES)))
+		return fpuPrvTrap(fpu, (FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
+	
+	ret = s / t;
+	LOG("d%02u (%f) / d%02u (%f) -> d%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr) / 2, s, fpuPrvGetFpRegNumT(instr) / 2, t, fpuPrvGetFpRegNumD(instr) / 2, ret);
+	fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtSD(uint32_t instr, struct FpuState *fpu)
+{
+	float ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
+	
+	LOG("d%02u (%f) CVT.S.D -> f%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2], fpuPrvGetFpRegNumD(instr), ret);
+	fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtSW(uint32_t instr, struct FpuState *fpu)
+{
+	float ret = (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)];
+	
+	LOG("f%02u (%d) CVT.S.W -> f%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr), (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)], fpuPrvGetFpRegNumD(instr), ret);
+	fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtDS(uint32_t instr, struct FpuState *fpu)
+{
+	double ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
+	
+	LOG("f%02u (%f) CVT.D.S -> d%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)], fpuPrvGetFpRegNumD(instr) / 2, ret);
+	fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtDW(uint32_t instr, struct FpuState *fpu)
+{
+	double ret = (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)];
+	
+	LOG("f%02u (%d) CVT.D.W -> d%02u (%f)\r\n", fpuPrvGetFpRegNumS(instr), (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)], fpuPrvGetFpRegNumD(instr) / 2, ret);
+	fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtWS(uint32_t instr, struct FpuState *fpu)
+{
+	float s = fpu->f[fpuPrvGetFpRegNumS(instr)];
+	int32_t ret;
+	
+	switch (fpu->fcr & 3) {
+		case 0:	//round to nearest
+			ret = roundf(s);
+			break;
+		
+		case 1:	//round to zero
+			ret = s;
+			break;
+		
+		case 2:	//round to +inf
+			ret = ceilf(s);
+			break;
+		
+		case 3:	//round to -inf
+			ret = floorf(s);
+			break;
+		
+		default:
+			__builtin_unreachable();
+			break;
+	}
+	
+	LOG("f%02u (%f) CVT.W.S -> f%02u (%d)\r\n", fpuPrvGetFpRegNumS(instr), s, fpuPrvGetFpRegNumD(instr), ret);
+	fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCvtWD(uint32_t instr, struct FpuState *fpu)
+{
+	double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
+	int32_t ret;
+	
+	switch (fpu->fcr & 3) {
+		case 0:	//round to nearest
+			ret = round(s);
+			break;
+		
+		case 1:	//round to zero
+			ret = s;
+			break;
+		
+		case 2:	//round to +inf
+			ret = ceil(s);
+			break;
+		
+		case 3:	//round to -inf
+			ret = floor(s);
+			break;
+		
+		default:
+			__builtin_unreachable();
+			break;
+	}
+	
+	LOG("d%02u (%f) CVT.W.D -> f%02u (%d)\r\n", fpuPrvGetFpRegNumS(instr) / 2, s, fpuPrvGetFpRegNumD(instr), ret);
+	fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
+	return FpuRetInstrDone;
+}
+
+//compares. low 4 bits of func: which of (less, equal, unordered) make it true, and whether unordered is an invalid op
+//see page 670 of r4000 doc!!!
+static enum FpuOpRet fpuPrvCmpDone(uint32_t instr, struct FpuState *fpu, uint_fast8_t cond)
+{
+	uint_fast8_t op = instr & 0x0f;
+	
+	LOG("compare %u -> (signal: %u, ret: %u)\r\n", op, ((cond & 1) && (op & 0b1000)), !!(op & cond));
+	
+	//the invalid op trap is never enabled here (see fpuOp()), so this only ever sets the flag
+	if ((cond & 1) && (op & 0b1000))
+		fpu->fcr |= FCR_INVAL_OP << FCR_SHIFT_FLAGS;
+	
+	if (op & cond)
+		fpu->fcr |= FCR_C;
+	else
+		fpu->fcr &=~ FCR_C;
+	
+	return FpuRetInstrDone;
+}
+
+static enum FpuOpRet fpuPrvCmpS(uint32_t instr, struct FpuState *fpu)
+{
+	float s = fpu->f[fpuPrvGetFpRegNumS(instr)], t = fpu->f[fpuPrvGetFpRegNumT(instr)];
+	uint_fast8_t cond = 0;
+	
+	if (isnan(s) || isnan(t))
+		cond += 1;
+	else {
+		
+		if (s == t)
+			cond += 2;
+		if (s < t)
+			cond += 4;
+	}
+	
+	return fpuPrvCmpDone(instr, fpu, cond);
+}
+
+static enum FpuOpRet fpuPrvCmpD(uint32_t instr, struct FpuState *fpu)
+{
+	double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2], t = fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
+	uint_fast8_t cond = 0;
+	
+	if (isnan(s) || isnan(t))
+		cond += 1;
+	else {
+		
+		if (s == t)
+			cond += 2;
+		if (s < t)
+			cond += 4;
+	}
+	
+	return fpuPrvCmpDone(instr, fpu, cond);
+}
+
+#define FPU_CMP_OPS(f)		\
+	[0b110000] = f, [0b110001] = f, [0b110010] = f, [0b110011] = f, [0b110100] = f, [0b110101] = f, [0b110110] = f, [0b110111] = f,	\
+	[0b111000] = f, [0b111001] = f, [0b111010] = f, [0b111011] = f, [0b111100] = f, [0b111101] = f, [0b111110] = f, [0b111111] = f
+
+//by fmt (S, D, -, -, W) and func. gaps are for the kernel's emulator
+static const FpuOpF mFpuOps[FPU_FMT_W - FPU_FMT_S + 1][64] = {
+	[FPU_FMT_S - FPU_FMT_S] = {
+		[0b000000] = fpuPrvAddS,
+		[0b000001] = fpuPrvSubS,
+		[0b000010] = fpuPrvMulS,
+		[0b000011] = fpuPrvDivS,
+		[0b000101] = fpuPrvAbsS,
+		[0b000110] = fpuPrvMovS,
+		[0b000111] = fpuPrvNegS,
+	#ifdef SUPPORT_FPU_R4000
+		[0b001100] = fpuPrvRoundWS,
+		[0b001101] = fpuPrvTruncWS,
+		[0b001110] = fpuPrvCeilWS,
+		[0b001111] = fpuPrvFloorWS,
+	#endif
+		[0b100001] = fpuPrvCvtDS,
+		[0b100100] = fpuPrvCvtWS,
+		FPU_CMP_OPS(fpuPrvCmpS),
+	},
+	[FPU_FMT_D - FPU_FMT_S] = {
+		[0b000000] = fpuPrvAddD,
+		[0b000001] = fpuPrvSubD,
+		[0b000010] = fpuPrvMulD,
+		[0b000011] = fpuPrvDivD,
+		[0b000101] = fpuPrvAbsD,
+		[0b000110] = fpuPrvMovD,
+		[0b000111] = fpuPrvNegD,
+	#ifdef SUPPORT_FPU_R4000
+		[0b001100] = fpuPrvRoundWD,
+		[0b001101] = fpuPrvTruncWD,
+		[0b001110] = fpuPrvCeilWD,
+		[0b001111] = fpuPrvFloorWD,
+	#endif
+		[0b100000] = fpuPrvCvtSD,
+		[0b100100] = fpuPrvCvtWD,
+		FPU_CMP_OPS(fpuPrvCmpD),
+	},
+	[FPU_FMT_W - FPU_FMT_S] = {
+		[0b100000] = fpuPrvCvtSW,
+		[0b100001] = fpuPrvCvtDW,
+	},
+};
+
 enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 {
-	bool isDouble = false, isFloat = false, isFixed = false;
-	uint_fast8_t op;
+	uint_fast8_t fmt = (instr >> 21) & 0x1f;
+	FpuOpF f;
 	
 	//the minute anyone enables any trapping we cnanot easily support, we are GTFOing and letting the FPU emulator take it on...
 	if (fpu->fcr & ((FCR_INVAL_OP | FCR_CEF_OVERFLOW | FCR_CEF_UDERFLOW | FCR_CEF_INEXACT) << FCR_SHIFT_ENABLES))
-		goto inval;
+		return fpuPrvUnimpl(instr, fpu);
 	
-	fpu->fcr &=~ FCR_PEROP_FLAGS;
+	//arithmetic first, it is most of what we see
+	if ((unsigned)(fmt - FPU_FMT_S) <= FPU_FMT_W - FPU_FMT_S) {
+		
+		f = mFpuOps[fmt - FPU_FMT_S][instr & 0x3f];
+		
+		return f ? f(instr, fpu) : fpuPrvUnimpl(instr, fpu);
+	}
 	
-	switch ((instr >> 21) & 0x1f) {
+	switch (fmt) {
 		
 		case 0:	//MFC
 			cpuSetRegT(instr, fpu->i[fpuPrvGetFpRegNumS(instr)], cpuRegs);
 			LOG("MFC f%02u -> r%02u (%08x)\r\n", fpuPrvGetFpRegNumS(instr), cpuGetRegNumT(instr), fpu->i[fpuPrvGetFpRegNumS(instr)]);
 			return FpuRetInstrDone;
-			
+		
 		case 2: //CFC
 			switch (fpuPrvGetFpRegNumS(instr)) {
 				case 0:
@@ -111,12 +492,13 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 					return FpuRetInstrDone;
 				
 				case 31:	//FCR
+					fpuPrvFlagsSync(fpu);
 					cpuSetRegT(instr, fpu->fcr, cpuRegs);
 					LOG("CFC c%02u -> r%02u (%08x)\r\n", fpuPrvGetFpRegNumS(instr), cpuGetRegNumT(instr), fpu->fcr);
 					return FpuRetInstrDone;
 				
 				default:
-					goto inval;
+					break;
 			}
 			break;
 		
@@ -129,11 +511,12 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 			switch (fpuPrvGetFpRegNumS(instr)) {
 				case 31:	//FCR
 					LOG("CTC r%02u -> c%02u (%08x)\r\n", cpuGetRegNumT(instr), fpuPrvGetFpRegNumS(instr), cpuGetRegT(instr, cpuRegs));
+					fpuPrvFlagsDrop();
 					fpu->fcr = cpuGetRegT(instr, cpuRegs);
 					return FpuRetInstrDone;
 				
 				default:
-					goto inval;
+					break;
 			}
 			break;
 		
@@ -146,534 +529,10 @@ enum FpuOpRet fpuOp(uint32_t instr, uint32_t *cpuRegs, struct FpuState *fpu)
 				return FpuLikelyBranchNotTaken;
 			else
 				return FpuRetInstrDone;
-			
-		case 16:
-			isFloat = true;
-			break;
-		
-		case 17:
-			isDouble = true;
-			break;
-		
-		case 20:
-			isFixed = true;
-			break;
 		
 		default:
-			goto inval;
-	}
-	
-	switch (op = (instr & 0x3f)) {
-	
-		case 0b000000:	//ADD.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] + fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) + d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] + fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) + f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
 			break;
-		
-		case 0b000001:	//SUB.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] - fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) - d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] - fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) + f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
-			break;
-		
-		case 0b000010:	//MUL.fmt
-			if (isDouble) {
-				double ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] * fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				LOG("d%02u (%f) * d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] * fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				LOG("f%02u (%f) * f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				return FpuRetInstrInval;
-			break;
-		
-		case 0b000011:	//DIV.fmt
-			if (isDouble) {
-				
-				double denom = fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				double ret;
-				
-				if (!denom) {
-					fpu->fcr |= ((FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
-					if (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES))
-						return FpuRetExcTaken;
-				}
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2] / denom;
-				LOG("d%02u (%f) / d%02u (%f) -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float denom = fpu->f[fpuPrvGetFpRegNumT(instr)];
-				float ret;
-				
-				if (!denom) {
-					fpu->fcr |= ((FCR_CEF_DIV0 << FCR_SHIFT_CAUSE) | (FCR_CEF_DIV0 << FCR_SHIFT_FLAGS));
-					if (fpu->fcr & (FCR_CEF_DIV0 << FCR_SHIFT_ENABLES))
-						return FpuRetExcTaken;
-				}
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)] / denom;
-				LOG("f%02u (%f) / f%02u (%f) -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b000101:	//ABS.fmt
-			if (isDouble) {
-				
-				double ret;
-				
-				ret = fabs(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				
-				LOG("d%02u (%f) ABS -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fabsf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) ABS -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b000110:	//MOV.fmt
-			if (isDouble) {
-				
-				double ret;
-				
-				ret =  fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				
-				LOG("d%02u (%f) MOV -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-				LOG("f%02u (%f) MOV -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		
-		case 0b000111:	//NEG.fmt
-			if (isDouble) {
-				
-				double ret;
-				
-				ret = -fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				
-				LOG("d%02u (%f) NEG -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFloat) {
-				
-				float ret;
-				
-				ret = -fpu->f[fpuPrvGetFpRegNumS(instr)];
-				LOG("f%02u (%f) NEG -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-	
-	#ifdef SUPPORT_FPU_R4000
-		
-		case 0b001100:	//round.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = round(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) ROUND -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = roundf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) ROUND -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b001101:	//trunc.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				LOG("d%02u (%f) TRUNC -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-				LOG("f%02u (%f) TRUNC -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b001110:	//ceil.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = ceil(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) CEIL -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = ceilf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) CEIL -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b001111:	//floor.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				ret = floor(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-				LOG("d%02u (%f) FLOOR -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				ret = floorf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-				LOG("f%02u (%f) FLOOR -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;	
-	
-	#endif
-	
-		case 0b100000:	//CVT.S.fmt
-			if (isDouble) {
-				
-				float ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				
-				LOG("d%02u (%f) CVT.S.D -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFixed) {
-				
-				float ret = (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)];
-				
-				LOG("f%02u (%d) CVT.S.W -> f%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->f[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b100001:	//CVT.D.fmt
-			if (isFloat) {
-				double ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-				
-				LOG("f%02u (%f) CVT.D.S -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr) / 2, ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else if (isFixed) {
-				double ret = (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)];
-				
-				LOG("f%02u (%d) CVT.D.W -> d%02u (%f)\r\n",
-					fpuPrvGetFpRegNumS(instr), (int32_t)fpu->i[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->d[fpuPrvGetFpRegNumD(instr) / 2] = ret;
-			}
-			else
-				goto inval;
-			break;
-		
-		case 0b100100:	//CVT.W.fmt
-			if (isDouble) {
-				
-				int32_t ret;
-				
-				switch (fpu->fcr & 3) {
-					case 0:	//round to nearest
-						ret = round(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					case 1:	//round to zero
-						ret = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-						break;
-					
-					case 2:	//round to +inf
-						ret = ceil(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					case 3:	//round to -inf
-						ret = floor(fpu->d[fpuPrvGetFpRegNumS(instr) / 2]);
-						break;
-					
-					default:
-						__builtin_unreachable();
-						break;
-				}
-				
-				LOG("d%02u (%f) CVT.W.D -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else if (isFloat) {
-				
-				int32_t ret;
-				
-				switch (fpu->fcr & 3) {
-					case 0:	//round to nearest
-						ret = roundf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					case 1:	//round to zero
-						ret = fpu->f[fpuPrvGetFpRegNumS(instr)];
-						break;
-					
-					case 2:	//round to +inf
-						ret = ceilf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					case 3:	//round to -inf
-						ret = floorf(fpu->f[fpuPrvGetFpRegNumS(instr)]);
-						break;
-					
-					default:
-						__builtin_unreachable();
-						break;
-				}
-				
-				LOG("f%02u (%f) CVT.W.S -> f%02u (%d)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					fpuPrvGetFpRegNumD(instr), ret);
-				fpu->i[fpuPrvGetFpRegNumD(instr)] = ret;
-			}
-			else
-				goto inval;
-			break;
-	
-		//compares (specializing these might gain speed)
-		//see page 670 of r4000 doc!!!
-		case 0b110000:	//C.f.fmt
-		case 0b110001:	//C.un.fmt
-		case 0b110010:	//C.eq.fmt
-		case 0b110011:	//C.ueq.fmt
-		case 0b110100:	//C.olt.fmt
-		case 0b110101:	//C.ult.fmt
-		case 0b110110:	//C.ole.fmt
-		case 0b110111:	//C.ule.fmt
-		case 0b111000:	//C.sf.fmt
-		case 0b111001:	//C.ngle.fmt
-		case 0b111010:	//C.seq.fmt
-		case 0b111011:	//C.ngl.fmt
-		case 0b111100:	//C.lt.fmt
-		case 0b111101:	//C.nge.fmt
-		case 0b111110:	//C.le.fmt
-		case 0b111111:	//C.ngt.fmt
-		{
-			static const char *names[] = {"f", "un", "eq", "ueq", "olt", "ult",  "ole", "ule", "sf", "ngle", "seq", "ngl", "lt", "nge", "le", "ngt", };
-			uint_fast8_t cond = 0;
-			
-			(void)names;
-			
-			if (isDouble) {
-				
-				double s = fpu->d[fpuPrvGetFpRegNumS(instr) / 2];
-				double t = fpu->d[fpuPrvGetFpRegNumT(instr) / 2];
-				
-				if (isnan(s) || isnan(t))
-					cond += 1;
-				else {
-					
-					if (s == t)
-						cond += 2;
-					if (s < t)
-						cond += 4;
-				}
-				
-				LOG("d%02u (%f) %s d%02u (%f) -> (signal: %u, ret: %u)\r\n",
-					fpuPrvGetFpRegNumS(instr) / 2, fpu->d[fpuPrvGetFpRegNumS(instr) / 2],
-					names[op & 15],
-					fpuPrvGetFpRegNumT(instr) / 2, fpu->d[fpuPrvGetFpRegNumT(instr) / 2],
-					((cond & 1) && (op & 0b1000)),
-					!!(op & cond));
-			}
-			else if (isFloat) {
-				
-				float s = fpu->f[fpuPrvGetFpRegNumS(instr)];
-				float t = fpu->f[fpuPrvGetFpRegNumT(instr)];
-				
-				if (isnan(s) || isnan(t))
-					cond += 1;
-				else {
-					
-					if (s == t)
-						cond += 2;
-					if (s < t)
-						cond += 4;
-				}
-				
-				LOG("f%02u (%f) %s f%02u (%f) -> (signal: %u, ret: %u)\r\n",
-					fpuPrvGetFpRegNumS(instr), fpu->f[fpuPrvGetFpRegNumS(instr)],
-					names[op & 15],
-					fpuPrvGetFpRegNumT(instr), fpu->f[fpuPrvGetFpRegNumT(instr)],
-					((cond & 1) && (op & 0b1000)),
-					!!(op & cond));
-			}
-			else
-				goto inval;
-			
-			if ((cond & 1) && (op & 0b1000)) {
-				
-				fpu->fcr |= ((FCR_INVAL_OP << FCR_SHIFT_CAUSE) | (FCR_INVAL_OP << FCR_SHIFT_FLAGS));
-				return FpuRetExcTaken;
-			}
-			
-			if (op & cond)
-				fpu->fcr |= FCR_C;
-			else
-				fpu->fcr &=~ FCR_C;			
-			break;
-		}
-		
-		default:
-			goto inval;
 	}
-	return FpuRetInstrDone;
-
-inval:
-	fpu->fcr |= FCR_UNIMPL;
-	return FpuRetExcTaken;
-}
\ No newline at end of file
+	
+	return fpuPrvUnimpl(instr, fpu);
+}
@@ -0,0 +1,402 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include "hostUart.h"
+#include "dz11.h"
+
+
+struct HostUartLine {
+	_Atomic int txFd;			//cpu thread writes it, reader thread swaps it as unix socket clients come and go
+	int rxFd;					//reader thread only (after init)
+	int listenFd;				//unix socket lines only
+	pthread_mutex_t txLock;		//held while writing, so reader thread never closes txFd under us
+	
+	//tx, only touched by the cpu thread
+	uint32_t used;
+	uint64_t pendingSince;		//0 if nothing pending or not yet noticed by hostUartPoll()
+	uint64_t lastFlush;
+	uint8_t buf[HOST_UART_TX_BUF_SZ];
+	
+	//rx, single producer (reader thread), single consumer (cpu thread). indices are free-running
+	_Atomic uint32_t rxHead, rxTail;
+	atomic_bool rxWaitingForSpace;	//reader stopped polling this line since ring was full
+	uint8_t rxBuf[HOST_UART_RX_BUF_SZ];
+};
+
+
+static struct HostUartLine mLines[HOST_UART_NUM_LINES];
+static atomic_bool mRxPending;		//set by reader thread, checked cheaply by the cpu thread
+static bool mRxBacklog;				//some ring still has chars the DZ11 had no room for
+static int mWakePipe[2];
+
+
+
+static uint64_t hostUartPrvGetTime(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void hostUartPrvFlush(struct HostUartLine *ln, uint64_t now)
+{
+	bool wasFull = ln->used == HOST_UART_TX_BUF_SZ;
+	uint32_t done = 0;
+	ssize_t ret;
+	int fd;
+	
+	pthread_mutex_lock(&ln->txLock);
+	fd = atomic_load(&ln->txFd);
+	while (fd >= 0 && done < ln->used) {
+		
+		ret = write(fd, ln->buf + done, ln->used - done);
+		if (ret > 0)
+			done += ret;
+		else if (ret < 0 && errno == EAGAIN)
+			break;		//nonblocking and nobody is reading. keep the rest, TRDY stays low till it drains
+		else if (ret < 0 && errno != EINTR) {
+			done = ln->used;		//nowhere to put it. drop it rather than hang the guest
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ln->txLock);
+	
+	if (fd < 0)		//client went away
+		done = ln->used;
+	
+	memmove(ln->buf, ln->buf + done, ln->used - done);
+	ln->used -= done;
+	ln->pendingSince = ln->used ? now : 0;
+	ln->lastFlush = now;
+	
+	if (wasFull && ln->used != HOST_UART_TX_BUF_SZ)
+		dz11txReadyChanged();
+}
+
+static void hostUartPrvSetClient(struct HostUartLine *ln, int fd)	//reader thread only
+{
+	int old;
+	
+	pthread_mutex_lock(&ln->txLock);
+	old = atomic_exchange(&ln->txFd, fd);
+	pthread_mutex_unlock(&ln->txLock);
+	
+	if (old >= 0)
+		close(old);
+	ln->rxFd = fd;
+}
+
+static void* hostUartPrvReaderThread(void *unused)
+{
+	struct pollfd pfds[HOST_UART_NUM_LINES + 1];
+	uint_fast8_t lineNo[HOST_UART_NUM_LINES];
+	uint_fast8_t i, nFds;
+	sigset_t set;
+	char dummy[16];
+	
+	(void)unused;
+	
+	//signals are for the main thread
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	
+	while (1) {
+		
+		pfds[0].fd = mWakePipe[0];
+		pfds[0].events = POLLIN;
+		nFds = 1;
+		
+		for (i = 0; i < HOST_UART_NUM_LINES; i++) {
+			
+			struct HostUartLine *ln = &mLines[i];
+			
+			//unix socket with nobody connected? wait for someone
+			if (ln->rxFd < 0 && ln->listenFd >= 0) {
+				
+				pfds[nFds].fd = ln->listenFd;
+				pfds[nFds].events = POLLIN;
+				lineNo[nFds++ - 1] = i;
+				continue;
+			}
+			
+			if (ln->rxFd < 0)
+				continue;
+			
+			//full? say so, then look again in case the cpu thread made space in between
+			if (atomic_load(&ln->rxHead) - atomic_load(&ln->rxTail) == HOST_UART_RX_BUF_SZ) {
+				
+				atomic_store(&ln->rxWaitingForSpace, true);
+				if (atomic_load(&ln->rxHead) - atomic_load(&ln->rxTail) == HOST_UART_RX_BUF_SZ)
+					continue;
+				atomic_store(&ln->rxWaitingForSpace, false);
+			}
+			
+			pfds[nFds].fd = ln->rxFd;
+			pfds[nFds].events = POLLIN;
+			lineNo[nFds++ - 1] = i;
+		}
+		
+		if (poll(pfds, nFds, -1) <= 0)
+			continue;
+		
+		if (pfds[0].revents)
+			while (read(mWakePipe[0], dummy, sizeof(dummy)) > 0);
+		
+		for (i = 1; i < nFds; i++) {
+			
+			struct HostUartLine *ln = &mLines[lineNo[i - 1]];
+			uint32_t head, space, ofst;
+			ssize_t ret;
+			int fd;
+			
+			if (!pfds[i].revents)
+				continue;
+			
+			if (pfds[i].fd == ln->listenFd) {
+				
+				fd = accept4(ln->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd >= 0)
+					hostUartPrvSetClient(ln, fd);
+				continue;
+			}
+			
+			//read as much as fits contiguously. rest comes next time around
+			head = atomic_load_explicit(&ln->rxHead, memory_order_relaxed);
+			space = HOST_UART_RX_BUF_SZ - (head - atomic_load_explicit(&ln->rxTail, memory_order_acquire));
+			ofst = head % HOST_UART_RX_BUF_SZ;
+			if (space > HOST_UART_RX_BUF_SZ - ofst)
+				space = HOST_UART_RX_BUF_SZ - ofst;
+			
+			ret = read(pfds[i].fd, ln->rxBuf + ofst, space);
+			if (ret > 0) {
+				atomic_store_explicit(&ln->rxHead, head + ret, memory_order_release);
+				atomic_store_explicit(&mRxPending, true, memory_order_release);
+			}
+			else if (!ret || (errno != EINTR && errno != EAGAIN)) {
+				
+				if (ln->listenFd >= 0)		//client left, go back to listening
+					hostUartPrvSetClient(ln, -1);
+				else						//EOF or dead. stop watching it
+					ln->rxFd = -1;
+			}
+		}
+	}
+	
+	return NULL;
+}
+
+static void hostUartPrvRxDrain(void)
+{
+	uint32_t head, tail, space;
+	uint_fast8_t i;
+	
+	mRxBacklog = false;
+	
+	for (i = 0; i < HOST_UART_NUM_LINES; i++) {
+		
+		struct HostUartLine *ln = &mLines[i];
+		
+		tail = atomic_load_explicit(&ln->rxTail, memory_order_relaxed);
+		head = atomic_load_explicit(&ln->rxHead, memory_order_acquire);
+		if (head == tail)
+			continue;
+		
+		//only give the DZ11 what its FIFO can take, the rest waits for the guest to read some
+		for (space = dz11charRxSpace(i); space && head != tail; space--)
+			dz11charRx(i, ln->rxBuf[tail++ % HOST_UART_RX_BUF_SZ]);
+		
+		if (head != tail)
+			mRxBacklog = true;
+		
+		atomic_store_explicit(&ln->rxTail, tail, memory_order_release);
+		
+		if (atomic_exchange(&ln->rxWaitingForSpace, false))
+			(void)!write(mWakePipe[1], "", 1);
+	}
+}
+
+static bool hostUartPrvAttach(uint_fast8_t line, const char *spec)
+{
+	struct HostUartLine *ln = &mLines[line];
+	struct sockaddr_un sa = {.sun_family = AF_UNIX, };
+	int fd, slaveFd;
+	
+	if (!strcmp(spec, "null"))
+		return true;
+	
+	if (!strcmp(spec, "stdio")) {
+		ln->rxFd = 0;
+		atomic_store(&ln->txFd, 1);
+		return true;
+	}
+	
+	if (!strcmp(spec, "stdout")) {
+		atomic_store(&ln->txFd, 1);
+		return true;
+	}
+	
+	if (!strncmp(spec, "file:", 5)) {
+		
+		fd = open(spec + 5, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			perror("cannot open serial port output file");
+			return false;
+		}
+		atomic_store(&ln->txFd, fd);
+		return true;
+	}
+	
+	if (!strcmp(spec, "pty")) {
+		
+		fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0 || grantpt(fd) || unlockpt(fd) || !ptsname(fd)) {
+			perror("cannot create a pty");
+			return false;
+		}
+		//keep the slave open ourselves, else reads on the master fail while nobody has it open
+		slaveFd = open(ptsname(fd), O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (slaveFd < 0) {
+			perror("cannot open pty slave");
+			return false;
+		}
+		fprintf(stderr, "serial line %u is at %s\n", line, ptsname(fd));
+		ln->rxFd = fd;
+		atomic_store(&ln->txFd, fd);
+		return true;
+	}
+	
+	if (!strncmp(spec, "unix:", 5)) {
+		
+		if (strlen(spec + 5) >= sizeof(sa.sun_path)) {
+			fprintf(stderr, "unix socket path '%s' too long\n", spec + 5);
+			return false;
+		}
+		strcpy(sa.sun_path, spec + 5);
+		unlink(sa.sun_path);
+		
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr*)&sa, sizeof(sa)) || listen(fd, 1)) {
+			perror("cannot listen on unix socket");
+			return false;
+		}
+		ln->listenFd = fd;
+		return true;
+	}
+	
+	fprintf(stderr, "unknown serial line attachment '%s'\n", spec);
+	return false;
+}
+
+bool hostUartInit(const char* const specs[HOST_UART_NUM_LINES])
+{
+	pthread_t thread;
+	uint_fast8_t i;
+	
+	for (i = 0; i < HOST_UART_NUM_LINES; i++) {
+		
+		struct HostUartLine *ln = &mLines[i];
+		
+		ln->rxFd = -1;
+		ln->listenFd = -1;
+		atomic_store(&ln->txFd, -1);
+		pthread_mutex_init(&ln->txLock, NULL);
+		
+		//line 3 is the console, it goes to stdio unless asked otherwise
+		if (!hostUartPrvAttach(i, (specs && specs[i]) ? specs[i] : (i == 3 ? "stdio" : "null")))
+			return false;
+	}
+	
+	//a socket client going away should not take us with it
+	signal(SIGPIPE, SIG_IGN);
+	
+	if (pipe(mWakePipe))
+		return false;
+	fcntl(mWakePipe[0], F_SETFL, fcntl(mWakePipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(mWakePipe[1], F_SETFL, fcntl(mWakePipe[1], F_GETFL) | O_NONBLOCK);
+	
+	if (pthread_create(&thread, NULL, hostUartPrvReaderThread, NULL))
+		return false;
+	pthread_detach(thread);
+	
+	return true;
+}
+
+bool hostUartTxReady(uint_fast8_t line)
+{
+	//a line with nothing attached drains infinitely fast
+	return line >= HOST_UART_NUM_LINES || mLines[line].used < HOST_UART_TX_BUF_SZ;
+}
+
+void hostUartTx(uint_fast8_t line, uint_fast8_t chr)
+{
+	struct HostUartLine *ln;
+	uint64_t now;
+	
+	if (line >= HOST_UART_NUM_LINES || atomic_load_explicit(&(ln = &mLines[line])->txFd, memory_order_relaxed) < 0)
+		return;
+	
+	if (ln->used == HOST_UART_TX_BUF_SZ)	//guest ignored TRDY
+		return;
+	
+	ln->buf[ln->used++] = chr;
+	
+	//newline goes out right away, unless we are being flooded. then the deadline batches lines up
+	if (chr == '\n' && (now = hostUartPrvGetTime()) - ln->lastFlush >= HOST_UART_FLUSH_DEADLINE)
+		hostUartPrvFlush(ln, now);
+	else if (ln->used == HOST_UART_TX_BUF_SZ)
+		ln->pendingSince = 1;	//anything nonzero and old, flush at next poll
+}
+
+void hostUartPoll(void)
+{
+	uint64_t now = 0;
+	uint_fast8_t i;
+	
+	if (mRxBacklog || (atomic_load_explicit(&mRxPending, memory_order_relaxed) && atomic_exchange_explicit(&mRxPending, false, memory_order_acquire)))
+		hostUartPrvRxDrain();
+	
+	for (i = 0; i < HOST_UART_NUM_LINES; i++) {
+		
+		struct HostUartLine *ln = &mLines[i];
+		
+		if (!ln->used)
+			continue;
+		
+		if (!now)
+			now = hostUartPrvGetTime();
+		
+		if (!ln->pendingSince)
+			ln->pendingSince = now;
+		else if (now - ln->pendingSince >= HOST_UART_FLUSH_DEADLINE)
+			hostUartPrvFlush(ln, now);
+	}
+}
+
+void hostUartFlushAll(void)
+{
+	uint_fast8_t i;
+	
+	for (i = 0; i < HOST_UART_NUM_LINES; i++) {
+		
+		if (mLines[i].used)
+			hostUartPrvFlush(&mLines[i], hostUartPrvGetTime());
+	}
+}
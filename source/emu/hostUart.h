@@ -0,0 +1,37 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _HOST_UART_H_
+#define _HOST_UART_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//host side of the DZ11 lines. output is buffered per line and written out in bulk. input is
+//read in bulk by a separate thread into a ring per line, and fed to the DZ11 as its FIFO has room
+
+#define HOST_UART_NUM_LINES			4
+#define HOST_UART_TX_BUF_SZ			4096
+#define HOST_UART_RX_BUF_SZ			4096		//must be a power of 2
+#define HOST_UART_FLUSH_DEADLINE	2000		//in usec. no char waits longer than about this
+
+
+//specs[n] says where line n goes, NULL for default (line 3 on stdio, rest unconnected):
+//	"stdio"				stdin/stdout
+//	"stdout"			output only, to stdout
+//	"null"				nothing, output is dropped
+//	"pty"				a new pseudo-terminal, its name is printed at startup
+//	"unix:<path>"		a listening unix stream socket, one client at a time
+//	"file:<path>"		output only, to a file
+bool hostUartInit(const char* const specs[HOST_UART_NUM_LINES]);
+
+bool hostUartTxReady(uint_fast8_t line);
+void hostUartTx(uint_fast8_t line, uint_fast8_t chr);
+
+void hostUartPoll(void);		//call often, writes out whatever is due and feeds input to the DZ11
+void hostUartFlushAll(void);
+
+
+#endif
@@ -0,0 +1,423 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "../hypercall.h"
+#include "kernelBoot.h"
+#include "soc.h"
+#include "cpu.h"
+#include "mem.h"
+
+
+#define MY_SYS_TYPE			0x00010000	//DS2100/3100, same as the loader
+#define MY_SYS_TYPE_STR		"0x00010000"
+#define KERNEL_MAGIC		0x30464354	//REX magic, makes linux skip argv[1] like it does for the loader
+
+//guest memory layout. we use the same low memory the loader would, so kernel sees the same thing
+#define KBOOT_VECS_VA		0x80001000	//struct DecPromVectors
+#define KBOOT_STUBS_VA		0x80001100	//3 words per PROM vector
+#define KBOOT_DATA_VA		0x80001400	//strings and argv[]
+#define KBOOT_DATA_END_VA	0x80003c00
+#define KBOOT_STACK_VA		0x80004000	//same as loader's stack_start
+#define MIN_SAFE_ADDR		0x80004000	//nothing of ours above this
+
+#define PROM_VEC_SZ			0xa8		//sizeof(struct DecPromVectors)
+#define PROM_VEC_GETCHAR	(0x24 / 4)
+#define PROM_VEC_PRINTF		(0x30 / 4)
+#define PROM_VEC_GETENV		(0x64 / 4)
+#define PROM_VEC_SLOTADDR	(0x6c / 4)
+#define PROM_VEC_CLEARCACHE	(0x7c / 4)
+#define PROM_VEC_GETSYSID	(0x80 / 4)
+#define PROM_VEC_GETMEMBMP	(0x84 / 4)
+#define PROM_VEC_GETTCINFO	(0xa4 / 4)
+
+#define INSTR_LI_AT(v)		(0x34010000 + (v))	//ori $at, $zero, v
+#define INSTR_JR_RA			0x03e00008
+
+#define EI_CLASS			4
+#define EI_DATA				5
+#define EI_VERSION			6
+#define ELFCLASS32			1
+#define ELFDATA2LSB			1
+#define EV_CURRENT			1
+#define ET_EXEC				2
+#define EM_MIPS				8
+#define EM_MIPS_RS4_BE		10
+#define PT_LOAD				1
+
+
+struct ElfHeader {
+	uint8_t		e_ident[16];
+	uint16_t	e_type;
+	uint16_t	e_machine;
+	uint32_t	e_version;
+	uint32_t	e_entry;
+	uint32_t	e_phoff;
+	uint32_t	e_shoff;
+	uint32_t	e_flags;
+	uint16_t	e_ehsize;
+	uint16_t	e_phentsize;
+	uint16_t	e_phnum;
+	uint16_t	e_shentsize;
+	uint16_t	e_shnum;
+	uint16_t	e_shstrndx;
+} __attribute__((packed));
+
+struct ElfProgHdr{
+	uint32_t	p_type;
+	uint32_t	p_offset;
+	uint32_t	p_vaddr;
+	uint32_t	p_paddr;
+	uint32_t	p_filesz;
+	uint32_t	p_memsz;
+	uint32_t	p_flags;
+	uint32_t	p_align;
+} __attribute__((packed));
+
+
+static uint32_t mSysTypeStrVa;
+
+
+
+static void* kernelBootPrvGuestPtr(uint32_t va, uint32_t len)	//kseg0/kseg1 only, which is all PROM users ever pass us
+{
+	if ((va >> 30) != 2)
+		return NULL;
+	
+	return memGetDirectPtr(va & 0x1fffffff, len);
+}
+
+static bool kernelBootPrvWrite32(uint32_t va, uint32_t val)
+{
+	//XXX: endianness
+	uint32_t *dst = kernelBootPrvGuestPtr(va, sizeof(uint32_t));
+	
+	if (!dst)
+		return false;
+	*dst = val;
+	cpuHostRamWritten(va & 0x1fffffff, sizeof(uint32_t));
+	
+	return true;
+}
+
+static uint32_t kernelBootPrvArg(uint_fast8_t idx)		//o32: first 4 in regs, rest on stack past the 16-byte home area
+{
+	const uint32_t *src;
+	
+	if (idx < 4)
+		return cpuGetRegExternal(MIPS_REG_A0 + idx);
+	
+	src = kernelBootPrvGuestPtr(cpuGetRegExternal(MIPS_REG_SP) + 4 * idx, sizeof(uint32_t));
+	
+	return src ? *src : 0;
+}
+
+static void kernelBootPrvGuestStr(char *dst, uint32_t dstSz, uint32_t va)
+{
+	const char *src;
+	uint32_t i;
+	
+	for (i = 0; i < dstSz - 1 && (src = kernelBootPrvGuestPtr(va + i, 1)) && *src; i++)
+		dst[i] = *src;
+	dst[i] = 0;
+}
+
+static void kernelBootPrvPutchar(char ch)
+{
+	if (ch == '\n')
+		fputc('\r', stderr);
+	fputc(ch, stderr);
+}
+
+static void kernelBootPrvPuts(const char *str)
+{
+	while (*str)
+		kernelBootPrvPutchar(*str++);
+}
+
+static void kernelBootPrvPromPrintf(void)
+{
+	uint32_t fmtVa = kernelBootPrvArg(0), argIdx = 1;
+	char spec[24], str[256], out[320];
+	const char *ch;
+	uint32_t specLen;
+	
+	while ((ch = kernelBootPrvGuestPtr(fmtVa++, 1)) && *ch) {
+		
+		if (*ch != '%') {
+			kernelBootPrvPutchar(*ch);
+			continue;
+		}
+		
+		//collect flags, width, precision. drop length modifiers, everything is 32 bits here
+		spec[0] = '%';
+		specLen = 1;
+		while ((ch = kernelBootPrvGuestPtr(fmtVa++, 1)) && *ch && specLen < sizeof(spec) - 2) {
+			
+			if (strchr("-+ #0123456789.", *ch))
+				spec[specLen++] = *ch;
+			else if (!strchr("hlzjt", *ch))
+				break;
+		}
+		if (!ch || !*ch)
+			break;
+		
+		spec[specLen++] = *ch;
+		spec[specLen] = 0;
+		
+		switch (*ch) {
+			case 'd':
+			case 'i':
+				snprintf(out, sizeof(out), spec, (int)kernelBootPrvArg(argIdx++));
+				break;
+			
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			case 'c':
+				snprintf(out, sizeof(out), spec, (unsigned)kernelBootPrvArg(argIdx++));
+				break;
+			
+			case 'p':
+				snprintf(out, sizeof(out), "0x%08x", (unsigned)kernelBootPrvArg(argIdx++));
+				break;
+			
+			case 's':
+				kernelBootPrvGuestStr(str, sizeof(str), kernelBootPrvArg(argIdx++));
+				snprintf(out, sizeof(out), spec, str);
+				break;
+			
+			case '%':
+				strcpy(out, "%");
+				break;
+			
+			default:	//print what we did not understand as is
+				snprintf(out, sizeof(out), "%s", spec);
+				break;
+		}
+		kernelBootPrvPuts(out);
+	}
+}
+
+static uint32_t kernelBootPrvPromGetMemBitmap(uint32_t outVa)
+{
+	//same as the loader: one byte per bit, pgSz is per-bit size / 8
+	uint32_t nBits = socGetMemMap(0), eachBitSz = socGetMemMap(1), i;
+	uint8_t *bmp = kernelBootPrvGuestPtr(outVa + sizeof(uint32_t), nBits);
+	
+	if (!bmp || !kernelBootPrvWrite32(outVa, eachBitSz / 8))
+		return 0;
+	
+	for (i = 0; i < nBits; i++)
+		bmp[i] = -((socGetMemMap(2 + i / 8) >> (i % 8)) & 1);
+	cpuHostRamWritten((outVa + sizeof(uint32_t)) & 0x1fffffff, nBits);
+	
+	return nBits;
+}
+
+bool kernelBootPromCall(uint_fast8_t vecIdx)
+{
+	char str[64];
+	uint32_t ret = 0;
+	
+	switch (vecIdx) {
+		case PROM_VEC_GETCHAR:
+			ret = -1;
+			break;
+		
+		case PROM_VEC_PRINTF:
+			kernelBootPrvPromPrintf();
+			break;
+		
+		case PROM_VEC_GETENV:
+			kernelBootPrvGuestStr(str, sizeof(str), cpuGetRegExternal(MIPS_REG_A0));
+			if (!strcmp(str, "systype"))
+				ret = mSysTypeStrVa;
+			else
+				fprintf(stderr, "PROM: got asked for unknown env type '%s'\r\n", str);
+			break;
+		
+		case PROM_VEC_SLOTADDR:
+		case PROM_VEC_GETTCINFO:
+			ret = 0;	//no turbochannel slots here....
+			break;
+		
+		case PROM_VEC_CLEARCACHE:
+			break;
+		
+		case PROM_VEC_GETSYSID:
+			ret = MY_SYS_TYPE;
+			break;
+		
+		case PROM_VEC_GETMEMBMP:
+			ret = kernelBootPrvPromGetMemBitmap(cpuGetRegExternal(MIPS_REG_A0));
+			break;
+		
+		default:
+			return false;
+	}
+	cpuSetRegExternal(MIPS_REG_V0, ret);
+	
+	return true;
+}
+
+static bool kernelBootPrvLoadElf(FILE *f, uint32_t *entryP)
+{
+	struct ElfProgHdr phdr;
+	struct ElfHeader ehdr;
+	uint8_t *dst;
+	uint32_t i;
+	
+	if (fread(&ehdr, sizeof(ehdr), 1, f) != 1 || memcmp(ehdr.e_ident, "\x7f" "ELF", 4)) {
+		fprintf(stderr, "Kernel not an ELF file\n");
+		return false;
+	}
+	
+	if (ehdr.e_ehsize < sizeof(struct ElfHeader) || ehdr.e_phentsize < sizeof(struct ElfProgHdr)) {
+		fprintf(stderr, "Kernel not a valid ELF file\n");
+		return false;
+	}
+	
+	if (ehdr.e_ident[EI_CLASS] != ELFCLASS32 || ehdr.e_ident[EI_DATA] != ELFDATA2LSB || ehdr.e_ident[EI_VERSION] != EV_CURRENT ||
+			ehdr.e_type != ET_EXEC || (ehdr.e_machine != EM_MIPS && ehdr.e_machine != EM_MIPS_RS4_BE)) {
+		fprintf(stderr, "Only v1 MIPS LE32 executable elf files supported\n");
+		return false;
+	}
+	
+	for (i = 0; i < ehdr.e_phnum; i++) {
+		
+		if (fseek(f, ehdr.e_phoff + i * ehdr.e_phentsize, SEEK_SET) || fread(&phdr, sizeof(phdr), 1, f) != 1) {
+			fprintf(stderr, "Kernel program header %u unreadable\n", i);
+			return false;
+		}
+		
+		if (phdr.p_type != PT_LOAD)
+			continue;
+		
+		if (phdr.p_filesz > phdr.p_memsz || phdr.p_paddr < MIN_SAFE_ADDR) {
+			fprintf(stderr, "Kernel load command %u (0x%08x + 0x%08x) is impossible\n", i, phdr.p_paddr, phdr.p_memsz);
+			return false;
+		}
+		
+		dst = kernelBootPrvGuestPtr(phdr.p_paddr, phdr.p_memsz);
+		if (!dst) {
+			fprintf(stderr, "Kernel load command %u (0x%08x + 0x%08x) is not in RAM\n", i, phdr.p_paddr, phdr.p_memsz);
+			return false;
+		}
+		
+		if (fseek(f, phdr.p_offset, SEEK_SET) || fread(dst, 1, phdr.p_filesz, f) != phdr.p_filesz) {
+			fprintf(stderr, "Kernel load command %u: short read\n", i);
+			return false;
+		}
+		memset(dst + phdr.p_filesz, 0, phdr.p_memsz - phdr.p_filesz);
+		
+		fprintf(stderr, "Loaded 0x%08x bytes to 0x%08x + 0x%08x\n", phdr.p_filesz, phdr.p_paddr, phdr.p_memsz);
+	}
+	
+	*entryP = ehdr.e_entry;
+	
+	return true;
+}
+
+static uint32_t kernelBootPrvPutStr(uint32_t *dataVaP, const char *str)	//returns VA or 0 if no space
+{
+	uint32_t len = strlen(str) + 1, va = *dataVaP;
+	char *dst;
+	
+	if (KBOOT_DATA_END_VA - va < len || !(dst = kernelBootPrvGuestPtr(va, len)))
+		return 0;
+	
+	memcpy(dst, str, len);
+	*dataVaP = va + len;
+	
+	return va;
+}
+
+static bool kernelBootPrvSetupProm(void)
+{
+	static const uint8_t vecs[] = {PROM_VEC_GETCHAR, PROM_VEC_PRINTF, PROM_VEC_GETENV, PROM_VEC_SLOTADDR,
+		PROM_VEC_CLEARCACHE, PROM_VEC_GETSYSID, PROM_VEC_GETMEMBMP, PROM_VEC_GETTCINFO, };
+	uint32_t i, stubVa = KBOOT_STUBS_VA;
+	uint8_t *vecTab;
+	
+	vecTab = kernelBootPrvGuestPtr(KBOOT_VECS_VA, PROM_VEC_SZ);
+	if (!vecTab)
+		return false;
+	memset(vecTab, 0, PROM_VEC_SZ);
+	
+	for (i = 0; i < sizeof(vecs) / sizeof(*vecs); i++, stubVa += 12) {
+		
+		if (!kernelBootPrvWrite32(KBOOT_VECS_VA + vecs[i] * 4, stubVa) ||
+				!kernelBootPrvWrite32(stubVa + 0, INSTR_LI_AT(H_PROM_BASE + vecs[i])) ||
+				!kernelBootPrvWrite32(stubVa + 4, INSTR_JR_RA) ||
+				!kernelBootPrvWrite32(stubVa + 8, HYPERCALL))	//in the delay slot, just like the loader's stubs
+			return false;
+	}
+	
+	return true;
+}
+
+bool kernelBootLoad(const char *path, const char *cmdline)
+{
+	static const char *defaultArgs = "earlyprintk=prom0 console=ttyS3 root=/dev/pvd3 rootfstype=ext4 rw init=/bin/sh";
+	uint32_t entryPt, dataVa = KBOOT_DATA_VA, argvVa, argc = 0, argVa;
+	char *args, *arg, *saveptr;
+	bool ret;
+	FILE *f;
+	
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open kernel file '%s'\n", path);
+		return false;
+	}
+	ret = kernelBootPrvLoadElf(f, &entryPt);
+	fclose(f);
+	if (!ret)
+		return false;
+	
+	if (!kernelBootPrvSetupProm()) {
+		fprintf(stderr, "Cannot place PROM vectors\n");
+		return false;
+	}
+	
+	mSysTypeStrVa = kernelBootPrvPutStr(&dataVa, MY_SYS_TYPE_STR);
+	
+	//argv[] array first (we do not know how long it is yet, so we reserve as many slots as could possibly fit), then strings
+	args = strdup(cmdline ? cmdline : defaultArgs);
+	if (!args)
+		return false;
+	
+	argvVa = (dataVa + 3) &~ 3;
+	dataVa = argvVa + 4 * (2 + (strlen(args) + 1) / 2 + 1);
+	
+	ret = !!mSysTypeStrVa;
+	ret = ret && (argVa = kernelBootPrvPutStr(&dataVa, "vmlinux")) && kernelBootPrvWrite32(argvVa + 4 * argc++, argVa);
+	ret = ret && (argVa = kernelBootPrvPutStr(&dataVa, "unused_arg")) && kernelBootPrvWrite32(argvVa + 4 * argc++, argVa);
+	for (arg = strtok_r(args, " \t", &saveptr); ret && arg; arg = strtok_r(NULL, " \t", &saveptr))
+		ret = (argVa = kernelBootPrvPutStr(&dataVa, arg)) && kernelBootPrvWrite32(argvVa + 4 * argc++, argVa);
+	ret = ret && kernelBootPrvWrite32(argvVa + 4 * argc, 0);
+	free(args);
+	
+	if (!ret) {
+		fprintf(stderr, "Kernel command line too long\n");
+		return false;
+	}
+	
+	//same state the loader leaves us in: ints off, kernel mode, args as per DEC PROM
+	cpuSetRegExternal(MIPS_EXT_REG_STATUS, cpuGetRegExternal(MIPS_EXT_REG_STATUS) &~ 3);
+	cpuSetRegExternal(MIPS_REG_SP, KBOOT_STACK_VA);
+	cpuSetRegExternal(MIPS_REG_A0, argc);
+	cpuSetRegExternal(MIPS_REG_A1, argvVa);
+	cpuSetRegExternal(MIPS_REG_A2, KERNEL_MAGIC);
+	cpuSetRegExternal(MIPS_REG_A3, KBOOT_VECS_VA);
+	cpuSetRegExternal(MIPS_EXT_REG_PC, entryPt);
+	
+	fprintf(stderr, "Direct boot: entry 0x%08x, %u args\n", entryPt, argc);
+	
+	return true;
+}
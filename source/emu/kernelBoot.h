@@ -0,0 +1,21 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _KERNEL_BOOT_H_
+#define _KERNEL_BOOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//direct kernel boot: does what the ROM + loader do (load ELF, provide PROM vectors, pass argv) from the host side
+//call after socInit(). cmdline may be NULL for the loader's default one
+bool kernelBootLoad(const char *path, const char *cmdline);
+
+//called for hypercalls H_PROM_BASE + n made by our PROM stubs
+bool kernelBootPromCall(uint_fast8_t vecIdx);
+
+
+#endif
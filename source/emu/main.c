@@ -12,21 +12,34 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
-#include <sys/select.h>
 #include <signal.h>
 #include <termios.h>
+#include <getopt.h>
+#include "../hypercall.h"
+#include "kernelBoot.h"
+#include "hostUart.h"
+#include "timeline.h"
+#include "batch.h"
+#include "pvNet.h"
+#include "pv9p.h"
+#include "ds1287.h"
 #include "dz11.h"
 #include "soc.h"
 #include "mem.h"
+#include "cpu.h"
+#ifdef SUPPORT_TRACE
+	#include "trace.h"
+#endif
 #define off64_t __off64_t
 
 
 
 
 static struct termios gOldTermios;
+static bool gTermiosSet = false;
 
 static FILE *gDiskFile;
-static bool gCtlCSeen = false;
+static volatile sig_atomic_t gCtlCSeen = 0;	//number of the signal that is to end the run
 
 
 
@@ -49,62 +62,416 @@ static bool massStorageAccess(uint8_t op, uint32_t sector, void *buf)
 	return false;
 }
 
-void ctl_cHandler(int v)	//handle SIGTERM      
+static bool isaParse(char *list, uint32_t *extsP)	//comma separated CPU_ISA_* names
 {
-	(void)v;
+	static const struct {
+		const char *name;
+		uint32_t exts;
+	} names[] = {
+		{"r3000",		0,},
+		{"mips32",		CPU_ISA_MOVCC | CPU_ISA_MUL | CPU_ISA_MAC | CPU_ISA_CLZ | CPU_ISA_BITFIELD | CPU_ISA_EXTEND | CPU_ISA_BYTESWAP,},
+		{"movcc",		CPU_ISA_MOVCC,},
+		{"mul",			CPU_ISA_MUL,},
+		{"mac",			CPU_ISA_MAC,},
+		{"clz",			CPU_ISA_CLZ,},
+		{"bitfield",	CPU_ISA_BITFIELD,},
+		{"extend",		CPU_ISA_EXTEND,},
+		{"byteswap",	CPU_ISA_BYTESWAP,},
+	};
+	uint_fast8_t i;
+	char *name;
 	
-	fclose(gDiskFile);
-	tcsetattr(0, TCSANOW, &gOldTermios);
-	gCtlCSeen = 1;
-	exit(0);
+	*extsP = 0;
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		
+		for (i = 0; i < sizeof(names) / sizeof(*names) && strcmp(name, names[i].name); i++);
+		if (i == sizeof(names) / sizeof(*names))
+			return false;
+		*extsP |= names[i].exts;
+	}
+	
+	return true;
+}
+
+static void termiosRestore(void)
+{
+	if (gTermiosSet)
+		tcsetattr(0, TCSANOW, &gOldTermios);
 }
 
+void ctl_cHandler(int v)	//handle SIGINT & SIGTERM. stdio, uart buffers and the run summary are not safe here, socSignalCheck() ends the run
+{
+	gCtlCSeen = v;
+}
+
+
+static void usage(const char *self)
+{
+	fprintf(stderr, "USAGE: %s [options] <rom.img> <disk.img>"
+	
+	#ifdef GDB_SUPPORT
+		" [<gdb_port>]"
+	#endif
+	
+	"\n       %s [options] --kernel <vmlinux> <disk.img>"
+	
+	#ifdef GDB_SUPPORT
+		" [<gdb_port>]"
+	#endif
+	
+	"\n"
+	"\t--kernel <file>         boot this ELF kernel directly, no ROM or loader needed\n"
+	"\t--cmdline <str>         kernel command line for --kernel (default is what the loader passes)\n"
+	"\t--ram <MB>              guest RAM size, up to %u MB (default %u MB)\n"
+	"\t--ram-populate          fault in all guest RAM at start\n"
+	"\t--ram-numa <node>       bind guest RAM to this host NUMA node\n"
+	"\t--rtc-clock <src>       what drives the RTC: 'instr' (1/8192 sec per 1024 instrs, default) or 'host' (real time)\n"
+	"\t--rtc-lost <policy>     with host clock, periodic irqs missed while we were slow: 'coalesce' (default), 'all' or 'skip'\n"
+	"\t--line <N>=<where>      attach serial line N (0..3) to stdio, null, pty, unix:<path> or file:<path>\n"
+	"\t                        (default is line 3 on stdio, the rest unattached)\n"
+	"\t--net <backend>         add a paravirtual NIC: unix:<path>,<peer> (linked to the emulator whose paths are\n"
+	"\t                        swapped), tap:<ifname>, or pcap:<out>[,<in>] (write tx frames, replay rx frames)\n"
+	"\t--net-mac <mac>         its MAC address, as xx:xx:xx:xx:xx:xx (default is made up from the pid)\n"
+	"\t--share <tag>=<dir>     export a host directory over 9P, guest mounts it with 'mount -t 9p -o trans=umips <tag>'.\n"
+	"\t                        <tag>:ro=<dir> makes it read only. may be given up to %u times\n"
+	"\t--isa <list>            MIPS32 instrs to run natively, comma separated: movcc, mul, mac, clz, bitfield,\n"
+	"\t                        extend, byteswap, or mips32 for all of them (default is none, as an R3000)\n"
+	"\t--tlb <entries>         TLB size, 64 to 1024 (default 64, as an R3000). guests that ask H_GET_TLB_SIZE use it all\n"
+	"\t--timeline              at exit, print the boot timeline: host time, instrs and exceptions between H_MARK marks\n"
+	"\t--exit-at-mark <id>     exit right after the guest makes the mark with this id (implies --timeline)\n"
+	"\t--batch <script>        type into the console from this expect-style script instead of stdin (see batch.h)\n"
+	"\t--timeout <sec>         end the run with status %u after this much host time\n"
+	"\t--timeout-guest <sec>   end the run with status %u after this much guest time (counted in instrs)\n"
+	"\t--summary <file>        at exit, write a JSON summary of the run: why and with what status it ended, counts, marks\n"
+	"\t                        exit status is what the guest gave H_TERM, or as above, or %u + signal number\n"
+	
+	#ifdef SUPPORT_TRACE
+		"\t--trace <file>          keep a binary instruction trace, dump it to <file> at exit, on crash, and on SIGUSR1\n"
+		"\t--trace-size <N>        trace ring size in records (default 1M)\n"
+		"\t--trace-start <N>       do not trace the first <N> instructions\n"
+		"\t--trace-pc <lo>-<hi>    only trace instructions in this PC range\n"
+		"\t--trace-asid <N>        only trace instructions run with this ASID\n"
+		"\t--trace-exc <ExcCode>   start tracing when an exception with this code is taken\n"
+	#endif
+	
+	, self, self, RAM_MAX_AMOUNT >> 20, RAM_DEFAULT_AMOUNT >> 20, PV9P_MAX_SHARES, BATCH_EXIT_TIMEOUT, BATCH_EXIT_TIMEOUT, BATCH_EXIT_SIGNAL);
+}
 
 int main(int argc, char** argv)
 {
+	enum {
+		OPT_TRACE = 0x100,
+		OPT_TRACE_SIZE,
+		OPT_TRACE_START,
+		OPT_TRACE_PC,
+		OPT_TRACE_ASID,
+		OPT_TRACE_EXC,
+		OPT_KERNEL,
+		OPT_CMDLINE,
+		OPT_RAM,
+		OPT_RAM_POPULATE,
+		OPT_RAM_NUMA,
+		OPT_LINE,
+		OPT_RTC_CLOCK,
+		OPT_RTC_LOST,
+		OPT_NET,
+		OPT_NET_MAC,
+		OPT_SHARE,
+		OPT_ISA,
+		OPT_TLB,
+		OPT_TIMELINE,
+		OPT_EXIT_AT_MARK,
+		OPT_BATCH,
+		OPT_TIMEOUT,
+		OPT_TIMEOUT_GUEST,
+		OPT_SUMMARY,
+	};
+	static const struct option opts[] = {
+		#ifdef SUPPORT_TRACE
+			{"trace",		required_argument,	NULL,	OPT_TRACE},
+			{"trace-size",	required_argument,	NULL,	OPT_TRACE_SIZE},
+			{"trace-start",	required_argument,	NULL,	OPT_TRACE_START},
+			{"trace-pc",	required_argument,	NULL,	OPT_TRACE_PC},
+			{"trace-asid",	required_argument,	NULL,	OPT_TRACE_ASID},
+			{"trace-exc",	required_argument,	NULL,	OPT_TRACE_EXC},
+		#endif
+		{"kernel",		required_argument,	NULL,	OPT_KERNEL},
+		{"cmdline",		required_argument,	NULL,	OPT_CMDLINE},
+		{"ram",			required_argument,	NULL,	OPT_RAM},
+		{"ram-populate",no_argument,		NULL,	OPT_RAM_POPULATE},
+		{"ram-numa",	required_argument,	NULL,	OPT_RAM_NUMA},
+		{"line",		required_argument,	NULL,	OPT_LINE},
+		{"rtc-clock",	required_argument,	NULL,	OPT_RTC_CLOCK},
+		{"rtc-lost",	required_argument,	NULL,	OPT_RTC_LOST},
+		{"net",			required_argument,	NULL,	OPT_NET},
+		{"net-mac",		required_argument,	NULL,	OPT_NET_MAC},
+		{"share",		required_argument,	NULL,	OPT_SHARE},
+		{"isa",			required_argument,	NULL,	OPT_ISA},
+		{"tlb",			required_argument,	NULL,	OPT_TLB},
+		{"timeline",	no_argument,		NULL,	OPT_TIMELINE},
+		{"exit-at-mark",required_argument,	NULL,	OPT_EXIT_AT_MARK},
+		{"batch",		required_argument,	NULL,	OPT_BATCH},
+		{"timeout",		required_argument,	NULL,	OPT_TIMEOUT},
+		{"timeout-guest",required_argument,	NULL,	OPT_TIMEOUT_GUEST},
+		{"summary",		required_argument,	NULL,	OPT_SUMMARY},
+		{"help",		no_argument,		NULL,	'h'},
+		{},
+	};
+	#ifdef SUPPORT_TRACE
+		struct TraceConfig traceCfg = {.numRecs = 1 << 20, .pcHi = 0xffffffff, .asid = -1, .startOnExc = -1, };
+		char *end;
+	#endif
+	struct SocRamCfg ramCfg = {.amount = RAM_DEFAULT_AMOUNT, .numaNode = -1, };
+	struct BatchConfig batchCfg = {};
+	enum Ds1287LostTickPolicy rtcLostPolicy = Ds1287LostTicksCoalesce;
+	bool rtcHostClock = false, timeline = false;
+	int64_t exitAtMark = -1;
+	uint32_t isaExts = 0;
 	struct termios cfg, old;
 	uint32_t romSz = 0;
 	uint8_t tmp;
+	const char *self = argv[0], *kernel = NULL, *cmdline = NULL, *lineSpecs[HOST_UART_NUM_LINES] = {}, *net = NULL;
+	uint8_t netMac[6];
+	bool haveNetMac = false;
+	const char *shares[PV9P_MAX_SHARES];
+	uint_fast8_t i, numShares = 0;
 	FILE *f;
-	int gdbPort = 0;
+	int gdbPort = 0, opt;
+	
+	while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+		switch (opt) {
+			#ifdef SUPPORT_TRACE
+				case OPT_TRACE:
+					traceCfg.dumpPath = optarg;
+					break;
+				
+				case OPT_TRACE_SIZE:
+					traceCfg.numRecs = strtoul(optarg, NULL, 0);
+					break;
+				
+				case OPT_TRACE_START:
+					traceCfg.startAfter = strtoull(optarg, NULL, 0);
+					break;
+				
+				case OPT_TRACE_PC:
+					traceCfg.pcLo = strtoul(optarg, &end, 0);
+					if (*end != '-') {
+						usage(self);
+						return -1;
+					}
+					traceCfg.pcHi = strtoul(end + 1, NULL, 0);
+					break;
+				
+				case OPT_TRACE_ASID:
+					traceCfg.asid = strtoul(optarg, NULL, 0) & 0x3f;
+					break;
+				
+				case OPT_TRACE_EXC:
+					traceCfg.startOnExc = strtoul(optarg, NULL, 0) & 0x1f;
+					break;
+			#endif
+			
+			case OPT_KERNEL:
+				kernel = optarg;
+				break;
+			
+			case OPT_CMDLINE:
+				cmdline = optarg;
+				break;
+			
+			case OPT_RAM:
+				ramCfg.amount = strtoul(optarg, NULL, 0);
+				if (!ramCfg.amount || ramCfg.amount > RAM_MAX_AMOUNT / RAM_MAP_BIT_SZ) {
+					usage(self);
+					return -1;
+				}
+				ramCfg.amount *= RAM_MAP_BIT_SZ;
+				break;
+			
+			case OPT_RAM_POPULATE:
+				ramCfg.populate = true;
+				break;
+			
+			case OPT_RAM_NUMA:
+				ramCfg.numaNode = atoi(optarg);
+				break;
+			
+			case OPT_LINE:
+				if (optarg[0] < '0' || optarg[0] >= '0' + HOST_UART_NUM_LINES || optarg[1] != '=') {
+					usage(self);
+					return -1;
+				}
+				lineSpecs[optarg[0] - '0'] = optarg + 2;
+				break;
+			
+			case OPT_RTC_CLOCK:
+				if (!strcmp(optarg, "host"))
+					rtcHostClock = true;
+				else if (!strcmp(optarg, "instr"))
+					rtcHostClock = false;
+				else {
+					usage(self);
+					return -1;
+				}
+				break;
+			
+			case OPT_RTC_LOST:
+				if (!strcmp(optarg, "coalesce"))
+					rtcLostPolicy = Ds1287LostTicksCoalesce;
+				else if (!strcmp(optarg, "all"))
+					rtcLostPolicy = Ds1287LostTicksDeliverAll;
+				else if (!strcmp(optarg, "skip"))
+					rtcLostPolicy = Ds1287LostTicksSkip;
+				else {
+					usage(self);
+					return -1;
+				}
+				break;
+			
+			case OPT_NET:
+				net = optarg;
+				break;
+			
+			case OPT_NET_MAC:
+				if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &netMac[0], &netMac[1], &netMac[2], &netMac[3], &netMac[4], &netMac[5]) != 6) {
+					usage(self);
+					return -1;
+				}
+				haveNetMac = true;
+				break;
+			
+			case OPT_SHARE:
+				if (numShares == PV9P_MAX_SHARES) {
+					usage(self);
+					return -1;
+				}
+				shares[numShares++] = optarg;
+				break;
+			
+			case OPT_ISA:
+				if (!isaParse(optarg, &isaExts)) {
+					usage(self);
+					return -1;
+				}
+				break;
+			
+			case OPT_TLB:	//socInit() does the cpuInit() that applies it
+				if (!cpuSetTlbSize(atoi(optarg))) {
+					usage(self);
+					return -1;
+				}
+				break;
+			
+			case OPT_TIMELINE:
+				timeline = true;
+				break;
+			
+			case OPT_EXIT_AT_MARK:
+				exitAtMark = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+			
+			case OPT_BATCH:
+				batchCfg.script = optarg;
+				break;
+			
+			case OPT_TIMEOUT:
+				batchCfg.timeoutUsec = strtod(optarg, NULL) * 1e6;
+				break;
+			
+			case OPT_TIMEOUT_GUEST:
+				batchCfg.timeoutInstrs = strtod(optarg, NULL) * CP0_COUNT_HZ;
+				break;
+			
+			case OPT_SUMMARY:
+				batchCfg.summaryPath = optarg;
+				break;
+			
+			default:
+				usage(self);
+				return -1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	
+	//with a direct kernel boot there is no rom, make the rest of the args line up as if there was one
+	if (kernel) {
+		argc++;
+		argv--;
+	}
 
 	#ifdef GDB_SUPPORT
 		if (argc == 4)
 			gdbPort = atoi(argv[--argc]);
 	#endif
 
-
-	if (argc != 3) {
-		fprintf(stderr, "USAGE: %s <rom.img> <disk.img>"
-		
-		#ifdef GDB_SUPPORT
-			" [<gdb_port]>"
-		#endif
-		
-		"\n", argv[0]);
+	if (argc != 3 || (cmdline && !kernel)) {
+		usage(self);
 		return -1;
-	}	
+	}
+	
+	#ifdef SUPPORT_TRACE
+		if (traceCfg.dumpPath && !traceInit(&traceCfg)) {
+			fprintf(stderr, "cannot allocate trace buffer\n");
+			return -3;
+		}
+	#endif
 	
-	if (!socInit(massStorageAccess)) {
+	timelineInit(timeline, exitAtMark);	//before the serial ports, so their last output is flushed before it prints
+	if (!batchInit(&batchCfg))
+		return -3;
+	
+	//the script does the typing, the console only prints
+	if (batchCfg.script && !lineSpecs[BATCH_CONSOLE_LINE])
+		lineSpecs[BATCH_CONSOLE_LINE] = "stdout";
+	
+	if (!hostUartInit(lineSpecs)) {
+		fprintf(stderr, "cannot set up host side of the serial ports\n");
+		return -3;
+	}
+	atexit(hostUartFlushAll);
+	
+	if (!socInit(massStorageAccess, &ramCfg)) {
 		fprintf(stderr," soc init fail\n");
 		return -3;
 	}
+	socRtcUseHostClock(rtcHostClock);
+	cpuSetIsaExts(isaExts);
+	ds1287setLostTickPolicy(rtcLostPolicy);
+	
+	if (net && !pvNetInit(net, haveNetMac ? netMac : NULL)) {
+		fprintf(stderr, "cannot set up the network device\n");
+		return -3;
+	}
+	
+	for (i = 0; i < numShares; i++) {
+		if (!pv9pInit(shares[i])) {
+			fprintf(stderr, "cannot export '%s'\n", shares[i]);
+			return -3;
+		}
+	}
 	
-	//load rom
-	f = fopen64(argv[1], "r+b");
-	if (!f) {
-		fprintf(stderr, "Failed to open ROM file\n");
-		exit(-2);
+	if (kernel) {
+		if (!kernelBootLoad(kernel, cmdline))
+			exit(-2);
 	}
-	while(fread(&tmp, 1, 1, f)) {
-		if (!memAccess((ROM_BASE & 0x1FFFFFFFUL) + romSz, 1, true, &tmp)) {
-			fprintf(stderr, "Failed to write rom byte %u\n", romSz);
-			exit(-3);
+	else {
+		//load rom
+		f = fopen64(argv[1], "r+b");
+		if (!f) {
+			fprintf(stderr, "Failed to open ROM file\n");
+			exit(-2);
+		}
+		while(fread(&tmp, 1, 1, f)) {
+			if (!memAccess((ROM_BASE & 0x1FFFFFFFUL) + romSz, 1, true, &tmp)) {
+				fprintf(stderr, "Failed to write rom byte %u\n", romSz);
+				exit(-3);
+			}
+			romSz++;
 		}
-		romSz++;
+		fclose(f);
+		fprintf(stderr, "Read %u bytes of rom\n", romSz);
 	}
-	fclose(f);
-	fprintf(stderr, "Read %u bytes of rom\n", romSz);
 	
 	gDiskFile = fopen64(argv[2], "r+b");
 	if(!gDiskFile){
@@ -112,8 +479,8 @@ int main(int argc, char** argv)
 		exit(-1);
 	}
 	
-	//setup the terminal
-	{
+	//setup the terminal, if there is one
+	if (isatty(0)) {
 		int ret;
 		
 		ret = tcgetattr(0, &old);
@@ -132,38 +499,43 @@ int main(int argc, char** argv)
 		ret = tcsetattr(0, TCSANOW, &cfg);
 		if(ret) perror("cannot set term attrs");
 		gOldTermios = old;
+		gTermiosSet = !ret;
+		atexit(termiosRestore);
 	}
 	
 	signal(SIGINT, &ctl_cHandler);
+	signal(SIGTERM, &ctl_cHandler);
 	socRun(gdbPort);
 	//does not return
 
 	return 0;
 }
 
+bool dz11charTxReady(uint_fast8_t line)
+{
+	return hostUartTxReady(line);
+}
+
 void dz11charPut(uint_fast8_t line, uint_fast8_t chr)
 {
-	if (line == 3) {
-		char ch = chr;
-		
-		while (1 != write(1, &ch, sizeof(ch)));
+	if (line == BATCH_CONSOLE_LINE)
+		batchConsoleOut(chr);
+	hostUartTx(line, chr);
+}
+
+void socSignalCheck(void)
+{
+	int sig = gCtlCSeen;
+	
+	if (sig) {
+		fclose(gDiskFile);
+		batchExit("signal", BATCH_EXIT_SIGNAL + sig);
 	}
 }
 
 void socInputCheck(void)
 {
-	struct timeval limit = {};
-	fd_set set;
-	
-	FD_ZERO(&set);
-	FD_SET(0, &set);
-	
-    if (1 == select(1, &set, NULL, NULL, & limit)) {
-    	
-    	char ch;
-    	
-    	if (1 == read(0, &ch, 1))
-    		dz11charRx(3, (uint8_t)ch);
-    }
+	socSignalCheck();
+	hostUartPoll();
+	batchPoll();
 }
-
@@ -75,6 +75,13 @@ void fastpathReport(uint32_t val, uint32_t addr)
 	pr("fastpath repot: [%08x] = %08x\n", addr, val);
 }
 
+bool dz11charTxReady(uint_fast8_t line)
+{
+	(void)line;
+	
+	return true;
+}
+
 void dz11charPut(uint_fast8_t line, uint_fast8_t chr)
 {
 	(void)chr;
@@ -329,14 +336,88 @@ static bool accessRam(uint32_t pa, uint_fast8_t size, bool write, void* buf, voi
 	return true;
 }
 
+static bool ramPrvRangeOk(uint32_t pa, uint32_t len)
+{
+	uint32_t nBits, eachBitSz, amt;
+	
+	spiRamGetMap(&nBits, &eachBitSz);
+	amt = nBits * eachBitSz;
+	
+	return pa < amt && amt - pa >= len;
+}
 
+//spi ram accesses may not cross 1K, so go in pieces that do not, and that fit mDiskBuf
+static uint32_t ramPrvChunk(uint32_t addr, uint32_t len, uint32_t maxSz)
+{
+	uint32_t ret = 1024 - addr % 1024;
+	
+	if (ret > maxSz)
+		ret = maxSz;
+	if (ret > sizeof(mDiskBuf))
+		ret = sizeof(mDiskBuf);
+	if (ret > len)
+		ret = len;
+	
+	return ret;
+}
+
+//same, for a piece that ends at addr + len
+static uint32_t ramPrvChunkBack(uint32_t addr, uint32_t len, uint32_t maxSz)
+{
+	uint32_t ret = (addr + len - 1) % 1024 + 1;
+	
+	if (ret > maxSz)
+		ret = maxSz;
+	if (ret > sizeof(mDiskBuf))
+		ret = sizeof(mDiskBuf);
+	if (ret > len)
+		ret = len;
+	
+	return ret;
+}
+
+static void ramPrvSet(uint32_t pa, uint8_t val, uint32_t len)
+{
+	uint32_t now;
+	
+	memset(mDiskBuf, val, sizeof(mDiskBuf));
+	for (; len; pa += now, len -= now) {
+		now = ramPrvChunk(pa, len, OPTIMAL_RAM_WR_SZ);
+		spiRamWrite(pa, mDiskBuf, now);
+	}
+}
+
+static void ramPrvMove(uint32_t dst, uint32_t src, uint32_t len)	//memmove semantics
+{
+	uint32_t now, t;
+	
+	if (dst > src && dst - src < len) {		//overlapping with dst above, go from the end
+		while (len) {
+			now = ramPrvChunkBack(src, len, OPTIMAL_RAM_RD_SZ);
+			t = ramPrvChunkBack(dst, len, OPTIMAL_RAM_WR_SZ);
+			if (now > t)
+				now = t;
+			len -= now;
+			spiRamRead(src + len, mDiskBuf, now);
+			spiRamWrite(dst + len, mDiskBuf, now);
+		}
+	}
+	else {
+		for (; len; src += now, dst += now, len -= now) {
+			now = ramPrvChunk(src, len, OPTIMAL_RAM_RD_SZ);
+			now = ramPrvChunk(dst, now, OPTIMAL_RAM_WR_SZ);
+			spiRamRead(src, mDiskBuf, now);
+			spiRamWrite(dst, mDiskBuf, now);
+		}
+	}
+}
 
 bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0, if any
 {
 	uint32_t hyperNum = cpuGetRegExternal(MIPS_REG_AT), t,  ramMapNumBits, ramMapEachBitSz;
 	const uint8_t *mRamMap;
 	uint_fast16_t ofst;
-	uint32_t blk, pa;
+	uint32_t blk, pa, src, len;
 	uint8_t chr;
 	bool ret;
 
@@ -388,6 +469,21 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 				pr(" rd_block(%u, 0x%08x) -> %d\n", blk, pa, ret);
 			break;
 		
+		case H_STOR_READ_MULTI:	//consecutive blocks keep the card's multi-block read going, see massStorageAccess()
+			blk = cpuGetRegExternal(MIPS_REG_A0);
+			pa = cpuGetRegExternal(MIPS_REG_A1);
+			len = cpuGetRegExternal(MIPS_REG_A2);
+			ret = len <= 0xffffffff / SD_BLOCK_SIZE && ramPrvRangeOk(pa, len * SD_BLOCK_SIZE);
+			for (; ret && len; len--, blk++) {
+				ret = massStorageAccess(MASS_STORE_OP_READ, blk, mDiskBuf);
+				for (ofst = 0; ret && ofst < SD_BLOCK_SIZE; ofst += t, pa += t) {
+					t = ramPrvChunk(pa, SD_BLOCK_SIZE - ofst, OPTIMAL_RAM_WR_SZ);
+					spiRamWrite(pa, mDiskBuf + ofst, t);
+				}
+			}
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
 		case H_STOR_WRITE:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
@@ -405,7 +501,37 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 			pr("termination requested\n");
 			while(1);
 			break;
+		
+		case H_GET_FEATURES:
+			cpuSetRegExternal(MIPS_REG_V0, H_FEAT_PAGE_OPS | H_FEAT_STOR_MULTI);	//our RTCs here are the real chip's subset
+			break;
+		
+		//these go through mDiskBuf, which is free between storage calls. icache is left alone, as for cpu stores
+		case H_PAGE_ZERO:
+		case H_MEM_SET:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			len = hyperNum == H_PAGE_ZERO ? H_PAGE_SIZE : cpuGetRegExternal(MIPS_REG_A2);
+			ret = (hyperNum == H_MEM_SET || !(pa % H_PAGE_SIZE)) && ramPrvRangeOk(pa, len);
+			if (ret)
+				ramPrvSet(pa, hyperNum == H_PAGE_ZERO ? 0 : cpuGetRegExternal(MIPS_REG_A1), len);
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
+		case H_PAGE_COPY:
+		case H_MEM_COPY:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			src = cpuGetRegExternal(MIPS_REG_A1);
+			len = hyperNum == H_PAGE_COPY ? H_PAGE_SIZE : cpuGetRegExternal(MIPS_REG_A2);
+			ret = (hyperNum == H_MEM_COPY || !((pa | src) % H_PAGE_SIZE)) && ramPrvRangeOk(pa, len) && ramPrvRangeOk(src, len);
+			if (ret && pa != src)
+				ramPrvMove(pa, src, len);
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
 
+		case H_MARK:	//no timeline here, but the loader makes these
+			cpuSetRegExternal(MIPS_REG_V0, false);
+			break;
+		
 		default:
 			pr("hypercall %u @ 0x%08x\n", hyperNum, cpuGetRegExternal(MIPS_EXT_REG_PC));
 			return false;
@@ -13,6 +13,7 @@ typedef struct {
 	uint32_t sz;
 	MemAccessF aF;
 	void *userData;
+	uint8_t *direct;
 
 } MemRegion;
 
@@ -25,6 +26,11 @@ struct {
 
 bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF, void* userData){
 
+	return memRegionAddDirect(pa, sz, aF, userData, NULL);
+}
+
+bool memRegionAddDirect(uint32_t pa, uint32_t sz, MemAccessF aF, void* userData, void *direct){
+	
 	uint8_t i;
 	
 	//check for intersection with another region
@@ -48,6 +54,7 @@ bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF aF, void* userData){
 			gMem.regions[i].sz = sz;
 			gMem.regions[i].aF = aF;
 			gMem.regions[i].userData = userData;
+			gMem.regions[i].direct = (uint8_t*)direct;
 		
 			return true;
 		}
@@ -92,3 +99,31 @@ bool memAccess(uint32_t addr, uint_fast8_t size, bool write, void* buf){
 	return false;
 }
 
+
+void* memGetDirectPtr(uint32_t pa, uint32_t len){
+	
+	uint_fast8_t i;
+	
+	for(i = 0; i < MAX_MEM_REGIONS; i++){
+		if(gMem.regions[i].direct && gMem.regions[i].pa <= pa && pa - gMem.regions[i].pa < gMem.regions[i].sz && gMem.regions[i].sz - (pa - gMem.regions[i].pa) >= len){
+		
+			return gMem.regions[i].direct + (pa - gMem.regions[i].pa);
+		}
+	}
+	
+	return NULL;
+}
+
+uint32_t memGetDirectSz(uint32_t pa){
+	
+	uint_fast8_t i;
+	
+	for(i = 0; i < MAX_MEM_REGIONS; i++){
+		if(gMem.regions[i].direct && gMem.regions[i].pa <= pa && pa - gMem.regions[i].pa < gMem.regions[i].sz){
+		
+			return gMem.regions[i].sz - (pa - gMem.regions[i].pa);
+		}
+	}
+	
+	return 0;
+}
@@ -17,8 +17,11 @@ typedef bool (*MemAccessF)(uint32_t pa, uint_fast8_t size, bool write, void* buf
 
 
 bool memRegionAdd(uint32_t pa, uint32_t sz, MemAccessF af, void* userData);
+bool memRegionAddDirect(uint32_t pa, uint32_t sz, MemAccessF af, void* userData, void *direct);	//for plain memory, direct points to its backing store
 bool memRegionDel(uint32_t pa, uint32_t sz);
 
 bool memAccess(uint32_t addr, uint_fast8_t size, bool write, void* buf);
+void* memGetDirectPtr(uint32_t pa, uint32_t len);		//NULL if [pa, pa + len) is not entirely inside a direct region
+uint32_t memGetDirectSz(uint32_t pa);					//how many bytes from pa on are directly accessible
 
 #endif
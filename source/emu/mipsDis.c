@@ -0,0 +1,171 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stdio.h>
+#include "mipsDis.h"
+#include "../hypercall.h"
+
+
+static const char *mRegNames[] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+const char* mipsRegName(uint_fast8_t reg)
+{
+	return mRegNames[reg & 31];
+}
+
+void mipsDisasm(char *dst, uint32_t dstSz, uint32_t instr, uint32_t pc)
+{
+	static const char *special[64] = {
+		[0] = "sll", [2] = "srl", [3] = "sra", [4] = "sllv", [6] = "srlv", [7] = "srav",
+		[8] = "jr", [9] = "jalr", [10] = "movz", [11] = "movn", [12] = "syscall", [13] = "break", [15] = "sync",
+		[16] = "mfhi", [17] = "mthi", [18] = "mflo", [19] = "mtlo",
+		[24] = "mult", [25] = "multu", [26] = "div", [27] = "divu",
+		[32] = "add", [33] = "addu", [34] = "sub", [35] = "subu", [36] = "and", [37] = "or", [38] = "xor", [39] = "nor",
+		[42] = "slt", [43] = "sltu",
+		[48] = "tge", [49] = "tgeu", [50] = "tlt", [51] = "tltu", [52] = "teq", [54] = "tne",
+	};
+	static const char *regimm[32] = {
+		[0] = "bltz", [1] = "bgez", [2] = "bltzl", [3] = "bgezl",
+		[8] = "tgei", [9] = "tgeiu", [10] = "tlti", [11] = "tltiu", [12] = "teqi", [14] = "tnei",
+		[16] = "bltzal", [17] = "bgezal", [18] = "bltzall", [19] = "bgezall",
+	};
+	static const char *major[64] = {
+		[4] = "beq", [5] = "bne", [6] = "blez", [7] = "bgtz",
+		[8] = "addi", [9] = "addiu", [10] = "slti", [11] = "sltiu", [12] = "andi", [13] = "ori", [14] = "xori", [15] = "lui",
+		[20] = "beql", [21] = "bnel",
+		[32] = "lb", [33] = "lh", [34] = "lwl", [35] = "lw", [36] = "lbu", [37] = "lhu", [38] = "lwr",
+		[40] = "sb", [41] = "sh", [42] = "swl", [43] = "sw", [46] = "swr",
+		[48] = "ll", [49] = "lwc1", [51] = "pref", [53] = "ldc1", [56] = "sc", [57] = "swc1", [61] = "sdc1",
+	};
+	static const char *cop0[64] = {
+		[1] = "tlbr", [2] = "tlbwi", [6] = "tlbwr", [8] = "tlbp", [16] = "rfe", [24] = "eret",
+	};
+	uint_fast8_t op = instr >> 26, rs = (instr >> 21) & 31, rt = (instr >> 16) & 31, rd = (instr >> 11) & 31;
+	uint_fast8_t sa = (instr >> 6) & 31, func = instr & 63;
+	int32_t simm = (int16_t)instr;
+	uint32_t uimm = (uint16_t)instr, brDst = pc + 4 + (simm << 2);
+	const char *name;
+	
+	switch (op) {
+		case 0:
+			name = special[func];
+			if (!instr)
+				snprintf(dst, dstSz, "nop");
+			else if (!name)
+				break;
+			else if (func <= 3)
+				snprintf(dst, dstSz, "%-7s%s, %s, %u", name, mRegNames[rd], mRegNames[rt], sa);
+			else if (func <= 7)
+				snprintf(dst, dstSz, "%-7s%s, %s, %s", name, mRegNames[rd], mRegNames[rt], mRegNames[rs]);
+			else if (func == 8)
+				snprintf(dst, dstSz, "%-7s%s", name, mRegNames[rs]);
+			else if (func == 9)
+				snprintf(dst, dstSz, "%-7s%s, %s", name, mRegNames[rd], mRegNames[rs]);
+			else if (func == 12 || func == 13 || func == 15)
+				snprintf(dst, dstSz, "%s", name);
+			else if (func == 16 || func == 18)
+				snprintf(dst, dstSz, "%-7s%s", name, mRegNames[rd]);
+			else if (func == 17 || func == 19)
+				snprintf(dst, dstSz, "%-7s%s", name, mRegNames[rs]);
+			else if (func >= 24 && func <= 27)
+				snprintf(dst, dstSz, "%-7s%s, %s", name, mRegNames[rs], mRegNames[rt]);
+			else if (func >= 48)
+				snprintf(dst, dstSz, "%-7s%s, %s", name, mRegNames[rs], mRegNames[rt]);
+			else
+				snprintf(dst, dstSz, "%-7s%s, %s, %s", name, mRegNames[rd], mRegNames[rs], mRegNames[rt]);
+			return;
+		
+		case 1:
+			name = regimm[rt];
+			if (!name)
+				break;
+			if (rt >= 8 && rt <= 14)
+				snprintf(dst, dstSz, "%-7s%s, %d", name, mRegNames[rs], (int)simm);
+			else
+				snprintf(dst, dstSz, "%-7s%s, 0x%08x", name, mRegNames[rs], (unsigned)brDst);
+			return;
+		
+		case 2:
+		case 3:
+			snprintf(dst, dstSz, "%-7s0x%08x", op == 2 ? "j" : "jal", (unsigned)(((pc + 4) & 0xf0000000ul) | ((instr << 2) & 0x0ffffffful)));
+			return;
+		
+		case 16:
+			if (rs == 0 || rs == 4)
+				snprintf(dst, dstSz, "%-7s%s, $%u", rs ? "mtc0" : "mfc0", mRegNames[rt], rd);
+			else if (rs == 16 && cop0[func])
+				snprintf(dst, dstSz, "%s", cop0[func]);
+			else
+				break;
+			return;
+		
+		case 17:
+			if (rs == 0 || rs == 4)
+				snprintf(dst, dstSz, "%-7s%s, $f%u", rs ? "mtc1" : "mfc1", mRegNames[rt], rd);
+			else if (rs == 2 || rs == 6)
+				snprintf(dst, dstSz, "%-7s%s, $fcr%u", rs == 6 ? "ctc1" : "cfc1", mRegNames[rt], rd);
+			else if (rs == 8)
+				snprintf(dst, dstSz, "bc1%c%s  0x%08x", (rt & 1) ? 't' : 'f', (rt & 2) ? "l" : " ", (unsigned)brDst);
+			else
+				snprintf(dst, dstSz, "cop1   0x%07x", (unsigned)(instr & 0x01ffffff));
+			return;
+		
+		case 28:	//SPECIAL2
+			if (func == 0 || func == 1 || func == 4 || func == 5)
+				snprintf(dst, dstSz, "%-7s%s, %s", func == 0 ? "madd" : func == 1 ? "maddu" : func == 4 ? "msub" : "msubu", mRegNames[rs], mRegNames[rt]);
+			else if (func == 2)
+				snprintf(dst, dstSz, "%-7s%s, %s, %s", "mul", mRegNames[rd], mRegNames[rs], mRegNames[rt]);
+			else if (func == 32 || func == 33)
+				snprintf(dst, dstSz, "%-7s%s, %s", func == 32 ? "clz" : "clo", mRegNames[rd], mRegNames[rs]);
+			else
+				break;
+			return;
+		
+		case 31:	//SPECIAL3
+			if (func == 0)
+				snprintf(dst, dstSz, "%-7s%s, %s, %u, %u", "ext", mRegNames[rt], mRegNames[rs], sa, rd + 1);
+			else if (func == 4)
+				snprintf(dst, dstSz, "%-7s%s, %s, %u, %u", "ins", mRegNames[rt], mRegNames[rs], sa, rd + 1 - sa);
+			else if (func == 32 && (sa == 2 || sa == 16 || sa == 24))
+				snprintf(dst, dstSz, "%-7s%s, %s", sa == 2 ? "wsbh" : sa == 16 ? "seb" : "seh", mRegNames[rd], mRegNames[rt]);
+			else
+				break;
+			return;
+		
+		case 19:
+			if (instr == HYPERCALL)
+				snprintf(dst, dstSz, "hypercall");
+			else
+				break;
+			return;
+		
+		default:
+			name = major[op];
+			if (!name)
+				break;
+			if (op == 4 || op == 5 || op == 20 || op == 21)
+				snprintf(dst, dstSz, "%-7s%s, %s, 0x%08x", name, mRegNames[rs], mRegNames[rt], (unsigned)brDst);
+			else if (op == 6 || op == 7)
+				snprintf(dst, dstSz, "%-7s%s, 0x%08x", name, mRegNames[rs], (unsigned)brDst);
+			else if (op == 15)
+				snprintf(dst, dstSz, "%-7s%s, 0x%04x", name, mRegNames[rt], (unsigned)uimm);
+			else if (op >= 12 && op <= 14)
+				snprintf(dst, dstSz, "%-7s%s, %s, 0x%04x", name, mRegNames[rt], mRegNames[rs], (unsigned)uimm);
+			else if (op < 16)
+				snprintf(dst, dstSz, "%-7s%s, %s, %d", name, mRegNames[rt], mRegNames[rs], (int)simm);
+			else if (op == 49 || op == 53 || op == 57 || op == 61)
+				snprintf(dst, dstSz, "%-7s$f%u, %d(%s)", name, rt, (int)simm, mRegNames[rs]);
+			else
+				snprintf(dst, dstSz, "%-7s%s, %d(%s)", name, mRegNames[rt], (int)simm, mRegNames[rs]);
+			return;
+	}
+	
+	snprintf(dst, dstSz, ".word  0x%08x", (unsigned)instr);
+}
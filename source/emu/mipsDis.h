@@ -0,0 +1,18 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _MIPS_DIS_H_
+#define _MIPS_DIS_H_
+
+#include <stdint.h>
+
+
+//host-side tools only. produces things like "addiu  sp, sp, -32"
+void mipsDisasm(char *dst, uint32_t dstSz, uint32_t instr, uint32_t pc);
+
+const char* mipsRegName(uint_fast8_t reg);
+
+
+#endif
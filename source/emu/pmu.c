@@ -0,0 +1,169 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <string.h>
+#include "../hypercall.h"
+#include "pmu.h"
+#include "mem.h"
+#include "cpu.h"
+
+//counters are not stepped per event. while enabled, a counter is the cpu core's event total minus a base, and the
+//total at which it next wraps is kept, so that overflows can be found with a compare. PMU_EVT_* are CpuPerfEvent values
+
+struct PmuCtr {
+	uint32_t cfg;
+	uint32_t count;			//only up to date while disabled
+	uint64_t base;			//event total at which count was zero, while enabled
+	uint64_t ovfAt;			//event total at which it next wraps, while enabled
+};
+
+static struct PmuCtr mCtrs[PMU_NUM_CTRS];
+static uint32_t mOvf;
+bool gPmuArmed;
+
+
+static uint64_t pmuPrvTotal(const uint64_t *totals, uint32_t cfg)
+{
+	uint_fast8_t evt = cfg & PMU_CFG_EVT_MASK;
+	
+	return evt < CpuPerfNumEvents ? totals[evt] : 0;
+}
+
+static void pmuPrvIrqUpdate(void)
+{
+	uint32_t irqCtrs = 0;
+	uint_fast8_t i;
+	
+	for (i = 0; i < PMU_NUM_CTRS; i++) {
+		if (mCtrs[i].cfg & PMU_CFG_IRQ)
+			irqCtrs |= 1 << i;
+	}
+	
+	cpuIrq(PMU_IRQ, !!(mOvf & irqCtrs));
+}
+
+static void pmuPrvArmedUpdate(void)
+{
+	uint_fast8_t i;
+	
+	gPmuArmed = false;
+	for (i = 0; i < PMU_NUM_CTRS; i++) {
+		if ((mCtrs[i].cfg & (PMU_CFG_ENABLE | PMU_CFG_IRQ)) == (PMU_CFG_ENABLE | PMU_CFG_IRQ))
+			gPmuArmed = true;
+	}
+}
+
+static void pmuPrvFindOverflows(const uint64_t *totals)
+{
+	uint64_t total;
+	uint_fast8_t i;
+	
+	for (i = 0; i < PMU_NUM_CTRS; i++) {
+		
+		if (!(mCtrs[i].cfg & PMU_CFG_ENABLE))
+			continue;
+		
+		total = pmuPrvTotal(totals, mCtrs[i].cfg);
+		if (total < mCtrs[i].ovfAt)
+			continue;
+		
+		//wrapping more than once between checks still only sets the bit
+		mOvf |= 1 << i;
+		mCtrs[i].ovfAt += ((total - mCtrs[i].ovfAt) &~ 0xffffffffull) + (1ull << 32);
+	}
+}
+
+static void pmuPrvStart(struct PmuCtr *ctr, const uint64_t *totals)
+{
+	uint64_t total = pmuPrvTotal(totals, ctr->cfg);
+	
+	ctr->base = total - ctr->count;
+	ctr->ovfAt = total + (1ull << 32) - ctr->count;
+}
+
+static bool pmuPrvMemAccess(uint32_t pa, uint_fast8_t size, bool write, void* buf, void* userData)
+{
+	uint64_t totals[CpuPerfNumEvents];
+	struct PmuCtr *ctr;
+	uint32_t val;
+	
+	(void)userData;
+	
+	pa -= PMU_BASE;
+	if (size != 4 || (pa & 3))
+		return false;
+	val = write ? *(uint32_t*)buf : 0;
+	
+	cpuGetPerfCounts(totals);
+	pmuPrvFindOverflows(totals);
+	
+	if (pa >= PMU_REG_CFG(0) && pa < PMU_REG_CFG(PMU_NUM_CTRS)) {
+		
+		ctr = &mCtrs[(pa - PMU_REG_CFG(0)) / 8];
+		
+		if (pa == PMU_REG_CFG(ctr - mCtrs)) {
+			
+			if (!write)
+				*(uint32_t*)buf = ctr->cfg;
+			else {
+				
+				//stop it with the old event, start it with the new one
+				if (ctr->cfg & PMU_CFG_ENABLE)
+					ctr->count = pmuPrvTotal(totals, ctr->cfg) - ctr->base;
+				ctr->cfg = val & (PMU_CFG_EVT_MASK | PMU_CFG_ENABLE | PMU_CFG_IRQ);
+				if (ctr->cfg & PMU_CFG_ENABLE)
+					pmuPrvStart(ctr, totals);
+			}
+		}
+		else if (!write)
+			*(uint32_t*)buf = (ctr->cfg & PMU_CFG_ENABLE) ? (uint32_t)(pmuPrvTotal(totals, ctr->cfg) - ctr->base) : ctr->count;
+		else {
+			
+			ctr->count = val;
+			if (ctr->cfg & PMU_CFG_ENABLE)
+				pmuPrvStart(ctr, totals);
+		}
+	}
+	else switch (pa) {
+		
+		case PMU_REG_INFO:
+			if (!write)
+				*(uint32_t*)buf = (PMU_NUM_CTRS << 8) | PMU_NUM_EVTS;
+			break;
+		
+		case PMU_REG_OVF:
+			if (write)
+				mOvf &=~ val;
+			else
+				*(uint32_t*)buf = mOvf;
+			break;
+		
+		default:
+			if (!write)
+				*(uint32_t*)buf = 0;
+			break;
+	}
+	
+	pmuPrvArmedUpdate();
+	pmuPrvIrqUpdate();
+	
+	return true;
+}
+
+void pmuCheck(void)
+{
+	uint64_t totals[CpuPerfNumEvents];
+	uint32_t prevOvf = mOvf;
+	
+	cpuGetPerfCounts(totals);
+	pmuPrvFindOverflows(totals);
+	if (mOvf != prevOvf)
+		pmuPrvIrqUpdate();
+}
+
+bool pmuInit(void)
+{
+	return memRegionAdd(PMU_BASE, 0x1000, pmuPrvMemAccess, (void*)0);
+}
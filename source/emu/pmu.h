@@ -0,0 +1,21 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PMU_H_
+#define _PMU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//guest-visible perf counters (ABI in hypercall.h), counting the cpu core's CpuPerfEvent events
+
+
+extern bool gPmuArmed;		//some counter may raise the irq, call pmuCheck() after each cpuCycle() while so
+
+bool pmuInit(void);
+void pmuCheck(void);
+
+
+#endif
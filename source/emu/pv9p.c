@@ -0,0 +1,1436 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#define _GNU_SOURCE
+#include <sys/sysmacros.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "../hypercall.h"
+#include "pvRing.h"
+#include "pv9p.h"
+#include "soc.h"
+#include "cpu.h"
+#include "mem.h"
+
+//a 9P2000.L server on a host directory. the guest speaks linux errno values and mode bits, as does our host (we only
+//build on linux), so those pass through as is. paths are kept relative to the share root and only ever grow by names
+//that walk checked, so ".." cannot leave the share. symlinks are given to the guest to resolve, never followed here:
+//each access opens its path one element at a time from the share root and refuses any that is a symlink, so that
+//none the guest makes, or that a walk ended on, can lead out of the share
+
+
+#define PV9P_MAX_MSIZE		(1024 * 1024)
+#define PV9P_MAX_SEGS		(PV9P_MAX_MSIZE / 4096 + 1)		//a payload of msize in 4K guest pages, not page aligned
+#define PV9P_FID_HASH		64
+
+#define PV9P_HDR_SZ			7			//size[4] type[1] tag[2]
+#define PV9P_IOHDR_SZ		11			//and count[4], for Rread and Rreaddir
+#define PV9P_QID_SZ			13
+#define PV9P_MAX_WELEM		16
+
+#define P9_RLERROR			7
+#define P9_TSTATFS			8
+#define P9_TLOPEN			12
+#define P9_TLCREATE			14
+#define P9_TSYMLINK			16
+#define P9_TMKNOD			18
+#define P9_TRENAME			20
+#define P9_TREADLINK		22
+#define P9_TGETATTR			24
+#define P9_TSETATTR			26
+#define P9_TXATTRWALK		30
+#define P9_TXATTRCREATE		32
+#define P9_TREADDIR			40
+#define P9_TFSYNC			50
+#define P9_TLOCK			52
+#define P9_TGETLOCK			54
+#define P9_TLINK			70
+#define P9_TMKDIR			72
+#define P9_TRENAMEAT		74
+#define P9_TUNLINKAT		76
+#define P9_TVERSION			100
+#define P9_TATTACH			104
+#define P9_TFLUSH			108
+#define P9_TWALK			110
+#define P9_TREAD			116
+#define P9_TWRITE			118
+#define P9_TCLUNK			120
+#define P9_TREMOVE			122
+
+#define P9_QTDIR			0x80
+#define P9_QTSYMLINK		0x02
+#define P9_QTFILE			0x00
+
+#define P9_DOTL_ACCMODE		0x0003
+#define P9_DOTL_WRONLY		0x0001
+#define P9_DOTL_RDWR		0x0002
+#define P9_DOTL_CREAT		0x0040
+#define P9_DOTL_EXCL		0x0080
+#define P9_DOTL_TRUNC		0x0200
+
+#define P9_ATTR_MODE		0x0001
+#define P9_ATTR_UID			0x0002
+#define P9_ATTR_GID			0x0004
+#define P9_ATTR_SIZE		0x0008
+#define P9_ATTR_ATIME		0x0010
+#define P9_ATTR_MTIME		0x0020
+#define P9_ATTR_ATIME_SET	0x0080
+#define P9_ATTR_MTIME_SET	0x0100
+
+#define P9_GETATTR_BASIC	0x07ff
+#define P9_AT_REMOVEDIR		0x0200
+#define P9_LOCK_SUCCESS		0
+#define P9_LOCK_TYPE_UNLCK	2
+#define P9_V9FS_MAGIC		0x01021997
+
+
+struct Pv9pFid {
+	struct Pv9pFid *next;
+	uint32_t fid;
+	char *path;					//relative to the share root, "" is the root itself
+	int fd;						//-1 till opened
+	DIR *dir;					//if it is an opened directory. owns fd then
+};
+
+struct Pv9pConn {				//9P fids are per connection, and each queue is one
+	struct Pv9pFid *fids[PV9P_FID_HASH];
+	uint32_t msize;				//0 till Tversion
+};
+
+struct Pv9pShare {
+	struct PvRingDev dev;
+	char tag[PV_9P_TAG_LEN];
+	char *root;					//host dir, absolute and resolved
+	int rootFd;					//O_PATH, all host access goes through it
+	bool ro;
+	struct Pv9pConn conn[PV_MAX_QUEUES];
+};
+
+struct Pv9pMsg {
+	const uint8_t *in;			//T-message
+	uint32_t inLen, inPos;
+	uint8_t *out;				//R-message
+	uint32_t outMax, outPos;
+	const struct iovec *zc;		//payload in guest pages, PV_9P_OP_ZC only
+	uint32_t zcNum, zcLen, zcDone;
+	bool bad;					//T-message ended early or had a bad string
+	bool full;					//R-message did not fit
+};
+
+static struct Pv9pShare mShares[PV9P_MAX_SHARES];
+static uint_fast8_t mNumShares;
+
+
+
+static const uint8_t* pv9pPrvGet(struct Pv9pMsg *m, uint32_t len)
+{
+	static const uint8_t zeroes[8];
+	const uint8_t *ret = m->in + m->inPos;
+	
+	if (m->inLen - m->inPos < len) {
+		m->bad = true;
+		m->inPos = m->inLen;
+		return zeroes;
+	}
+	m->inPos += len;
+	
+	return ret;
+}
+
+static uint64_t pv9pPrvGetLe(struct Pv9pMsg *m, uint_fast8_t len)
+{
+	const uint8_t *p = pv9pPrvGet(m, len);
+	uint64_t ret = 0;
+	
+	while (len--)
+		ret = (ret << 8) + p[len];
+	
+	return ret;
+}
+
+static uint32_t pv9pPrvGet32(struct Pv9pMsg *m)
+{
+	return pv9pPrvGetLe(m, 4);
+}
+
+static uint64_t pv9pPrvGet64(struct Pv9pMsg *m)
+{
+	return pv9pPrvGetLe(m, 8);
+}
+
+static void pv9pPrvGetStr(struct Pv9pMsg *m, char *dst, uint32_t dstSz)
+{
+	uint32_t len = pv9pPrvGetLe(m, 2);
+	const uint8_t *p = pv9pPrvGet(m, len);
+	
+	if (m->bad || len >= dstSz || memchr(p, 0, len)) {
+		m->bad = true;
+		len = 0;
+	}
+	memcpy(dst, p, len);
+	dst[len] = 0;
+}
+
+static void pv9pPrvLe(uint8_t *dst, uint64_t val, uint_fast8_t len)
+{
+	while (len--) {
+		*dst++ = val;
+		val >>= 8;
+	}
+}
+
+static void pv9pPrvPutLe(struct Pv9pMsg *m, uint64_t val, uint_fast8_t len)
+{
+	if (m->outMax - m->outPos < len) {
+		m->full = true;
+		return;
+	}
+	pv9pPrvLe(m->out + m->outPos, val, len);
+	m->outPos += len;
+}
+
+static void pv9pPrvPut8(struct Pv9pMsg *m, uint8_t val)
+{
+	pv9pPrvPutLe(m, val, 1);
+}
+
+static void pv9pPrvPut32(struct Pv9pMsg *m, uint32_t val)
+{
+	pv9pPrvPutLe(m, val, 4);
+}
+
+static void pv9pPrvPut64(struct Pv9pMsg *m, uint64_t val)
+{
+	pv9pPrvPutLe(m, val, 8);
+}
+
+static void pv9pPrvPutStr(struct Pv9pMsg *m, const char *str)
+{
+	uint32_t len = strlen(str);
+	
+	pv9pPrvPutLe(m, len, 2);
+	if (m->full || m->outMax - m->outPos < len) {
+		m->full = true;
+		return;
+	}
+	memcpy(m->out + m->outPos, str, len);
+	m->outPos += len;
+}
+
+static void pv9pPrvPutQid(struct Pv9pMsg *m, const struct stat *st)
+{
+	pv9pPrvPut8(m, S_ISDIR(st->st_mode) ? P9_QTDIR : (S_ISLNK(st->st_mode) ? P9_QTSYMLINK : P9_QTFILE));
+	pv9pPrvPut32(m, st->st_mtime ^ (st->st_size << 8));		//changes when the file does, guest uses it to drop stale caches
+	pv9pPrvPut64(m, st->st_ino);
+}
+
+//the first len bytes of the zero-copy payload, as an iovec list
+static uint32_t pv9pPrvZcTrim(const struct Pv9pMsg *m, uint32_t len, struct iovec *iov)
+{
+	uint32_t i;
+	
+	for (i = 0; i < m->zcNum && len; i++) {
+		iov[i] = m->zc[i];
+		if (iov[i].iov_len > len)
+			iov[i].iov_len = len;
+		len -= iov[i].iov_len;
+	}
+	
+	return i;
+}
+
+static struct Pv9pFid* pv9pPrvFidFind(struct Pv9pConn *c, uint32_t fid)
+{
+	struct Pv9pFid *f;
+	
+	for (f = c->fids[fid % PV9P_FID_HASH]; f && f->fid != fid; f = f->next);
+	
+	return f;
+}
+
+static int pv9pPrvFidNew(struct Pv9pConn *c, uint32_t fid, const char *path)
+{
+	struct Pv9pFid *f;
+	
+	if (pv9pPrvFidFind(c, fid))
+		return EBADF;
+	
+	f = calloc(1, sizeof(struct Pv9pFid));
+	if (!f || !(f->path = strdup(path))) {
+		free(f);
+		return ENOMEM;
+	}
+	f->fid = fid;
+	f->fd = -1;
+	f->next = c->fids[fid % PV9P_FID_HASH];
+	c->fids[fid % PV9P_FID_HASH] = f;
+	
+	return 0;
+}
+
+static int pv9pPrvFidSetPath(struct Pv9pFid *f, const char *path)
+{
+	char *copy = strdup(path);
+	
+	if (!copy)
+		return ENOMEM;
+	free(f->path);
+	f->path = copy;
+	
+	return 0;
+}
+
+static void pv9pPrvFidDestroy(struct Pv9pFid *f)
+{
+	if (f->dir)
+		closedir(f->dir);
+	else if (f->fd >= 0)
+		close(f->fd);
+	free(f->path);
+	free(f);
+}
+
+static int pv9pPrvFidFree(struct Pv9pConn *c, uint32_t fid)
+{
+	struct Pv9pFid **fP, *f;
+	
+	for (fP = &c->fids[fid % PV9P_FID_HASH]; (f = *fP) && f->fid != fid; fP = &f->next);
+	if (!f)
+		return EBADF;
+	
+	*fP = f->next;
+	pv9pPrvFidDestroy(f);
+	
+	return 0;
+}
+
+static void pv9pPrvConnReset(struct Pv9pConn *c)
+{
+	struct Pv9pFid *f;
+	uint_fast8_t i;
+	
+	for (i = 0; i < PV9P_FID_HASH; i++) {
+		while ((f = c->fids[i])) {
+			c->fids[i] = f->next;
+			pv9pPrvFidDestroy(f);
+		}
+	}
+	c->msize = 0;
+}
+
+//fids at or under "from" now live under "to"
+static void pv9pPrvRenamed(struct Pv9pConn *c, const char *from, const char *to)
+{
+	size_t fromLen = strlen(from), toLen = strlen(to);
+	struct Pv9pFid *f;
+	uint_fast8_t i;
+	char *path;
+	
+	for (i = 0; i < PV9P_FID_HASH; i++) {
+		for (f = c->fids[i]; f; f = f->next) {
+			
+			if (strncmp(f->path, from, fromLen) || (f->path[fromLen] && f->path[fromLen] != '/'))
+				continue;
+			
+			path = malloc(toLen + strlen(f->path + fromLen) + 1);
+			if (!path)
+				continue;
+			strcpy(path, to);
+			strcpy(path + toLen, f->path + fromLen);
+			free(f->path);
+			f->path = path;
+		}
+	}
+}
+
+static int pv9pPrvNameCheck(const char *name)
+{
+	if (!*name || !strcmp(name, ".") || !strcmp(name, "..") || strchr(name, '/'))
+		return EINVAL;
+	
+	return strlen(name) > NAME_MAX ? ENAMETOOLONG : 0;
+}
+
+//share relative path of name in dir
+static int pv9pPrvRelPath(const char *dir, const char *name, char *dst)
+{
+	int len = snprintf(dst, PATH_MAX, "%s%s%s", dir, *dir ? "/" : "", name);
+	
+	return (len < 0 || len >= PATH_MAX) ? ENAMETOOLONG : 0;
+}
+
+//open the dir rel's last element is in, or rel itself if name is not NULL, and give the name to use in it with *at()
+//calls ("." for the share root). caller closes *dirFdP
+static int pv9pPrvAt(const struct Pv9pShare *sh, const char *rel, const char *name, int *dirFdP, const char **nameP)
+{
+	const char *stop = rel + strlen(rel), *end;
+	char elem[NAME_MAX + 1];
+	int fd, next, ret;
+	
+	if (!name) {
+		name = strrchr(rel, '/');
+		stop = name ? name : rel;
+		name = name ? name + 1 : (*rel ? rel : ".");
+	}
+	
+	if ((fd = fcntl(sh->rootFd, F_DUPFD_CLOEXEC, 0)) < 0)
+		return errno;
+	
+	for (; rel < stop; rel = end + 1) {
+		
+		if (!(end = memchr(rel, '/', stop - rel)))
+			end = stop;
+		if (end - rel > NAME_MAX) {
+			close(fd);
+			return ENAMETOOLONG;
+		}
+		memcpy(elem, rel, end - rel);
+		elem[end - rel] = 0;
+		
+		//a symlink here fails with ENOTDIR
+		next = openat(fd, elem, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		ret = errno;
+		close(fd);
+		if (next < 0)
+			return ret;
+		fd = next;
+	}
+	
+	*dirFdP = fd;
+	*nameP = name;
+	
+	return 0;
+}
+
+static int pv9pPrvStat(const struct Pv9pShare *sh, const char *rel, struct stat *st)
+{
+	const char *name;
+	int ret, dirFd;
+	
+	if ((ret = pv9pPrvAt(sh, rel, NULL, &dirFd, &name)))
+		return ret;
+	ret = fstatat(dirFd, name, st, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+	close(dirFd);
+	
+	return ret;
+}
+
+static int pv9pPrvVersion(struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t msize = pv9pPrvGet32(m);
+	char ver[32];
+	
+	pv9pPrvGetStr(m, ver, sizeof(ver));
+	if (m->bad)
+		return EINVAL;
+	
+	//a new session, everything the guest had open before is gone
+	pv9pPrvConnReset(c);
+	c->msize = msize < PV9P_MAX_MSIZE ? msize : PV9P_MAX_MSIZE;
+	if (c->msize < PV9P_IOHDR_SZ + 1)
+		c->msize = PV9P_IOHDR_SZ + 1;
+	
+	pv9pPrvPut32(m, c->msize);
+	pv9pPrvPutStr(m, strcmp(ver, "9P2000.L") ? "unknown" : "9P2000.L");
+	
+	return 0;
+}
+
+static int pv9pPrvAttach(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	char name[PATH_MAX];
+	struct stat st;
+	int ret;
+	
+	pv9pPrvGet32(m);							//afid, we do no auth
+	pv9pPrvGetStr(m, name, sizeof(name));		//uname
+	pv9pPrvGetStr(m, name, sizeof(name));		//aname, there is only one tree per share
+	if (m->bad)
+		return EINVAL;
+	
+	if (fstat(sh->rootFd, &st))
+		return errno;
+	if ((ret = pv9pPrvFidNew(c, fid, "")))
+		return ret;
+	pv9pPrvPutQid(m, &st);
+	
+	return 0;
+}
+
+static int pv9pPrvWalk(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), newFid = pv9pPrvGet32(m), nwname = pv9pPrvGetLe(m, 2), nwqidPos, i;
+	char rel[PATH_MAX], name[PATH_MAX];
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret = 0;
+	
+	if (m->bad || nwname > PV9P_MAX_WELEM)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if (newFid != fid && pv9pPrvFidFind(c, newFid))
+		return EBADF;
+	if (newFid == fid && nwname && f->fd >= 0)
+		return EBADF;
+	
+	strcpy(rel, f->path);
+	nwqidPos = m->outPos;
+	pv9pPrvPutLe(m, 0, 2);
+	
+	for (i = 0; i < nwname; i++) {
+		
+		pv9pPrvGetStr(m, name, sizeof(name));
+		if (m->bad)
+			return EINVAL;
+		
+		if (!strcmp(name, "..")) {
+			
+			char *slash = strrchr(rel, '/');
+			
+			*(slash ? slash : rel) = 0;
+		}
+		else if (strcmp(name, ".")) {
+			
+			char tmp[PATH_MAX];
+			
+			if ((ret = pv9pPrvNameCheck(name)) || (ret = pv9pPrvRelPath(rel, name, tmp)))
+				break;
+			strcpy(rel, tmp);
+		}
+		
+		if ((ret = pv9pPrvStat(sh, rel, &st)))
+			break;
+		//the guest resolves symlinks itself, walking through one would let it out of the share. ending on one is
+		//fine, pv9pPrvAt() will not go through it later either
+		if (S_ISLNK(st.st_mode) && i != nwname - 1) {
+			ret = ELOOP;
+			break;
+		}
+		pv9pPrvPutQid(m, &st);
+	}
+	
+	//as per 9P, failing past the first element is a success with fewer qids and newfid left alone
+	if (ret && !i)
+		return ret;
+	if (!ret)
+		ret = newFid == fid ? pv9pPrvFidSetPath(f, rel) : pv9pPrvFidNew(c, newFid, rel);
+	else
+		ret = 0;
+	
+	pv9pPrvLe(m->out + nwqidPos, i, 2);
+	
+	return ret;
+}
+
+static int pv9pPrvOpenFlags(uint32_t flags)
+{
+	int ret;
+	
+	switch (flags & P9_DOTL_ACCMODE) {
+		case P9_DOTL_WRONLY:
+			ret = O_WRONLY;
+			break;
+		
+		case P9_DOTL_RDWR:
+			ret = O_RDWR;
+			break;
+		
+		default:
+			ret = O_RDONLY;
+			break;
+	}
+	
+	//guest gives explicit offsets even for O_APPEND, so that one is not passed on
+	if (flags & P9_DOTL_CREAT)
+		ret |= O_CREAT;
+	if (flags & P9_DOTL_EXCL)
+		ret |= O_EXCL;
+	if (flags & P9_DOTL_TRUNC)
+		ret |= O_TRUNC;
+	
+	return ret | O_NOFOLLOW | O_CLOEXEC;
+}
+
+static int pv9pPrvLopen(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), flags = pv9pPrvGet32(m) & ~(P9_DOTL_CREAT | P9_DOTL_EXCL);
+	const char *name;
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret, dirFd;
+	
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)) || f->fd >= 0)
+		return EBADF;
+	if ((ret = pv9pPrvAt(sh, f->path, NULL, &dirFd, &name)))
+		return ret;
+	
+	if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW))
+		ret = errno;
+	else if (S_ISDIR(st.st_mode)) {
+		
+		if ((f->fd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+			ret = errno;
+		else if (!(f->dir = fdopendir(f->fd))) {
+			ret = errno;
+			close(f->fd);
+			f->fd = -1;
+		}
+	}
+	else if (S_ISREG(st.st_mode)) {
+		
+		if (sh->ro && ((flags & P9_DOTL_ACCMODE) || (flags & P9_DOTL_TRUNC)))
+			ret = EROFS;
+		else if ((f->fd = openat(dirFd, name, pv9pPrvOpenFlags(flags))) < 0)
+			ret = errno;
+	}
+	else {		//guest handles device nodes and fifos itself, and a host fifo would block us
+		ret = EOPNOTSUPP;
+	}
+	close(dirFd);
+	if (ret)
+		return ret;
+	
+	pv9pPrvPutQid(m, &st);
+	pv9pPrvPut32(m, 0);			//iounit: whatever msize allows
+	
+	return 0;
+}
+
+static int pv9pPrvLcreate(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), flags, mode;
+	char name[PATH_MAX], rel[PATH_MAX];
+	const char *at;
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret, fd, dirFd;
+	
+	pv9pPrvGetStr(m, name, sizeof(name));
+	flags = pv9pPrvGet32(m);
+	mode = pv9pPrvGet32(m);
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(f = pv9pPrvFidFind(c, fid)) || f->fd >= 0)
+		return EBADF;
+	if ((ret = pv9pPrvNameCheck(name)) || (ret = pv9pPrvRelPath(f->path, name, rel)) || (ret = pv9pPrvAt(sh, f->path, name, &dirFd, &at)))
+		return ret;
+	
+	fd = openat(dirFd, at, pv9pPrvOpenFlags(flags) | O_CREAT, mode & 07777);
+	ret = errno;
+	close(dirFd);
+	if (fd < 0)
+		return ret;
+	ret = 0;
+	if (fstat(fd, &st) || (ret = pv9pPrvFidSetPath(f, rel))) {
+		ret = ret ? ret : errno;
+		close(fd);
+		return ret;
+	}
+	f->fd = fd;
+	
+	pv9pPrvPutQid(m, &st);
+	pv9pPrvPut32(m, 0);
+	
+	return 0;
+}
+
+static int pv9pPrvRead(struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), count, max = c->msize - PV9P_IOHDR_SZ;
+	uint64_t ofst = pv9pPrvGet64(m);
+	struct iovec iov[PV9P_MAX_SEGS];
+	struct Pv9pFid *f;
+	ssize_t ret;
+	
+	count = pv9pPrvGet32(m);
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)) || f->fd < 0 || f->dir)
+		return EBADF;
+	
+	//straight into guest memory, either the reply itself or the pages the payload goes to
+	if (m->zc) {
+		if (max > m->zcLen)
+			max = m->zcLen;
+		if (count > max)
+			count = max;
+		ret = preadv(f->fd, iov, pv9pPrvZcTrim(m, count, iov), ofst);
+	}
+	else {
+		if (max > m->outMax - m->outPos - 4)
+			max = m->outMax - m->outPos - 4;
+		if (count > max)
+			count = max;
+		ret = pread(f->fd, m->out + m->outPos + 4, count, ofst);
+	}
+	if (ret < 0)
+		return errno;
+	
+	pv9pPrvPut32(m, ret);
+	if (m->zc)
+		m->zcDone = ret;
+	else
+		m->outPos += ret;
+	
+	return 0;
+}
+
+static int pv9pPrvWrite(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), count;
+	uint64_t ofst = pv9pPrvGet64(m);
+	struct iovec iov[PV9P_MAX_SEGS];
+	struct Pv9pFid *f;
+	const uint8_t *data;
+	ssize_t ret;
+	
+	count = pv9pPrvGet32(m);
+	if (m->zc) {
+		if (count > m->zcLen)
+			count = m->zcLen;
+		data = NULL;
+	}
+	else {
+		data = pv9pPrvGet(m, count);
+	}
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(f = pv9pPrvFidFind(c, fid)) || f->fd < 0 || f->dir)
+		return EBADF;
+	
+	if (m->zc)
+		ret = pwritev(f->fd, iov, pv9pPrvZcTrim(m, count, iov), ofst);
+	else
+		ret = pwrite(f->fd, data, count, ofst);
+	if (ret < 0)
+		return errno;
+	
+	pv9pPrvPut32(m, ret);
+	
+	return 0;
+}
+
+static int pv9pPrvReaddir(struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), count, max = c->msize - PV9P_IOHDR_SZ, done = 0;
+	uint64_t ofst = pv9pPrvGet64(m);
+	struct dirent *de;
+	struct Pv9pFid *f;
+	uint8_t *buf;
+	int ret = 0;
+	
+	count = pv9pPrvGet32(m);
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)) || !f->dir)
+		return EBADF;
+	
+	if (m->zc) {
+		if (max > m->zcLen)
+			max = m->zcLen;
+	}
+	else if (max > m->outMax - m->outPos - 4)
+		max = m->outMax - m->outPos - 4;
+	if (count > max)
+		count = max;
+	
+	buf = m->zc ? malloc(count + 1) : m->out + m->outPos + 4;
+	if (!buf)
+		return ENOMEM;
+	
+	if (ofst)
+		seekdir(f->dir, ofst);
+	else
+		rewinddir(f->dir);
+	
+	while (1) {
+		
+		long pos = telldir(f->dir);
+		uint32_t nameLen, entLen;
+		uint8_t *p;
+		
+		errno = 0;
+		if (!(de = readdir(f->dir))) {
+			ret = done ? 0 : errno;
+			break;
+		}
+		
+		//qid[13] offset[8] type[1] name[s]
+		nameLen = strlen(de->d_name);
+		entLen = PV9P_QID_SZ + 8 + 1 + 2 + nameLen;
+		if (count - done < entLen) {
+			seekdir(f->dir, pos);
+			break;
+		}
+		
+		p = buf + done;
+		p[0] = de->d_type == DT_DIR ? P9_QTDIR : (de->d_type == DT_LNK ? P9_QTSYMLINK : P9_QTFILE);
+		pv9pPrvLe(p + 1, 0, 4);
+		pv9pPrvLe(p + 5, de->d_ino, 8);
+		pv9pPrvLe(p + 13, telldir(f->dir), 8);
+		p[21] = de->d_type;
+		pv9pPrvLe(p + 22, nameLen, 2);
+		memcpy(p + 24, de->d_name, nameLen);
+		done += entLen;
+	}
+	
+	if (!ret) {
+		pv9pPrvPut32(m, done);
+		if (!m->zc)
+			m->outPos += done;
+		else {
+			struct iovec iov[PV9P_MAX_SEGS];
+			uint32_t i, n = pv9pPrvZcTrim(m, done, iov), pos = 0;
+			
+			for (i = 0; i < n; pos += iov[i++].iov_len)
+				memcpy(iov[i].iov_base, buf + pos, iov[i].iov_len);
+			m->zcDone = done;
+		}
+	}
+	if (m->zc)
+		free(buf);
+	
+	return ret;
+}
+
+static int pv9pPrvGetattr(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret;
+	
+	pv9pPrvGet64(m);		//request mask, we always have the basic set and nothing more
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvStat(sh, f->path, &st)))
+		return ret;
+	
+	pv9pPrvPut64(m, P9_GETATTR_BASIC);
+	pv9pPrvPutQid(m, &st);
+	pv9pPrvPut32(m, st.st_mode);
+	pv9pPrvPut32(m, st.st_uid);
+	pv9pPrvPut32(m, st.st_gid);
+	pv9pPrvPut64(m, st.st_nlink);
+	//the guest's new_decode_dev() format
+	pv9pPrvPut64(m, (minor(st.st_rdev) & 0xff) | (major(st.st_rdev) << 8) | ((minor(st.st_rdev) & ~0xff) << 12));
+	pv9pPrvPut64(m, st.st_size);
+	pv9pPrvPut64(m, st.st_blksize);
+	pv9pPrvPut64(m, st.st_blocks);
+	pv9pPrvPut64(m, st.st_atim.tv_sec);
+	pv9pPrvPut64(m, st.st_atim.tv_nsec);
+	pv9pPrvPut64(m, st.st_mtim.tv_sec);
+	pv9pPrvPut64(m, st.st_mtim.tv_nsec);
+	pv9pPrvPut64(m, st.st_ctim.tv_sec);
+	pv9pPrvPut64(m, st.st_ctim.tv_nsec);
+	pv9pPrvPut64(m, 0);		//btime
+	pv9pPrvPut64(m, 0);
+	pv9pPrvPut64(m, 0);		//gen
+	pv9pPrvPut64(m, 0);		//data version
+	
+	return 0;
+}
+
+static int pv9pPrvSetattr(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), valid = pv9pPrvGet32(m), mode = pv9pPrvGet32(m), uid = pv9pPrvGet32(m), gid = pv9pPrvGet32(m);
+	uint64_t size = pv9pPrvGet64(m);
+	struct timespec ts[2];
+	const char *name;
+	struct Pv9pFid *f;
+	struct stat st;
+	uint_fast8_t i;
+	int ret, fd, dirFd;
+	
+	for (i = 0; i < 2; i++) {
+		ts[i].tv_sec = pv9pPrvGet64(m);
+		ts[i].tv_nsec = pv9pPrvGet64(m);
+	}
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvAt(sh, f->path, NULL, &dirFd, &name)))
+		return ret;
+	if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW))
+		goto fail;
+	
+	//fchmodat() would follow a symlink, and linux cannot chmod or truncate one anyway
+	if ((valid & (P9_ATTR_MODE | P9_ATTR_SIZE)) && S_ISLNK(st.st_mode)) {
+		ret = EOPNOTSUPP;
+		goto out;
+	}
+	
+	if ((valid & P9_ATTR_MODE) && fchmodat(dirFd, name, mode & 07777, 0))
+		goto fail;
+	if ((valid & (P9_ATTR_UID | P9_ATTR_GID)) && fchownat(dirFd, name, (valid & P9_ATTR_UID) ? uid : (uid_t)-1, (valid & P9_ATTR_GID) ? gid : (gid_t)-1, AT_SYMLINK_NOFOLLOW))
+		goto fail;
+	if (valid & P9_ATTR_SIZE) {
+		
+		//nonblocking, so a fifo cannot stall us
+		if ((fd = openat(dirFd, name, O_WRONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC)) < 0)
+			goto fail;
+		ret = ftruncate(fd, size) ? errno : 0;
+		close(fd);
+		if (ret)
+			goto out;
+	}
+	if (valid & (P9_ATTR_ATIME | P9_ATTR_MTIME)) {
+		
+		if (!(valid & P9_ATTR_ATIME))
+			ts[0].tv_nsec = UTIME_OMIT;
+		else if (!(valid & P9_ATTR_ATIME_SET))
+			ts[0].tv_nsec = UTIME_NOW;
+		if (!(valid & P9_ATTR_MTIME))
+			ts[1].tv_nsec = UTIME_OMIT;
+		else if (!(valid & P9_ATTR_MTIME_SET))
+			ts[1].tv_nsec = UTIME_NOW;
+		
+		if (utimensat(dirFd, name, ts, AT_SYMLINK_NOFOLLOW))
+			goto fail;
+	}
+	goto out;
+
+fail:
+	ret = errno;
+out:
+	close(dirFd);
+	
+	return ret;
+}
+
+static int pv9pPrvStatfs(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	const char *name;
+	struct statvfs sv;
+	struct Pv9pFid *f;
+	int ret, fd, dirFd;
+	
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvAt(sh, f->path, NULL, &dirFd, &name)))
+		return ret;
+	fd = openat(dirFd, name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	ret = (fd < 0 || fstatvfs(fd, &sv)) ? errno : 0;
+	if (fd >= 0)
+		close(fd);
+	close(dirFd);
+	if (ret)
+		return ret;
+	
+	pv9pPrvPut32(m, P9_V9FS_MAGIC);
+	pv9pPrvPut32(m, sv.f_bsize);
+	pv9pPrvPut64(m, sv.f_blocks);
+	pv9pPrvPut64(m, sv.f_bfree);
+	pv9pPrvPut64(m, sv.f_bavail);
+	pv9pPrvPut64(m, sv.f_files);
+	pv9pPrvPut64(m, sv.f_ffree);
+	pv9pPrvPut64(m, sv.f_fsid);
+	pv9pPrvPut32(m, sv.f_namemax);
+	
+	return 0;
+}
+
+//Tmkdir, Tsymlink and Tmknod: make name in dir fid, reply with its qid
+static int pv9pPrvMake(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m, uint8_t type)
+{
+	uint32_t fid = pv9pPrvGet32(m), mode = 0, majorNo = 0, minorNo = 0;
+	char name[PATH_MAX], target[PATH_MAX];
+	const char *at;
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret, dirFd;
+	
+	pv9pPrvGetStr(m, name, sizeof(name));
+	if (type == P9_TSYMLINK)
+		pv9pPrvGetStr(m, target, sizeof(target));
+	else
+		mode = pv9pPrvGet32(m);
+	if (type == P9_TMKNOD) {
+		majorNo = pv9pPrvGet32(m);
+		minorNo = pv9pPrvGet32(m);
+	}
+	pv9pPrvGet32(m);		//gid, files are the host user's
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvNameCheck(name)) || (ret = pv9pPrvAt(sh, f->path, name, &dirFd, &at)))
+		return ret;
+	
+	switch (type) {
+		case P9_TMKDIR:
+			ret = mkdirat(dirFd, at, mode & 07777);
+			break;
+		
+		case P9_TSYMLINK:
+			ret = symlinkat(target, dirFd, at);
+			break;
+		
+		default:
+			ret = mknodat(dirFd, at, mode, makedev(majorNo, minorNo));
+			break;
+	}
+	ret = (ret || fstatat(dirFd, at, &st, AT_SYMLINK_NOFOLLOW)) ? errno : 0;
+	close(dirFd);
+	if (ret)
+		return ret;
+	pv9pPrvPutQid(m, &st);
+	
+	return 0;
+}
+
+static int pv9pPrvReadlink(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	char target[PATH_MAX];
+	const char *name;
+	struct Pv9pFid *f;
+	int ret, dirFd;
+	ssize_t len;
+	
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvAt(sh, f->path, NULL, &dirFd, &name)))
+		return ret;
+	len = readlinkat(dirFd, name, target, sizeof(target) - 1);
+	ret = errno;
+	close(dirFd);
+	if (len < 0)
+		return ret;
+	target[len] = 0;
+	pv9pPrvPutStr(m, target);
+	
+	return 0;
+}
+
+static int pv9pPrvLink(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t dfid = pv9pPrvGet32(m), fid = pv9pPrvGet32(m);
+	const char *fromName, *toName;
+	int ret, fromFd, toFd;
+	struct Pv9pFid *d, *f;
+	char name[PATH_MAX];
+	
+	pv9pPrvGetStr(m, name, sizeof(name));
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(d = pv9pPrvFidFind(c, dfid)) || !(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	if ((ret = pv9pPrvNameCheck(name)) || (ret = pv9pPrvAt(sh, f->path, NULL, &fromFd, &fromName)))
+		return ret;
+	if (!(ret = pv9pPrvAt(sh, d->path, name, &toFd, &toName))) {
+		ret = linkat(fromFd, fromName, toFd, toName, 0) ? errno : 0;
+		close(toFd);
+	}
+	close(fromFd);
+	
+	return ret;
+}
+
+//Trename (fid, to dir + name) and Trenameat (dir + name, to dir + name)
+static int pv9pPrvRename(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m, uint8_t type)
+{
+	char oldName[PATH_MAX], newName[PATH_MAX], oldRel[PATH_MAX], newRel[PATH_MAX];
+	uint32_t fid = pv9pPrvGet32(m), dfid;
+	const char *fromName, *toName;
+	int ret = 0, fromFd, toFd;
+	struct Pv9pFid *f, *d;
+	
+	if (type == P9_TRENAMEAT)
+		pv9pPrvGetStr(m, oldName, sizeof(oldName));
+	dfid = pv9pPrvGet32(m);
+	pv9pPrvGetStr(m, newName, sizeof(newName));
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(f = pv9pPrvFidFind(c, fid)) || !(d = pv9pPrvFidFind(c, dfid)))
+		return EBADF;
+	
+	if (type == P9_TRENAMEAT) {
+		if (!(ret = pv9pPrvNameCheck(oldName)))
+			ret = pv9pPrvRelPath(f->path, oldName, oldRel);
+	}
+	else if (!*f->path)
+		ret = EBUSY;			//the share root itself
+	else
+		strcpy(oldRel, f->path);
+	if (ret || (ret = pv9pPrvNameCheck(newName)) || (ret = pv9pPrvRelPath(d->path, newName, newRel)))
+		return ret;
+	if ((ret = pv9pPrvAt(sh, oldRel, NULL, &fromFd, &fromName)))
+		return ret;
+	if (!(ret = pv9pPrvAt(sh, newRel, NULL, &toFd, &toName))) {
+		ret = renameat(fromFd, fromName, toFd, toName) ? errno : 0;
+		close(toFd);
+	}
+	close(fromFd);
+	if (ret)
+		return ret;
+	pv9pPrvRenamed(c, oldRel, newRel);
+	
+	return 0;
+}
+
+static int pv9pPrvUnlinkat(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t dfid = pv9pPrvGet32(m), flags;
+	char name[PATH_MAX];
+	struct Pv9pFid *d;
+	const char *at;
+	int ret, dirFd;
+	
+	pv9pPrvGetStr(m, name, sizeof(name));
+	flags = pv9pPrvGet32(m);
+	if (m->bad)
+		return EINVAL;
+	if (sh->ro)
+		return EROFS;
+	if (!(d = pv9pPrvFidFind(c, dfid)))
+		return EBADF;
+	if ((ret = pv9pPrvNameCheck(name)) || (ret = pv9pPrvAt(sh, d->path, name, &dirFd, &at)))
+		return ret;
+	ret = unlinkat(dirFd, at, (flags & P9_AT_REMOVEDIR) ? AT_REMOVEDIR : 0) ? errno : 0;
+	close(dirFd);
+	
+	return ret;
+}
+
+static int pv9pPrvRemove(struct Pv9pShare *sh, struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	const char *name;
+	struct Pv9pFid *f;
+	struct stat st;
+	int ret, dirFd;
+	
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)))
+		return EBADF;
+	
+	//fid is clunked even if the remove fails
+	if (sh->ro)
+		ret = EROFS;
+	else if (!*f->path)
+		ret = EBUSY;
+	else if (!(ret = pv9pPrvAt(sh, f->path, NULL, &dirFd, &name))) {
+		if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) || unlinkat(dirFd, name, S_ISDIR(st.st_mode) ? AT_REMOVEDIR : 0))
+			ret = errno;
+		close(dirFd);
+	}
+	pv9pPrvFidFree(c, fid);
+	
+	return ret;
+}
+
+static int pv9pPrvFsync(struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m);
+	struct Pv9pFid *f;
+	
+	if (m->bad)
+		return EINVAL;
+	if (!(f = pv9pPrvFidFind(c, fid)) || f->fd < 0)
+		return EBADF;
+	
+	return fsync(f->fd) ? errno : 0;
+}
+
+//posix locks only work between users of the one guest kernel, so we grant all and report none
+static int pv9pPrvGetlock(struct Pv9pConn *c, struct Pv9pMsg *m)
+{
+	uint32_t fid = pv9pPrvGet32(m), procId;
+	uint64_t start, len;
+	char clientId[PATH_MAX];
+	
+	pv9pPrvGet(m, 1);			//type
+	start = pv9pPrvGet64(m);
+	len = pv9pPrvGet64(m);
+	procId = pv9pPrvGet32(m);
+	pv9pPrvGetStr(m, clientId, sizeof(clientId));
+	if (m->bad)
+		return EINVAL;
+	if (!pv9pPrvFidFind(c, fid))
+		return EBADF;
+	
+	pv9pPrvPut8(m, P9_LOCK_TYPE_UNLCK);
+	pv9pPrvPut64(m, start);
+	pv9pPrvPut64(m, len);
+	pv9pPrvPut32(m, procId);
+	pv9pPrvPutStr(m, clientId);
+	
+	return 0;
+}
+
+static bool pv9pPrvReq(void *userData, uint_fast8_t queue, struct PvRingReq *req)
+{
+	struct Pv9pMsg m = {.in = req->out, .inLen = req->outLen, .inPos = PV9P_HDR_SZ, .out = req->in, .outMax = req->inLen, .outPos = PV9P_HDR_SZ, };
+	struct Pv9pShare *sh = (struct Pv9pShare*)userData;
+	struct Pv9pConn *c = &sh->conn[queue];
+	struct iovec zc[PV9P_MAX_SEGS];
+	uint8_t type;
+	int ret;
+	
+	if (req->op == PV_9P_OP_ZC) {
+		
+		uint32_t i, segBytes = req->outLen - req->arg;
+		struct Pv9pSeg seg;
+		
+		if (req->arg > req->outLen || segBytes % sizeof(struct Pv9pSeg) || segBytes / sizeof(struct Pv9pSeg) > PV9P_MAX_SEGS) {
+			req->status = PV_ST_INVAL;
+			return true;
+		}
+		m.inLen = req->arg;
+		m.zc = zc;
+		m.zcNum = segBytes / sizeof(struct Pv9pSeg);
+		
+		for (i = 0; i < m.zcNum; i++) {
+			
+			memcpy(&seg, req->out + req->arg + sizeof(struct Pv9pSeg) * i, sizeof(struct Pv9pSeg));
+			if (!(zc[i].iov_base = memGetDirectPtr(seg.pa, seg.len)) && seg.len) {
+				req->status = PV_ST_INVAL;
+				return true;
+			}
+			zc[i].iov_len = seg.len;
+			m.zcLen += seg.len;
+		}
+	}
+	else if (req->op != PV_9P_OP_MSG) {
+		req->status = PV_ST_INVAL;
+		return true;
+	}
+	
+	//always room for an Rlerror
+	if (!m.in || m.inLen < PV9P_HDR_SZ || !m.out || m.outMax < PV9P_HDR_SZ + 4) {
+		req->status = PV_ST_INVAL;
+		return true;
+	}
+	type = m.in[4];
+	
+	if (!c->msize && type != P9_TVERSION)
+		ret = EINVAL;
+	else if (m.zc && type != P9_TREAD && type != P9_TWRITE && type != P9_TREADDIR)
+		ret = EINVAL;
+	else switch (type) {
+		case P9_TVERSION:
+			ret = pv9pPrvVersion(c, &m);
+			break;
+		
+		case P9_TATTACH:
+			ret = pv9pPrvAttach(sh, c, &m);
+			break;
+		
+		case P9_TFLUSH:			//we complete everything as soon as it is posted, nothing to flush
+			ret = 0;
+			break;
+		
+		case P9_TWALK:
+			ret = pv9pPrvWalk(sh, c, &m);
+			break;
+		
+		case P9_TLOPEN:
+			ret = pv9pPrvLopen(sh, c, &m);
+			break;
+		
+		case P9_TLCREATE:
+			ret = pv9pPrvLcreate(sh, c, &m);
+			break;
+		
+		case P9_TREAD:
+			ret = pv9pPrvRead(c, &m);
+			break;
+		
+		case P9_TWRITE:
+			ret = pv9pPrvWrite(sh, c, &m);
+			break;
+		
+		case P9_TREADDIR:
+			ret = pv9pPrvReaddir(c, &m);
+			break;
+		
+		case P9_TCLUNK:
+			ret = pv9pPrvFidFree(c, pv9pPrvGet32(&m));
+			break;
+		
+		case P9_TREMOVE:
+			ret = pv9pPrvRemove(sh, c, &m);
+			break;
+		
+		case P9_TGETATTR:
+			ret = pv9pPrvGetattr(sh, c, &m);
+			break;
+		
+		case P9_TSETATTR:
+			ret = pv9pPrvSetattr(sh, c, &m);
+			break;
+		
+		case P9_TSTATFS:
+			ret = pv9pPrvStatfs(sh, c, &m);
+			break;
+		
+		case P9_TMKDIR:
+		case P9_TSYMLINK:
+		case P9_TMKNOD:
+			ret = pv9pPrvMake(sh, c, &m, type);
+			break;
+		
+		case P9_TREADLINK:
+			ret = pv9pPrvReadlink(sh, c, &m);
+			break;
+		
+		case P9_TLINK:
+			ret = pv9pPrvLink(sh, c, &m);
+			break;
+		
+		case P9_TRENAME:
+		case P9_TRENAMEAT:
+			ret = pv9pPrvRename(sh, c, &m, type);
+			break;
+		
+		case P9_TUNLINKAT:
+			ret = pv9pPrvUnlinkat(sh, c, &m);
+			break;
+		
+		case P9_TFSYNC:
+			ret = pv9pPrvFsync(c, &m);
+			break;
+		
+		case P9_TLOCK:
+			pv9pPrvPut8(&m, P9_LOCK_SUCCESS);
+			ret = 0;
+			break;
+		
+		case P9_TGETLOCK:
+			ret = pv9pPrvGetlock(c, &m);
+			break;
+		
+		case P9_TXATTRWALK:
+		case P9_TXATTRCREATE:
+		default:
+			ret = EOPNOTSUPP;
+			break;
+	}
+	
+	if (!ret && m.full)
+		ret = EMSGSIZE;
+	if (ret) {
+		type = P9_RLERROR - 1;
+		m.outPos = PV9P_HDR_SZ;
+		m.zcDone = 0;
+		pv9pPrvPut32(&m, ret);
+	}
+	
+	pv9pPrvLe(m.out, m.outPos + m.zcDone, 4);
+	m.out[4] = type + 1;
+	m.out[5] = m.in[5];
+	m.out[6] = m.in[6];
+	req->inLen = m.outPos;
+	
+	//zero-copy data went straight to guest RAM, not into the reply buffer the ring knows about
+	if (m.zc) {
+		
+		struct Pv9pSeg seg;
+		uint32_t i;
+		
+		for (i = 0; i < m.zcNum; i++) {
+			memcpy(&seg, req->out + req->arg + sizeof(struct Pv9pSeg) * i, sizeof(struct Pv9pSeg));
+			cpuHostRamWritten(seg.pa, seg.len);
+		}
+	}
+	
+	return true;
+}
+
+static uint32_t pv9pPrvCfg(void *userData, uint32_t word)
+{
+	const struct Pv9pShare *sh = (const struct Pv9pShare*)userData;
+	const uint8_t *tag;
+	
+	if (!word)
+		return PV9P_MAX_MSIZE;
+	if (word > PV_9P_TAG_LEN / 4)
+		return 0;
+	
+	tag = (const uint8_t*)sh->tag + (word - 1) * 4;
+	return tag[0] + (tag[1] << 8) + (tag[2] << 16) + (((uint32_t)tag[3]) << 24);
+}
+
+bool pv9pInit(const char *spec)
+{
+	struct Pv9pShare *sh = &mShares[mNumShares];
+	const char *eq = strchr(spec, '=');
+	struct stat st;
+	size_t tagLen;
+	
+	if (mNumShares == PV9P_MAX_SHARES) {
+		fprintf(stderr, "pv9p: at most %u shares\n", PV9P_MAX_SHARES);
+		return false;
+	}
+	if (!eq) {
+		fprintf(stderr, "pv9p: share wants '<tag>=<hostdir>'\n");
+		return false;
+	}
+	
+	tagLen = eq - spec;
+	if (tagLen >= 3 && !strncmp(eq - 3, ":ro", 3)) {
+		sh->ro = true;
+		tagLen -= 3;
+	}
+	if (!tagLen || tagLen >= sizeof(sh->tag)) {
+		fprintf(stderr, "pv9p: tag must be 1..%u chars\n", (unsigned)sizeof(sh->tag) - 1);
+		return false;
+	}
+	memcpy(sh->tag, spec, tagLen);
+	
+	sh->root = realpath(eq + 1, NULL);
+	if (!sh->root || (sh->rootFd = open(sh->root, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0 || fstat(sh->rootFd, &st)) {
+		fprintf(stderr, "pv9p: '%s' is not a directory\n", eq + 1);
+		return false;
+	}
+	
+	sh->dev.type = PV_DEV_9P;
+	sh->dev.numQueues = PV_MAX_QUEUES;
+	sh->dev.irq = SOC_IRQNO_PV;
+	sh->dev.reqF = pv9pPrvReq;
+	sh->dev.cfgF = pv9pPrvCfg;
+	sh->dev.userData = sh;
+	if (pvRingDevAdd(&sh->dev) < 0)
+		return false;
+	mNumShares++;
+	
+	return true;
+}
@@ -0,0 +1,20 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PV_9P_H_
+#define _PV_9P_H_
+
+#include <stdbool.h>
+
+//paravirtual filesystem on the ring transport (PV_DEV_9P in hypercall.h), exports a host directory with 9P2000.L.
+//spec is "<tag>=<hostdir>" or "<tag>:ro=<hostdir>", guest mounts it with "mount -t 9p -o trans=umips <tag> <dir>".
+//call once per directory to export
+
+#define PV9P_MAX_SHARES		4
+
+bool pv9pInit(const char *spec);
+
+
+#endif
@@ -0,0 +1,354 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef __linux__
+	#include <linux/if_tun.h>
+#endif
+#include "../hypercall.h"
+#include "pvRing.h"
+#include "pvNet.h"
+#include "soc.h"
+
+
+#define PV_NET_Q_RX			0
+#define PV_NET_Q_TX			1
+
+#define PCAP_MAGIC			0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_ETH	1
+
+struct PcapHdr {
+	uint32_t magic;
+	uint16_t verMajor, verMinor;
+	int32_t thisZone;
+	uint32_t sigFigs, snapLen, linkType;
+};
+
+struct PcapRecHdr {
+	uint32_t sec, subSec, capturedLen, origLen;
+};
+
+enum PvNetBackend {
+	PvNetUnix,
+	PvNetTap,
+	PvNetPcap,
+};
+
+static struct {
+	enum PvNetBackend backend;
+	int fd;							//unix or tap
+	struct sockaddr_un peer;
+	FILE *pcapOut, *pcapIn;
+	bool pcapInSwapped, pcapOutDirty;
+	uint8_t mac[6];
+	int devIdx;
+	
+	//a received frame the guest had no buffer for yet
+	uint8_t rxFrame[PV_NET_MAX_FRAME];
+	uint32_t rxLen;
+} mNet = {.fd = -1, .devIdx = -1, };
+
+
+
+static uint32_t pvNetPrvSwap32(uint32_t val, bool swap)
+{
+	return swap ? __builtin_bswap32(val) : val;
+}
+
+static bool pvNetPrvPcapWrite(const uint8_t *frame, uint32_t len)
+{
+	struct PcapRecHdr rec = {.capturedLen = len, .origLen = len, };
+	struct timeval tv;
+	
+	gettimeofday(&tv, NULL);
+	rec.sec = tv.tv_sec;
+	rec.subSec = tv.tv_usec;
+	
+	return fwrite(&rec, sizeof(rec), 1, mNet.pcapOut) == 1 && fwrite(frame, 1, len, mNet.pcapOut) == len;
+}
+
+//one frame into mNet.rxFrame, if there is one
+static void pvNetPrvRxFetch(void)
+{
+	struct PcapRecHdr rec;
+	uint32_t len;
+	ssize_t ret;
+	
+	if (mNet.rxLen)
+		return;
+	
+	switch (mNet.backend) {
+		case PvNetUnix:
+		case PvNetTap:
+			do {
+				ret = read(mNet.fd, mNet.rxFrame, sizeof(mNet.rxFrame));
+			} while (ret < 0 && errno == EINTR);
+			if (ret > 0)
+				mNet.rxLen = ret;
+			break;
+		
+		case PvNetPcap:
+			if (!mNet.pcapIn)
+				break;
+			if (fread(&rec, sizeof(rec), 1, mNet.pcapIn) != 1) {
+				fclose(mNet.pcapIn);
+				mNet.pcapIn = NULL;
+				fprintf(stderr, "pvnet: pcap replay done\n");
+				break;
+			}
+			len = pvNetPrvSwap32(rec.capturedLen, mNet.pcapInSwapped);
+			if (len > sizeof(mNet.rxFrame)) {		//jumbo or truncated-by-capture, skip it
+				fseek(mNet.pcapIn, len, SEEK_CUR);
+				break;
+			}
+			if (fread(mNet.rxFrame, 1, len, mNet.pcapIn) == len)
+				mNet.rxLen = len;
+			break;
+	}
+}
+
+static void pvNetPrvTx(const uint8_t *frame, uint32_t len)
+{
+	ssize_t ret;
+	
+	switch (mNet.backend) {
+		case PvNetUnix:
+			do {
+				ret = sendto(mNet.fd, frame, len, 0, (struct sockaddr*)&mNet.peer, sizeof(mNet.peer));
+			} while (ret < 0 && errno == EINTR);
+			break;			//no peer yet, or it is slow? frame is lost as on a real wire
+		
+		case PvNetTap:
+			do {
+				ret = write(mNet.fd, frame, len);
+			} while (ret < 0 && errno == EINTR);
+			break;
+		
+		case PvNetPcap:
+			if (!pvNetPrvPcapWrite(frame, len))
+				fprintf(stderr, "pvnet: cannot write to pcap\n");
+			mNet.pcapOutDirty = true;
+			break;
+	}
+}
+
+static bool pvNetPrvReq(void *userData, uint_fast8_t queue, struct PvRingReq *req)
+{
+	(void)userData;
+	
+	if (queue == PV_NET_Q_TX) {
+		
+		if (!req->out || req->outLen > PV_NET_MAX_FRAME)
+			req->status = PV_ST_INVAL;
+		else
+			pvNetPrvTx(req->out, req->outLen);
+		return true;
+	}
+	
+	if (!req->in || req->inLen < PV_NET_MAX_FRAME) {
+		req->status = PV_ST_INVAL;
+		req->inLen = 0;
+		return true;
+	}
+	
+	pvNetPrvRxFetch();
+	if (!mNet.rxLen)
+		return false;
+	
+	memcpy(req->in, mNet.rxFrame, mNet.rxLen);
+	req->inLen = mNet.rxLen;
+	mNet.rxLen = 0;
+	
+	return true;
+}
+
+static uint32_t pvNetPrvCfg(void *userData, uint32_t word)
+{
+	(void)userData;
+	
+	switch (word) {
+		case 0:
+			return mNet.mac[0] + (mNet.mac[1] << 8) + (mNet.mac[2] << 16) + (((uint32_t)mNet.mac[3]) << 24);
+		
+		case 1:
+			return mNet.mac[4] + (mNet.mac[5] << 8);
+		
+		case 2:
+			return PV_NET_MAX_FRAME;
+		
+		default:
+			return 0;
+	}
+}
+
+static void pvNetPrvPoll(void *userData)
+{
+	(void)userData;
+	
+	//so the capture is usable even if we are killed
+	if (mNet.pcapOutDirty) {
+		mNet.pcapOutDirty = false;
+		fflush(mNet.pcapOut);
+	}
+	
+	//rx queue stalls when it runs out of frames. restart it once one is here
+	pvNetPrvRxFetch();
+	if (mNet.rxLen)
+		pvRingWake(mNet.devIdx, PV_NET_Q_RX);
+}
+
+static bool pvNetPrvOpenUnix(const char *spec)
+{
+	struct sockaddr_un sa = {.sun_family = AF_UNIX, };
+	const char *comma = strchr(spec, ',');
+	
+	if (!comma || (size_t)(comma - spec) >= sizeof(sa.sun_path) || strlen(comma + 1) >= sizeof(mNet.peer.sun_path)) {
+		fprintf(stderr, "pvnet: unix backend wants '<path>,<peer>'\n");
+		return false;
+	}
+	memcpy(sa.sun_path, spec, comma - spec);
+	mNet.peer.sun_family = AF_UNIX;
+	strcpy(mNet.peer.sun_path, comma + 1);
+	
+	mNet.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (mNet.fd < 0) {
+		perror("pvnet: socket");
+		return false;
+	}
+	
+	unlink(sa.sun_path);
+	if (bind(mNet.fd, (struct sockaddr*)&sa, sizeof(sa))) {
+		perror("pvnet: bind");
+		return false;
+	}
+	
+	return true;
+}
+
+static bool pvNetPrvOpenTap(const char *ifName)
+{
+	#ifdef __linux__
+		struct ifreq ifr = {.ifr_flags = IFF_TAP | IFF_NO_PI, };
+		
+		if (strlen(ifName) >= sizeof(ifr.ifr_name)) {
+			fprintf(stderr, "pvnet: tap name too long\n");
+			return false;
+		}
+		strcpy(ifr.ifr_name, ifName);
+		
+		mNet.fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (mNet.fd < 0) {
+			perror("pvnet: cannot open /dev/net/tun");
+			return false;
+		}
+		if (ioctl(mNet.fd, TUNSETIFF, &ifr)) {
+			perror("pvnet: cannot attach to tap");
+			return false;
+		}
+		
+		return true;
+	#else
+		(void)ifName;
+		fprintf(stderr, "pvnet: tap not supported on this host\n");
+		return false;
+	#endif
+}
+
+static bool pvNetPrvOpenPcap(const char *spec)
+{
+	const struct PcapHdr outHdr = {.magic = PCAP_MAGIC, .verMajor = 2, .verMinor = 4, .snapLen = 65535, .linkType = PCAP_LINKTYPE_ETH, };
+	const char *comma = strchr(spec, ',');
+	struct PcapHdr inHdr;
+	char *outName;
+	uint32_t magic;
+	
+	outName = comma ? strndup(spec, comma - spec) : strdup(spec);
+	mNet.pcapOut = fopen(outName, "wb");
+	free(outName);
+	if (!mNet.pcapOut || fwrite(&outHdr, sizeof(outHdr), 1, mNet.pcapOut) != 1) {
+		perror("pvnet: cannot create pcap");
+		return false;
+	}
+	fflush(mNet.pcapOut);
+	
+	if (!comma)
+		return true;
+	
+	mNet.pcapIn = fopen(comma + 1, "rb");
+	if (!mNet.pcapIn || fread(&inHdr, sizeof(inHdr), 1, mNet.pcapIn) != 1) {
+		perror("pvnet: cannot read replay pcap");
+		return false;
+	}
+	magic = inHdr.magic;
+	mNet.pcapInSwapped = magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+	magic = pvNetPrvSwap32(magic, mNet.pcapInSwapped);
+	if ((magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) || pvNetPrvSwap32(inHdr.linkType, mNet.pcapInSwapped) != PCAP_LINKTYPE_ETH) {
+		fprintf(stderr, "pvnet: replay file is not an ethernet pcap\n");
+		return false;
+	}
+	
+	return true;
+}
+
+bool pvNetInit(const char *spec, const uint8_t *mac)
+{
+	static const struct PvRingDev dev = {
+		.type = PV_DEV_NET,
+		.numQueues = 2,
+		.irq = SOC_IRQNO_ETHERNET,
+		.reqF = pvNetPrvReq,
+		.cfgF = pvNetPrvCfg,
+		.pollF = pvNetPrvPoll,
+	};
+	bool ret;
+	
+	if (!strncmp(spec, "unix:", 5)) {
+		mNet.backend = PvNetUnix;
+		ret = pvNetPrvOpenUnix(spec + 5);
+	}
+	else if (!strncmp(spec, "tap:", 4)) {
+		mNet.backend = PvNetTap;
+		ret = pvNetPrvOpenTap(spec + 4);
+	}
+	else if (!strncmp(spec, "pcap:", 5)) {
+		mNet.backend = PvNetPcap;
+		ret = pvNetPrvOpenPcap(spec + 5);
+	}
+	else {
+		fprintf(stderr, "pvnet: unknown backend '%s'\n", spec);
+		return false;
+	}
+	if (!ret)
+		return false;
+	
+	if (mac)
+		memcpy(mNet.mac, mac, sizeof(mNet.mac));
+	else {
+		uint32_t pid = getpid();
+		
+		//locally administered, unicast
+		mNet.mac[0] = 0x02;
+		mNet.mac[1] = 'u';
+		mNet.mac[2] = 'm';
+		mNet.mac[3] = pid >> 16;
+		mNet.mac[4] = pid >> 8;
+		mNet.mac[5] = pid;
+	}
+	
+	mNet.devIdx = pvRingDevAdd(&dev);
+	
+	return mNet.devIdx >= 0;
+}
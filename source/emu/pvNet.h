@@ -0,0 +1,21 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PV_NET_H_
+#define _PV_NET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//paravirtual NIC on the ring transport (PV_DEV_NET in hypercall.h). spec says where its frames go:
+//	"unix:<path>,<peer>"	unix datagram socket bound at <path>, sends to <peer>. two emulators with swapped paths are linked
+//	"tap:<ifname>"			a host TAP interface (needs the rights to create or attach to it)
+//	"pcap:<out>[,<in>]"		tx frames are written to pcap file <out>, frames from pcap file <in> are replayed as rx
+//mac may be NULL, then one is made up from our pid
+
+bool pvNetInit(const char *spec, const uint8_t *mac);
+
+
+#endif
@@ -0,0 +1,207 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stddef.h>
+#include "../hypercall.h"
+#include "pvRing.h"
+#include "soc.h"
+#include "cpu.h"
+#include "mem.h"
+
+
+#define PV_IRQ_MIN		2		//hardware irq lines only
+#define PV_IRQ_MAX		7
+
+
+struct PvRingQueue {
+	struct PvRing *ring;		//NULL if guest has not set one up
+	uint32_t ringPa;
+	uint32_t num;
+	bool wake;					//backend asked to be retried
+};
+
+static struct {
+	const struct PvRingDev *dev;
+	struct PvRingQueue q[PV_MAX_QUEUES];
+} mDevs[PV_MAX_DEVS];
+
+static uint_fast8_t mNumDevs;
+static uint32_t mIrqPending;		//devices that completed something since the last H_PV_IRQ_ACK
+
+
+
+int pvRingDevAdd(const struct PvRingDev *dev)
+{
+	if (mNumDevs == PV_MAX_DEVS || !dev->numQueues || dev->numQueues > PV_MAX_QUEUES || dev->irq < PV_IRQ_MIN || dev->irq > PV_IRQ_MAX)
+		return -1;
+	
+	mDevs[mNumDevs].dev = dev;
+	
+	return mNumDevs++;
+}
+
+void pvRingWake(uint_fast8_t devIdx, uint_fast8_t queue)
+{
+	mDevs[devIdx].q[queue].wake = true;
+}
+
+static struct PvRingQueue* pvRingPrvGetQueue(uint32_t devAndQueue, uint32_t *devIdxP)
+{
+	uint32_t devIdx = devAndQueue >> 8, queue = devAndQueue & 0xff;
+	
+	if (devIdx >= mNumDevs || queue >= mDevs[devIdx].dev->numQueues)
+		return NULL;
+	
+	*devIdxP = devIdx;
+	return &mDevs[devIdx].q[queue];
+}
+
+static void pvRingPrvProcess(uint_fast8_t devIdx, uint_fast8_t queue)
+{
+	const struct PvRingDev *dev = mDevs[devIdx].dev;
+	struct PvRingQueue *q = &mDevs[devIdx].q[queue];
+	struct PvRing *ring = q->ring;
+	uint32_t used, start;
+	
+	if (!ring)
+		return;
+	
+	used = start = ring->used;
+	
+	//a guest that posts more than fits gets nothing done till it fixes its counters
+	if (ring->avail == used || ring->avail - used > q->num)
+		return;
+	
+	do {
+		struct PvReq *r = &ring->req[used & (q->num - 1)];
+		struct PvRingReq req = {.op = r->op, .arg = r->arg, .status = PV_ST_OK, };
+		
+		if (r->outLen && !(req.out = memGetDirectPtr(r->outPa, r->outLen)))
+			req.status = PV_ST_INVAL;
+		else if (r->inLen && !(req.in = memGetDirectPtr(r->inPa, r->inLen)))
+			req.status = PV_ST_INVAL;
+		else {
+			req.outLen = r->outLen;
+			req.inLen = r->inLen;
+			
+			//handler always sees inLen as the buffer size, but we report 0 written unless it says otherwise
+			if (!dev->reqF(dev->userData, queue, &req))
+				break;
+			if (req.inLen > r->inLen)
+				req.inLen = r->inLen;
+			
+			//handlers may scribble on all of it, not just what they report
+			cpuHostRamWritten(r->inPa, r->inLen);
+		}
+		r->status = req.status;
+		r->inLen = req.status == PV_ST_INVAL ? 0 : req.inLen;
+		ring->used = ++used;
+	
+	} while (used != ring->avail);
+	
+	if (used != start)
+		cpuHostRamWritten(q->ringPa, offsetof(struct PvRing, req) + sizeof(struct PvReq) * q->num);
+	
+	if (used != start && !(ring->flags & PV_RING_F_NO_IRQ)) {
+		mIrqPending |= 1 << devIdx;
+		cpuIrq(dev->irq, true);
+	}
+}
+
+void pvRingPoll(void)
+{
+	uint_fast8_t i, j;
+	
+	for (i = 0; i < mNumDevs; i++) {
+		
+		if (mDevs[i].dev->pollF)
+			mDevs[i].dev->pollF(mDevs[i].dev->userData);
+		
+		for (j = 0; j < mDevs[i].dev->numQueues; j++) {
+			
+			struct PvRingQueue *q = &mDevs[i].q[j];
+			
+			if (q->ring && (q->wake || (q->ring->flags & PV_RING_F_POLL))) {
+				q->wake = false;
+				pvRingPrvProcess(i, j);
+			}
+		}
+	}
+}
+
+uint32_t pvRingGetDev(uint32_t devIdx)
+{
+	if (devIdx >= mNumDevs)
+		return PV_DEV_NONE;
+	
+	return (((uint32_t)mDevs[devIdx].dev->irq) << 24) | (((uint32_t)mDevs[devIdx].dev->numQueues) << 16) | mDevs[devIdx].dev->type;
+}
+
+uint32_t pvRingGetCfg(uint32_t devIdx, uint32_t word)
+{
+	if (devIdx >= mNumDevs || !mDevs[devIdx].dev->cfgF)
+		return 0;
+	
+	return mDevs[devIdx].dev->cfgF(mDevs[devIdx].dev->userData, word);
+}
+
+bool pvRingQueueSetup(uint32_t devAndQueue, uint32_t ringPa, uint32_t numEntries)
+{
+	struct PvRingQueue *q;
+	struct PvRing *ring;
+	uint32_t devIdx;
+	
+	if (!(q = pvRingPrvGetQueue(devAndQueue, &devIdx)))
+		return false;
+	
+	q->ring = NULL;
+	q->wake = false;
+	
+	if (!numEntries)
+		return true;
+	
+	if ((ringPa & 3) || numEntries > PV_MAX_RING_SZ || (numEntries & (numEntries - 1)))
+		return false;
+	
+	ring = memGetDirectPtr(ringPa, offsetof(struct PvRing, req) + sizeof(struct PvReq) * numEntries);
+	if (!ring || ring->avail || ring->used)
+		return false;
+	
+	q->ring = ring;
+	q->ringPa = ringPa;
+	q->num = numEntries;
+	
+	return true;
+}
+
+bool pvRingKick(uint32_t devAndQueue)
+{
+	struct PvRingQueue *q;
+	uint32_t devIdx;
+	
+	if (!(q = pvRingPrvGetQueue(devAndQueue, &devIdx)))
+		return false;
+	
+	pvRingPrvProcess(devIdx, devAndQueue & 0xff);
+	
+	return true;
+}
+
+uint32_t pvRingIrqAck(uint32_t irq)
+{
+	uint32_t ret = 0;
+	uint_fast8_t i;
+	
+	for (i = 0; i < mNumDevs; i++) {
+		if (mDevs[i].dev->irq == irq)
+			ret |= mIrqPending & (1 << i);
+	}
+	mIrqPending &=~ ret;
+	
+	if (irq >= PV_IRQ_MIN && irq <= PV_IRQ_MAX)
+		cpuIrq(irq, false);
+	
+	return ret;
+}
@@ -0,0 +1,55 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _PV_RING_H_
+#define _PV_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//host side of the paravirtual ring transport (ABI in hypercall.h). devices register here and are handed each
+//request the guest posts, with its buffers already checked and mapped. requests complete strictly in order
+
+
+struct PvRingReq {
+	uint16_t op;
+	uint16_t status;			//handler sets it, PV_ST_OK by default
+	uint32_t arg;
+	const uint8_t *out;			//NULL if no such buffer was given
+	uint32_t outLen;
+	uint8_t *in;
+	uint32_t inLen;				//handler sets it to how much it wrote, 0 by default
+};
+
+//return false to leave the request (and all after it in that queue) pending, till pvRingWake() is called
+typedef bool (*PvRingReqF)(void *userData, uint_fast8_t queue, struct PvRingReq *req);
+typedef uint32_t (*PvRingCfgF)(void *userData, uint32_t word);
+typedef void (*PvRingPollF)(void *userData);
+
+struct PvRingDev {
+	uint16_t type;				//PV_DEV_*
+	uint8_t numQueues;
+	uint8_t irq;				//cpu irq line raised on completions, SOC_IRQNO_PV unless device has its own
+	PvRingReqF reqF;
+	PvRingCfgF cfgF;			//may be NULL if device has no config
+	PvRingPollF pollF;			//may be NULL. called from pvRingPoll(), to check backend for input
+	void *userData;
+};
+
+
+int pvRingDevAdd(const struct PvRingDev *dev);		//returns device index or -1, dev must stay valid
+void pvRingWake(uint_fast8_t devIdx, uint_fast8_t queue);	//backend can now make progress on a queue it left pending
+
+void pvRingPoll(void);			//call periodically: polls backends, processes rings that asked for polling
+
+//hypercalls, as per hypercall.h
+uint32_t pvRingGetDev(uint32_t devIdx);
+uint32_t pvRingGetCfg(uint32_t devIdx, uint32_t word);
+bool pvRingQueueSetup(uint32_t devAndQueue, uint32_t ringPa, uint32_t numEntries);
+bool pvRingKick(uint32_t devAndQueue);
+uint32_t pvRingIrqAck(uint32_t irq);
+
+
+#endif
@@ -6,7 +6,9 @@
 #ifndef _SOC_H_
 #define _SOC_H_
 
-#define RAM_AMOUNT	(16<<20)
+#define RAM_DEFAULT_AMOUNT	(16<<20)
+#define RAM_MAX_AMOUNT		(256<<20)	/* kseg0 could reach 512MB, but devices start at PA 0x17000000 and ROM is at 0x1FC00000 */
+#define RAM_MAP_BIT_SZ		(1<<20)		/* granularity of ram size and of the memory bitmap */
 #define RAM_BASE	0x00000000UL
 #define ROM_BASE	0x1FC00000UL	/* as per spec */
 
@@ -22,26 +24,36 @@
 
 typedef bool (*MassStorageF)(uint8_t op, uint32_t val, void *buf);
 
+struct SocRamCfg {
+	uint32_t amount;		//bytes, multiple of RAM_MAP_BIT_SZ, at most RAM_MAX_AMOUNT
+	int numaNode;			//bind guest RAM to this host node, -1 for no binding
+	bool populate;			//fault it all in at start
+};
 
-bool socInit(MassStorageF diskF);
+
+bool socInit(MassStorageF diskF, const struct SocRamCfg *ramCfg);
 void socRun(int gdbPort);
+void socRtcUseHostClock(bool hostClock);	//RTC ticks follow host time instead of one per 1024 instructions
+uint32_t socGetMemMap(uint32_t idx);	//as per H_GET_MEM_MAP
 
 
 ///SoC IRQ numbers:
-// 2 - SCSI
+// 2 - SCSI (perf counter overflow on pc)
 // 3 - Ethernet
 // 4 - UARTs
 // 5 - RTC
-// 6 - ?
+// 6 - ? (paravirtual ring devices on pc)
 // 7 - bus interface unit
 #define SOC_IRQNO_SCSI		2
 #define SOC_IRQNO_ETHERNET	3
 #define SOC_IRQNO_UART		4
 #define SOC_IRQNO_RTC		5
+#define SOC_IRQNO_PV		6
 
 
 //externally provided
 void socInputCheck(void);
+void socSignalCheck(void);		//ends the run if a signal asked for it. called often, and while waiting on a debugger
 
 
 #endif
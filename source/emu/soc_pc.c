@@ -3,14 +3,22 @@
 	Non-commercial use only OR licensing@dmitry.gr
 */
 
+#include <sys/syscall.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include "../hypercall.h"
+#include "kernelBoot.h"
 #include "decBus.h"
 #include "ds1287.h"
 #include "printf.h"
+#include "timeline.h"
+#include "batch.h"
+#include "pvRing.h"
+#include "pmu.h"
 #include "dz11.h"
 #include "soc.h"
 #include "cpu.h"
@@ -20,8 +28,10 @@
 
 
 static MassStorageF gDiskF;
-static uint8_t gRam[RAM_AMOUNT];
+static uint8_t *gRam;
+static uint32_t gRamAmount;
 static uint8_t gRom[256*1024];
+static bool mRtcHostClock = false;
 
 
 
@@ -63,34 +73,44 @@ static bool accessRamRom(uint32_t pa, uint_fast8_t size, bool write, void* buf,
 	return true;
 }
 
+uint32_t socGetMemMap(uint32_t idx)
+{
+	//[0] is nBits, [1] is eachBitSz, [2+] are bitmap bytes
+	uint32_t nBits = gRamAmount / RAM_MAP_BIT_SZ;
+	
+	switch (idx) {
+		case 0:
+			return nBits;
+		
+		case 1:
+			return RAM_MAP_BIT_SZ;
+		
+		default:
+			idx = (idx - 2) * 8;	//first bit this byte covers
+			if (idx >= nBits)
+				return 0;
+			if (nBits - idx >= 8)
+				return 0xff;
+			return (1 << (nBits - idx)) - 1;
+	}
+}
+
+static bool socPrvRamRangeOk(uint32_t pa, uint32_t len)
+{
+	return pa < gRamAmount && gRamAmount - pa >= len;
+}
+
 bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0, if any
 {
 	uint32_t hyperNum = cpuGetRegExternal(MIPS_REG_AT), t;
-	uint32_t blk, pa;
+	char name[TIMELINE_NAME_LEN];
+	uint32_t blk, pa, src, len;
 	uint8_t chr;
 	bool ret;
 
 	switch (hyperNum) {
 		case H_GET_MEM_MAP:
-			//a0 is byte index index if >= 2, [0] is nBits, [1] is eachBitSz
-			switch (cpuGetRegExternal(MIPS_REG_A0)) {
-				case 0:
-					pa = 1;
-					break;
-				
-				case 1:
-					pa = RAM_AMOUNT;
-					break;
-				
-				case 2:
-					pa = 0x01;	//that one bit :D
-					break;
-				
-				default:
-					pa = 0;
-					break;
-			}
-			cpuSetRegExternal(MIPS_REG_V0, pa);
+			cpuSetRegExternal(MIPS_REG_V0, socGetMemMap(cpuGetRegExternal(MIPS_REG_A0)));
 			break;
 		
 		case H_CONSOLE_WRITE:
@@ -109,25 +129,127 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 		case H_STOR_READ:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
-			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskF(MASS_STORE_OP_READ, blk, gRam + pa);
+			ret = socPrvRamRangeOk(pa, 512) && gDiskF(MASS_STORE_OP_READ, blk, gRam + pa);
+			cpuHostRamWritten(pa, 512);
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 	//		fprintf(stderr, " rd_block(%u, 0x%08x) -> %d\r\n", blk, pa, ret);
 		
 			break;
 		
+		case H_STOR_READ_MULTI:
+			blk = cpuGetRegExternal(MIPS_REG_A0);
+			pa = cpuGetRegExternal(MIPS_REG_A1);
+			len = cpuGetRegExternal(MIPS_REG_A2);
+			ret = len <= gRamAmount / BLK_DEV_BLK_SZ && socPrvRamRangeOk(pa, len * BLK_DEV_BLK_SZ);
+			for (t = 0; ret && t < len; t++)
+				ret = gDiskF(MASS_STORE_OP_READ, blk + t, gRam + pa + t * BLK_DEV_BLK_SZ);
+			cpuHostRamWritten(pa, t * BLK_DEV_BLK_SZ);
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
 		case H_STOR_WRITE:
 			blk = cpuGetRegExternal(MIPS_REG_A0);
 			pa = cpuGetRegExternal(MIPS_REG_A1);
-			ret = pa < RAM_AMOUNT && RAM_AMOUNT - pa >= 512 && gDiskF(MASS_STORE_OP_WRITE, blk, gRam + pa);
+			ret = socPrvRamRangeOk(pa, 512) && gDiskF(MASS_STORE_OP_WRITE, blk, gRam + pa);
 			cpuSetRegExternal(MIPS_REG_V0, ret);
 	//		fprintf(stderr, " wr_block(%u, 0x%08x) -> %d\r\n", blk, pa, ret);
 			break;
 		
 		case H_TERM:
-			exit(0);
+			batchExit("guest", (uint8_t)cpuGetRegExternal(MIPS_REG_A0));
+			break;
+		
+		case H_GET_FEATURES:
+			//Count only keeps time if the RTC, and thus guest time, is also driven by the instruction count
+			cpuSetRegExternal(MIPS_REG_V0, H_FEAT_RTC_ONESHOT | H_FEAT_PV_RING | H_FEAT_PAGE_OPS | H_FEAT_ISA | H_FEAT_TLB_SIZE | H_FEAT_PMU | H_FEAT_MARK | H_FEAT_STOR_MULTI | (mRtcHostClock ? 0 : H_FEAT_CP0_TIMER));
+			break;
+		
+		case H_GET_ISA:
+			cpuSetRegExternal(MIPS_REG_V0, cpuGetIsaExts());	//CPU_ISA_* are the same bits
+			break;
+		
+		case H_GET_TLB_SIZE:
+			cpuSetRegExternal(MIPS_REG_V0, cpuGetTlbSize());
+			break;
+		
+		case H_MARK:
+			pa = cpuGetRegExternal(MIPS_REG_A1);
+			for (len = 0; pa && len < sizeof(name) - 1 && socPrvRamRangeOk(pa + len, 1) && gRam[pa + len]; len++)
+				name[len] = gRam[pa + len];
+			name[len] = 0;
+			if (!timelineMark(cpuGetRegExternal(MIPS_REG_A0), name))
+				batchExit("mark", 0);
+			cpuSetRegExternal(MIPS_REG_V0, true);
+			break;
+		
+		case H_PV_GET_DEV:
+			cpuSetRegExternal(MIPS_REG_V0, pvRingGetDev(cpuGetRegExternal(MIPS_REG_A0)));
+			break;
+		
+		case H_PV_GET_CFG:
+			cpuSetRegExternal(MIPS_REG_V0, pvRingGetCfg(cpuGetRegExternal(MIPS_REG_A0), cpuGetRegExternal(MIPS_REG_A1)));
+			break;
+		
+		case H_PV_QUEUE_SETUP:
+			cpuSetRegExternal(MIPS_REG_V0, pvRingQueueSetup(cpuGetRegExternal(MIPS_REG_A0), cpuGetRegExternal(MIPS_REG_A1), cpuGetRegExternal(MIPS_REG_A2)));
+			break;
+		
+		case H_PV_KICK:
+			cpuSetRegExternal(MIPS_REG_V0, pvRingKick(cpuGetRegExternal(MIPS_REG_A0)));
+			break;
+		
+		case H_PV_IRQ_ACK:
+			cpuSetRegExternal(MIPS_REG_V0, pvRingIrqAck(cpuGetRegExternal(MIPS_REG_A0)));
+			break;
+		
+		//like the cpu's own stores, these leave the icache alone. the guest flushes it if it put code there
+		case H_PAGE_ZERO:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			ret = !(pa % H_PAGE_SIZE) && socPrvRamRangeOk(pa, H_PAGE_SIZE);
+			if (ret) {
+				memset(gRam + pa, 0, H_PAGE_SIZE);
+				cpuHostRamWritten(pa, H_PAGE_SIZE);
+			}
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
+		case H_PAGE_COPY:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			src = cpuGetRegExternal(MIPS_REG_A1);
+			ret = !((pa | src) % H_PAGE_SIZE) && socPrvRamRangeOk(pa, H_PAGE_SIZE) && socPrvRamRangeOk(src, H_PAGE_SIZE);
+			if (ret && pa != src) {
+				memcpy(gRam + pa, gRam + src, H_PAGE_SIZE);
+				cpuHostRamWritten(pa, H_PAGE_SIZE);
+			}
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
+		case H_MEM_SET:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			len = cpuGetRegExternal(MIPS_REG_A2);
+			ret = socPrvRamRangeOk(pa, len);
+			if (ret) {
+				memset(gRam + pa, (uint8_t)cpuGetRegExternal(MIPS_REG_A1), len);
+				cpuHostRamWritten(pa, len);
+			}
+			cpuSetRegExternal(MIPS_REG_V0, ret);
+			break;
+		
+		case H_MEM_COPY:
+			pa = cpuGetRegExternal(MIPS_REG_A0);
+			src = cpuGetRegExternal(MIPS_REG_A1);
+			len = cpuGetRegExternal(MIPS_REG_A2);
+			ret = socPrvRamRangeOk(pa, len) && socPrvRamRangeOk(src, len);
+			if (ret) {
+				memmove(gRam + pa, gRam + src, len);
+				cpuHostRamWritten(pa, len);
+			}
+			cpuSetRegExternal(MIPS_REG_V0, ret);
 			break;
 		
 		default:
+			if (hyperNum >= H_PROM_BASE && hyperNum - H_PROM_BASE < 0x40 && kernelBootPromCall(hyperNum - H_PROM_BASE))
+				break;
 			err_str("hypercall %u @ 0x%08x\n", hyperNum, cpuGetRegExternal(MIPS_EXT_REG_PC));
 			return false;
 	}
@@ -135,14 +257,140 @@ bool cpuExtHypercall(void)	//call type in $at, params in $a0..$a3, return in $v0
 }
 
 
-bool socInit(MassStorageF diskF)
+static uint32_t socPrvPvBlkCfg(void *userData, uint32_t word)
+{
+	uint32_t numSec;
+	
+	(void)userData;
+	
+	if (word || !gDiskF(MASS_STORE_OP_GET_SZ, 0, &numSec))
+		return 0;
+	
+	return numSec;
+}
+
+static bool socPrvPvBlkReq(void *userData, uint_fast8_t queue, struct PvRingReq *req)
+{
+	uint32_t i, numSec = socPrvPvBlkCfg(userData, 0), len;
+	
+	(void)queue;
+	
+	switch (req->op) {
+		case PV_BLK_OP_READ:
+		case PV_BLK_OP_WRITE:
+			len = req->op == PV_BLK_OP_READ ? req->inLen : req->outLen;
+			if (!len || len % BLK_DEV_BLK_SZ || req->arg > numSec || len / BLK_DEV_BLK_SZ > numSec - req->arg) {
+				req->status = PV_ST_INVAL;
+				break;
+			}
+			for (i = 0; i < len / BLK_DEV_BLK_SZ; i++) {
+				
+				if (req->op == PV_BLK_OP_READ ? !gDiskF(MASS_STORE_OP_READ, req->arg + i, req->in + i * BLK_DEV_BLK_SZ) : !gDiskF(MASS_STORE_OP_WRITE, req->arg + i, (void*)(req->out + i * BLK_DEV_BLK_SZ))) {
+					req->status = PV_ST_ERR;
+					break;
+				}
+			}
+			if (req->op == PV_BLK_OP_READ)
+				req->inLen = i * BLK_DEV_BLK_SZ;
+			break;
+		
+		case PV_BLK_OP_FLUSH:		//writes are not cached by us
+			break;
+		
+		default:
+			req->status = PV_ST_INVAL;
+			break;
+	}
+	
+	return true;
+}
+
+static bool socPrvAllocRam(const struct SocRamCfg *cfg)
+{
+	//map with 2MB of slack so we can align it, else the THP code cannot use huge pages for the ends
+	const uintptr_t align = 2 << 20;
+	uintptr_t start, alignedStart;
+	uint8_t *mem;
+	
+	if (!cfg->amount || cfg->amount > RAM_MAX_AMOUNT || cfg->amount % RAM_MAP_BIT_SZ) {
+		fprintf(stderr, "RAM size of %u bytes not supported\n", cfg->amount);
+		return false;
+	}
+	
+	mem = mmap(NULL, cfg->amount + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("cannot map guest RAM");
+		return false;
+	}
+	start = (uintptr_t)mem;
+	alignedStart = (start + align - 1) &~ (align - 1);
+	if (alignedStart != start)
+		munmap(mem, alignedStart - start);
+	munmap((void*)(alignedStart + cfg->amount), start + align - alignedStart);
+	mem = (uint8_t*)alignedStart;
+	
+	#ifdef MADV_HUGEPAGE
+		if (madvise(mem, cfg->amount, MADV_HUGEPAGE))
+			perror("cannot use huge pages for guest RAM");
+	#endif
+	
+	if (cfg->numaNode >= 0) {
+		
+		#ifdef SYS_mbind
+			unsigned long nodeMask[4] = {};
+			
+			//MPOL_BIND is 2. done directly to avoid needing libnuma
+			if (cfg->numaNode >= (int)(sizeof(nodeMask) * 8))
+				fprintf(stderr, "NUMA node %d not supported\n", cfg->numaNode);
+			else {
+				nodeMask[cfg->numaNode / (sizeof(*nodeMask) * 8)] |= 1UL << (cfg->numaNode % (sizeof(*nodeMask) * 8));
+				if (syscall(SYS_mbind, mem, (unsigned long)cfg->amount, 2, nodeMask, sizeof(nodeMask) * 8, 0))
+					perror("cannot bind guest RAM to NUMA node");
+			}
+		#else
+			fprintf(stderr, "NUMA binding not supported on this host\n");
+		#endif
+	}
+	
+	//after madvise and mbind, so the faults are served with huge pages from the right node
+	if (cfg->populate) {
+		
+		bool populated = false;
+		uint32_t i;
+		
+		#ifdef MADV_POPULATE_WRITE
+			populated = !madvise(mem, cfg->amount, MADV_POPULATE_WRITE);
+		#endif
+		
+		for (i = 0; !populated && i < cfg->amount; i += 4096)
+			((volatile uint8_t*)mem)[i] = 0;
+	}
+	
+	gRam = mem;
+	gRamAmount = cfg->amount;
+	
+	return true;
+}
+
+bool socInit(MassStorageF diskF, const struct SocRamCfg *ramCfg)
 {
+	static const struct PvRingDev pvBlk = {
+		.type = PV_DEV_BLOCK,
+		.numQueues = 1,
+		.irq = SOC_IRQNO_PV,
+		.reqF = socPrvPvBlkReq,
+		.cfgF = socPrvPvBlkCfg,
+	};
+	
 	gDiskF = diskF;
 	
-	if (!memRegionAdd(RAM_BASE, sizeof(gRam), accessRamRom, (void*)1))
+	if (!socPrvAllocRam(ramCfg))
+		return false;
+	
+	if (!memRegionAddDirect(RAM_BASE, gRamAmount, accessRamRom, (void*)1, gRam))
 		return false;
 	
-	if (!memRegionAdd(ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRamRom, (void*)0))
+	if (!memRegionAddDirect(ROM_BASE & 0x1FFFFFFFUL, sizeof(gRom), accessRamRom, (void*)0, gRom))
 		return false;
 	
 	if (!decBusInit())
@@ -154,42 +402,98 @@ bool socInit(MassStorageF diskF)
 	if (!ds1287init())
 		return false;
 	
+	if (!pmuInit())
+		return false;
+	
+	if (pvRingDevAdd(&pvBlk) < 0)
+		return false;
+	
 	cpuInit();
 	
 	return true;
 }
 
 #ifdef GDB_SUPPORT
-	static void gdbCmdWait(unsigned gdbPort, bool* ss);
+	static void gdbPrvInit(int gdbPort);
+	static void gdbPrvPoll(void);
+	static void gdbPrvStopped(void);
 #endif
 
-static bool singleStep = false;
+static bool mDebugStop = false;		//a debugger wants us stopped before the next instr
 	
 void socStop(void)
 {
-	singleStep = true;
+	mDebugStop = true;
+}
+
+void socRtcUseHostClock(bool hostClock)
+{
+	mRtcHostClock = hostClock;
+}
+
+static void socPrvRtcHostClockStep(void)
+{
+	static uint64_t lastNsec = 0, remainder = 0;
+	struct timespec ts;
+	uint64_t now, ticks;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	
+	if (!lastNsec)
+		lastNsec = now;
+	
+	//1/8192 sec ticks, carrying the fractional part so we do not drift
+	remainder += (now - lastNsec) * 8192;
+	lastNsec = now;
+	ticks = remainder / 1000000000ull;
+	remainder %= 1000000000ull;
+	
+	if (ticks)
+		ds1287step(ticks > 0xffffffffull ? 0xffffffff : ticks);
 }
 
 void socRun(int gdbPort)
 {
+	uint64_t rtcTickAt = 1024;	//instr count of the next RTC tick, when it runs off instrs
 	uint16_t cy = 0;
 	
-	(void)gdbPort;
+	#ifdef GDB_SUPPORT
+		gdbPrvInit(gdbPort);
+	#else
+		(void)gdbPort;
+	#endif
 	
 	while(true) {
 		cy++;
 		
 		#ifdef GDB_SUPPORT
-			gdbCmdWait(gdbPort, &singleStep);
+			if (mDebugStop)
+				gdbPrvStopped();
 		#endif
 		
 		cpuCycle();
 		
-		if (!(cy & 0x03ff))
+		if (gPmuArmed)
+			pmuCheck();
+		
+		//a cpuCycle() may retire more than one instr, but never runs past a multiple of 1024 of them
+		if (mRtcHostClock) {
+			if (!(cy & 0x03ff))
+				socPrvRtcHostClockStep();
+		}
+		else if (cpuGetInstrCnt() >= rtcTickAt) {
+			rtcTickAt += 1024;
 			ds1287step(1);
+		}
 		
-		if (!(cy & 0x1fff))
+		if (!(cy & 0x1fff)) {
 			socInputCheck();
+			pvRingPoll();
+			#ifdef GDB_SUPPORT
+				gdbPrvPoll();
+			#endif
+		}
 	}
 }
 
@@ -216,54 +520,37 @@ void socRun(int gdbPort)
 #ifdef GDB_SUPPORT
 
 
+	#include <netinet/tcp.h>
+	#include <netinet/in.h>
 	#include <sys/socket.h>
 	#include <arpa/inet.h>
-	#include <sys/socket.h>
-	#include <sys/time.h>
 	#include <sys/types.h>
-	#include <sys/select.h>
 	#include <unistd.h>
-	#include <errno.h>
-	#include <stdlib.h>
-	#include <netinet/in.h>
 	#include <string.h>
+	#include <stdlib.h>
 	#include <stdio.h>
+	#include <fcntl.h>
+	#include <errno.h>
+	#include <poll.h>
 	
-	#define MAX_BKPT	16
-	
-	static uint32_t gBkpts[MAX_BKPT];
-	static uint32_t gNumBkpts = 0;
+	#define GDB_MAX_PACKET		4096							//payload, as we advertise in qSupported
+	#define GDB_MAX_MEM_XFER	(GDB_MAX_PACKET / 2 - 16)		//hex replies to 'm' must fit a packet
 	
+	static int mGdbListenSock = -1, mGdbSock = -1;
+	static bool mGdbRunning;				//debugger resumed us and is waiting for a stop reply
+	static bool mGdbTrapped, mGdbInterrupted;
+	static enum CpuWatchType mGdbTrapType;
+	static uint32_t mGdbTrapAddr;
+	static uint8_t mGdbRxBuf[GDB_MAX_PACKET];
+	static uint32_t mGdbRxLen, mGdbRxPos;
 	
 	
-	static bool socdBkptDel(uint32_t addr, uint8_t sz){
-		
-		uint8_t i;
-		
-		(void)sz;
-		for(i = 0; i < gNumBkpts; i++){
-			
-			if(gBkpts[i] == addr){
-				
-				gNumBkpts--;
-				gBkpts[i] = gBkpts[gNumBkpts];
-				i--;
-			}	
-		}
-		
-		return true;
-	}
-	
-	
-	static bool socdBkptAdd(uint32_t addr, uint8_t sz){	//bool
-		
-		socdBkptDel(addr, sz);
-		
-		if(gNumBkpts == MAX_BKPT) return false;
-		
-		gBkpts[gNumBkpts++] = addr;
-		
-		return true;
+	void cpuExtDebugTrap(uint32_t addr, enum CpuWatchType watchType)
+	{
+		mGdbTrapped = true;
+		mGdbTrapType = watchType;
+		mGdbTrapAddr = addr;
+		mDebugStop = true;
 	}
 	
 	static uint32_t htoi(const char** cP){
@@ -286,11 +573,6 @@ void socRun(int gdbPort)
 		return i;
 	}
 	
-	static bool gdb_memAccess(uint32_t va, uint8_t* buf, bool write){
-		
-		return cpuMemAccessExternal(buf, va, 1, write, CpuAccessAsCurrent);
-	}
-	
 	static bool gdbRegGet(uint8_t which, uint32_t *dst)
 	{
 		if (which < 32)
@@ -363,285 +645,437 @@ void socRun(int gdbPort)
 		return true;
 	}
 	
-	static int interpPacket(const char* in, char* out, bool* ss){	//return 0 if we failed to interp a command, 1 is all ok, -1 to send no reply and run. pi or other irrational numbers may be returned in reply to unreasonable (or irrational) requests :)
-		
-		unsigned char c;
-		unsigned addr, len;
-		int i;
-		int ret = 1;
-		
+	static uint32_t gdbPrvMemAccess(uint32_t va, uint8_t *buf, uint32_t len, bool write)	//returns how many bytes it managed
+	{
+		uint32_t done = 0, word;
 		
-		if(strcmp(in, "qSupported") == 0){
-			
-			strcpy(out, "PacketSize=99");	
-		}
-		else if(strcmp(in, "vCont?") == 0){
-			
-			out[0] = 0;
-		}
-		else if(strcmp(in, "s") == 0){		//single step
-			
-			*ss = true;
-			return -1;
-		}
-		else if(strcmp(in, "c") == 0 || in[0] == 'C'){		//continue [with signal, which we ignore]
-			
-			return -1;
-		}
-		else if(in[0] == 'Z' || in[0] == 'z'){
-			
-			char op = in[0];
-			char type = in[1];
-			bool (*f)(uint32_t addr, uint8_t sz) = NULL;
+		//words where we can, not one cpuMemAccessExternal() per byte. devices that only do bytes get bytes
+		while (done < len) {
 			
-			in += 3;
-			addr = htoi(&in);
-			if(*in++ != ',') goto fail;	//no comma?
-			len = htoi(&in);
-			if(*in) goto fail;		//string not over?
-			
-			if(type == '0' || type == '1'){	//bkpt
+			if (!((va + done) & 3) && len - done >= 4) {
 				
-				f = (op == 'Z') ? socdBkptAdd : socdBkptDel;
+				if (write)
+					memcpy(&word, buf + done, 4);
+				if (cpuMemAccessExternal(&word, va + done, 4, write, CpuAccessAsCurrent)) {
+					if (!write)
+						memcpy(buf + done, &word, 4);
+					done += 4;
+					continue;
+				}
 			}
-
-			strcpy(out, f && f(addr, len) ? "OK" : "e00");
-		}
-		else if(in[0] == 'H' && (in[1] == 'c' || in[1] == 'g')){
-			strcpy(out, "OK");	
+			if (!cpuMemAccessExternal(buf + done, va + done, 1, write, CpuAccessAsCurrent))
+				break;
+			done++;
 		}
-		else if(in[0] == 'q'){
+		
+		if (write && done)
+			cpuDebugCodeChanged();
+		
+		return done;
+	}
+	
+	static uint32_t gdbPrvMemoryMap(char *out)
+	{
+		//everything is accessible (gdb refuses to touch what is not in the map), but ROM is ROM so gdb uses Z1 there
+		static const struct {
+			uint32_t start, len;
+			bool rom;
+		} map[] = {
+			{0x00000000, ROM_BASE + 0x80000000UL, false},
+			{ROM_BASE + 0x80000000UL, sizeof(gRom), true},
+			{ROM_BASE + 0x80000000UL + sizeof(gRom), 0x20000000UL - sizeof(gRom), false},
+			{ROM_BASE + 0xA0000000UL, sizeof(gRom), true},
+			{ROM_BASE + 0xA0000000UL + sizeof(gRom), 0x60000000UL - (ROM_BASE + sizeof(gRom)), false},
+		};
+		uint32_t i, len;
+		
+		len = sprintf(out, "<?xml version=\"1.0\"?><!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+							"\"http://sourceware.org/gdb/gdb-memory-map.dtd\"><memory-map>");
+		for (i = 0; i < sizeof(map) / sizeof(*map); i++)
+			len += sprintf(out + len, "<memory type=\"%s\" start=\"0x%08x\" length=\"0x%08x\"/>", map[i].rom ? "rom" : "ram", (unsigned)map[i].start, (unsigned)map[i].len);
+		len += sprintf(out + len, "</memory-map>");
+		
+		return len;
+	}
+	
+	static int gdbPrvGetc(bool wait)	//-1 on disconnect, -2 if nothing is there and we were not to wait
+	{
+		ssize_t ret;
+		
+		if (mGdbRxPos == mGdbRxLen) {
 			
-			if(in[1] == 'C'){
-				
-				strcpy(out, "");	
-			}
-			else if(strcmp(in  +1, "Offsets") == 0){
+			//signals restart recv(), so wake up now and then to see if one is to end the run
+			if (wait) {
+				struct pollfd pfd = {.fd = mGdbSock, .events = POLLIN, };
 				
-				strcpy(out, "Text=0;Data=0;Bss=0");
+				while (poll(&pfd, 1, 100) <= 0)
+					socSignalCheck();
 			}
-			else goto fail;
-		}
-		else if(in[0] == 'p'){	//read register
 			
-			in++;
-			i = htoi(&in);
-			if(*in) goto fail;	//string not over?
+			do {
+				ret = recv(mGdbSock, mGdbRxBuf, sizeof(mGdbRxBuf), wait ? 0 : MSG_DONTWAIT);
+			} while (ret < 0 && errno == EINTR);
 			
-			out[0] = 0;
-			if(!addRegToStr(out, i)) goto fail;
-		}
-		else if(strcmp(in, "g") == 0){	//read all registers
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return -2;
+			if (ret <= 0)
+				return -1;
 			
-			out[0] = 0;
-			for(i = 0; i < 38; i++) if(!addRegToStr(out, i)) goto fail;
+			mGdbRxLen = ret;
+			mGdbRxPos = 0;
 		}
-		else if(in[0] == 'P'){	//write register
-			
-			in++;
-			i = htoi(&in);
-			if(*in++ != '=') goto fail;	//string not over?
-			addr = htoi(&in);		//get val
+		
+		return mGdbRxBuf[mGdbRxPos++];
+	}
+	
+	static int32_t gdbPrvRecvPacket(uint8_t *buf)	//blocks. returns unescaped payload length (buf is also terminated), -1 on disconnect
+	{
+		uint32_t len = 0;
+		int c;
+		
+		do {	//skip acks and stray ^Cs
+			if ((c = gdbPrvGetc(true)) < 0)
+				return -1;
+		} while (c != '$');
+		
+		while ((c = gdbPrvGetc(true)) != '#') {
 			
-			strcpy(out, gdbRegSet(i, addr) ? "OK" : "e00");
+			if (c == 0x7d && (c = gdbPrvGetc(true)) >= 0)
+				c ^= 0x20;
+			if (c < 0)
+				return -1;
+			if (len < GDB_MAX_PACKET)
+				buf[len++] = c;
 		}
-		else if(in[0] == 'm'){	//read memory
+		buf[len] = 0;
+		
+		//checksum. we are on TCP, so not much point checking it
+		if (gdbPrvGetc(true) < 0 || gdbPrvGetc(true) < 0)
+			return -1;
+		send(mGdbSock, "+", 1, MSG_NOSIGNAL);
+		
+		return len;
+	}
+	
+	static void gdbPrvSendPacket(const char *data, uint32_t len)
+	{
+		static char pkt[GDB_MAX_PACKET * 2 + 8];
+		uint32_t i, o = 0;
+		uint8_t sum = 0;
+		char c;
+		
+		pkt[o++] = '$';
+		for (i = 0; i < len; i++) {
 			
-			in++;
-			addr = htoi(&in);
-			if(*in++ != ',') goto fail;
-			len = htoi(&in);
-			if(*in) goto fail;
-			out[0] = 0;
-			while(len--){
-				
-				if(!gdb_memAccess(addr++, &c, false)) break;
-				sprintf(out + strlen(out), "%02x", c);	
+			c = data[i];
+			if (c == '$' || c == '#' || c == '}' || c == '*') {
+				pkt[o++] = 0x7d;
+				sum += 0x7d;
+				c ^= 0x20;
 			}
-			if (!strlen(out))
-				strcpy(out, "e00");
-		}
-		else if(strcmp(in, "?") == 0){
-			
-			strcpy(out,"S05");	
+			pkt[o++] = c;
+			sum += (uint8_t)c;
 		}
-		else goto fail;
+		o += sprintf(pkt + o, "#%02x", sum);
 		
-	send_pkt:
+		send(mGdbSock, pkt, o, MSG_NOSIGNAL);
+	}
+	
+	static void gdbPrvSendStr(const char *str)
+	{
+		gdbPrvSendPacket(str, strlen(str));
+	}
 	
-		return ret;
+	static void gdbPrvSendStopReply(void)
+	{
+		static const char* const watchNames[] = {[CpuWatchWrite] = "watch", [CpuWatchRead] = "rwatch", [CpuWatchAccess] = "awatch"};
+		char reply[32];
 		
-	fail:
-		out[0] = 0;
-		ret = 0;
-		goto send_pkt;
+		if (mGdbTrapped && mGdbTrapType != CpuWatchNone)
+			sprintf(reply, "T05%s:%08x;", watchNames[mGdbTrapType], (unsigned)mGdbTrapAddr);
+		else if (mGdbInterrupted && !mGdbTrapped)
+			strcpy(reply, "S11");
+		else
+			strcpy(reply, "S05");
+		
+		mGdbTrapped = false;
+		mGdbInterrupted = false;
+		gdbPrvSendStr(reply);
 	}
 	
-	static void sendpacket(int sock, char* packet, int withAck){
+	static void gdbPrvAttach(int sock)
+	{
+		int one = 1;
 		
-		unsigned int c;
-		unsigned i;
-				
-		c = 0;
-		for(i = 0; i < strlen(packet); i++) c += packet[i];
-		memmove(packet + (withAck ? 2 : 1), packet, strlen(packet) + 1);
-		if(withAck){
-			packet[0] = '+';
-			packet[1] = '$';
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		mGdbSock = sock;
+		mGdbRxLen = 0;
+		mGdbRxPos = 0;
+		mGdbRunning = false;
+		mGdbTrapped = false;
+		mGdbInterrupted = false;
+		cpuDebugClearAll();
+		
+		//debuggers expect the target to be stopped when they attach
+		mDebugStop = true;
+	}
+	
+	static void gdbPrvDetach(void)
+	{
+		close(mGdbSock);
+		mGdbSock = -1;
+		mGdbRunning = false;
+		cpuDebugClearAll();
+		fprintf(stderr, "gdb detached\n");
+	}
+	
+	static void gdbPrvInit(int gdbPort)
+	{
+		struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(gdbPort)};
+		int one = 1, sock;
+		
+		if (!gdbPort)
+			return;
+		
+		inet_aton("127.0.0.1", &sa.sin_addr);
+		
+		mGdbListenSock = socket(PF_INET, SOCK_STREAM, 0);
+		if (mGdbListenSock == -1) {
+			err_str("gdb socket creation fails: %d\n", errno);
+			return;
 		}
-		else{
-			packet[0] = '$';
+		setsockopt(mGdbListenSock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		
+		if (bind(mGdbListenSock, (struct sockaddr*)&sa, sizeof(sa)) || listen(mGdbListenSock, 1)) {
+			err_str("gdb socket bind/listen fails: %d\n", errno);
+			close(mGdbListenSock);
+			mGdbListenSock = -1;
+			return;
 		}
-		sprintf(packet + strlen(packet), "#%02x", c & 0xFF);
 		
-		//printf("sending packet <<%s>>\n", packet);
-		send(sock, packet, strlen(packet), 0);	
+		//as always, do not run anything until a debugger attaches
+		fprintf(stderr, "gdb stub listening for connection on port %d\n", gdbPort);
+		sock = accept(mGdbListenSock, NULL, NULL);
+		if (sock == -1)
+			err_str("gdb socket accept fails: %d\n", errno);
+		else
+			gdbPrvAttach(sock);
+		
+		//one that attaches after a detach is picked up by gdbPrvPoll() as we run
+		fcntl(mGdbListenSock, F_SETFL, fcntl(mGdbListenSock, F_GETFL) | O_NONBLOCK);
 	}
 	
-	static inline void gdbCmdWait(unsigned gdbPort, bool* ss)
+	static void gdbPrvPoll(void)
 	{
+		int c, sock;
 		
-		static int running = 0;
-		static int sock = -1;
-		char packet[4096];
-		struct timeval tv = {0};
-		fd_set set;
-		int ret;
-		
-		if(*ss && running){
+		if (mGdbSock == -1) {
 			
-			strcpy(packet,"S05");
-			sendpacket(sock, packet, 0);
-			running = 0;	//perform single step
+			if (mGdbListenSock != -1 && (sock = accept(mGdbListenSock, NULL, NULL)) != -1)
+				gdbPrvAttach(sock);
+			return;
 		}
-		*ss = false;
 		
-		if(running){	//check for breakpoints
-			
-			uint8_t i;
+		//while we run, all a debugger may send is a ^C
+		while ((c = gdbPrvGetc(false)) != -2) {
 			
-			for(i = 0; i < gNumBkpts; i++){
-				
-				if(cpuGetRegExternal(MIPS_EXT_REG_PC) == gBkpts[i]){
-					
-				//	printf("bkpt hit: pc=0x%08lX bk=0x%08lX i=%d\n", soc->cpu.regs[15], gBkpts[i], i);
-					strcpy(packet,"S05");
-					sendpacket(sock, packet, 0);
-					running = 0;	//perform breakpoint hit
-					break;
-				}
+			if (c == -1) {
+				gdbPrvDetach();
+				break;
+			}
+			if (c == 0x03) {
+				mGdbInterrupted = true;
+				mDebugStop = true;
 			}
 		}
+	}
+	
+	static void gdbPrvHandlePacket(const uint8_t *pkt, uint32_t pktLen)
+	{
+		static uint8_t mem[GDB_MAX_PACKET];
+		static char out[GDB_MAX_PACKET + 1];
+		const char *in = (const char*)pkt;
+		uint32_t addr, len, i;
 		
-		if(gdbPort){
+		out[0] = 0;
+		
+		switch (in[0]) {
 			
-			if(sock == -1){	//no socket yet - make one
-				
-				struct sockaddr_in sa = {.sin_family = AF_INET, .sin_port = htons(gdbPort)};
-				socklen_t sl = sizeof(sa);
-				
-				inet_aton("127.0.0.1", &sa.sin_addr);
-				
-				sock = socket(PF_INET, SOCK_STREAM, 0);
-				if(sock == -1){
-					err_str("gdb socket creation fails: %d", errno);
-				}
-				
-				ret = bind(sock, (struct sockaddr*)&sa, sizeof(sa));
-				if(ret){
-					err_str("gdb socket bind fails: %d", errno);
-				}
-				
-				fprintf(stderr, "gdb stub listening for connection on port %d\n", gdbPort);
-				ret = listen(sock, 1);
-				if(ret){
-					err_str("gdb socket listen fails: : %d", errno);
+			case '?':
+				gdbPrvSendStopReply();
+				return;
+			
+			case 's':		//single step
+				mGdbTrapped = false;
+				cpuDebugSkipTrapsOnce();
+				cpuCycle();
+				gdbPrvSendStopReply();
+				return;
+			
+			case 'c':		//continue [with signal, which we ignore]
+			case 'C':
+				cpuDebugSkipTrapsOnce();
+				mGdbRunning = true;
+				return;
+			
+			case 'D':
+				gdbPrvSendStr("OK");
+				gdbPrvDetach();
+				return;
+			
+			case 'k':
+				exit(0);
+				break;
+			
+			case 'g':		//read all registers
+				for (i = 0; i < 38; i++)
+					addRegToStr(out, i);
+				break;
+			
+			case 'p':		//read register
+				in++;
+				i = htoi(&in);
+				if (*in || !addRegToStr(out, i))
+					strcpy(out, "E00");
+				break;
+			
+			case 'P':		//write register
+				in++;
+				i = htoi(&in);
+				if (*in++ != '=')
+					goto fail;
+				addr = htoi(&in);
+				strcpy(out, gdbRegSet(i, __builtin_bswap32(addr)) ? "OK" : "E00");
+				break;
+			
+			case 'm':		//read memory, as hex. gdb splits big reads by the PacketSize we gave it
+				in++;
+				addr = htoi(&in);
+				if (*in++ != ',')
+					goto fail;
+				len = htoi(&in);
+				if (len > GDB_MAX_MEM_XFER)
+					len = GDB_MAX_MEM_XFER;
+				len = gdbPrvMemAccess(addr, mem, len, false);
+				if (!len)
+					strcpy(out, "E00");
+				for (i = 0; i < len; i++)
+					sprintf(out + i * 2, "%02x", mem[i]);
+				break;
+			
+			case 'M':		//write memory, as hex
+			case 'X':		//write memory, binary
+				in++;
+				addr = htoi(&in);
+				if (*in++ != ',')
+					goto fail;
+				len = htoi(&in);
+				if (*in++ != ':')
+					goto fail;
+				if (pkt[0] == 'X') {
+					if (len > pktLen - (uint32_t)(in - (const char*)pkt))
+						goto fail;
+					memcpy(mem, in, len);
 				}
-				
-				ret = accept(sock, (struct sockaddr*)&sa, &sl);
-				if(ret == -1){
-					err_str("gdb socket accept fails: : %d", errno);
+				else for (i = 0; i < len; i++) {
+					
+					char hex[3] = {in[i * 2], in[i * 2] ? in[i * 2 + 1] : 0, 0};
+					const char *h = hex;
+					
+					if (!hex[1])
+						goto fail;
+					mem[i] = htoi(&h);
 				}
-				close(sock);
-				sock = ret;
-				
-				gNumBkpts = 0;
-			}
-		}
-		if(gdbPort){
-				
-			do{
-		
-				FD_ZERO(&set);
-				FD_SET(sock, &set);
-				tv.tv_sec = running ? 0 : 0x00f00000UL;
-				do{
-					ret = select(sock + 1, &set, NULL, NULL, &tv);
-				}while(!ret && !running);
-				if(ret < 0){
-					err_str("select fails: : %d", errno);
+				strcpy(out, gdbPrvMemAccess(addr, mem, len, true) == len ? "OK" : "E00");
+				break;
+			
+			case 'Z':		//insert breakpoint/watchpoint
+			case 'z':		//remove it
+				if (in[1] < '0' || in[1] > '4' || in[2] != ',')
+					goto fail;
+				in += 3;
+				addr = htoi(&in);
+				if (*in++ != ',')
+					goto fail;
+				len = htoi(&in);
+				if (pkt[1] <= '1')		//sw and hw breakpoints are the same thing for us
+					i = cpuDebugBkptSet(addr, pkt[0] == 'Z');
+				else {
+					static const enum CpuWatchType types[] = {CpuWatchWrite, CpuWatchRead, CpuWatchAccess};
+					
+					i = cpuDebugWatchSet(addr, len, types[pkt[1] - '2'], pkt[0] == 'Z');
 				}
-				if(ret > 0){
-					char c;
-					char* p;
-					int len = 0, esc = 0, end = 0;
+				strcpy(out, i ? "OK" : "E00");
+				break;
+			
+			case 'H':
+				strcpy(out, "OK");
+				break;
+			
+			case 'q':
+				if (!strncmp(in, "qSupported", 10))
+					sprintf(out, "PacketSize=%x;qXfer:memory-map:read+", GDB_MAX_PACKET);
+				else if (!strcmp(in, "qOffsets"))
+					strcpy(out, "Text=0;Data=0;Bss=0");
+				else if (!strcmp(in, "qAttached"))
+					strcpy(out, "1");
+				else if (!strncmp(in, "qXfer:memory-map:read::", 23)) {
 					
-					ret = recv(sock, &c, 1, 0);
-					if(ret != 1){
-						err_str("failed to receive byte (1)\n");
-						exit(0);
-					}
+					static char map[1024];
+					uint32_t mapLen = gdbPrvMemoryMap(map);
 					
-					if(c == 3){
-						strcpy(packet,"S11");
-						sendpacket(sock, packet, 0);
-						running = 0;	//perform breakpoint hit
-					}
-					else if(c != '$'){
-						//printf("unknown packet header '%c'\n", c);
-					}
-					else{
-						do{
-							if(esc){
-								c = c ^ 0x20;
-								esc = 0;
-							}
-							else if(c == 0x7d){
-								esc = 1;
-							}
-							
-							if(!esc){	//we cannot be here if we're being escaped
-								
-								packet[len++] = c;
-								if(end == 0 && c == '#') end = 2;
-								else if(end){
-									
-									end--;
-									if(!end) break;
-								}
-								
-								ret = recv(sock, &c, 1, 0);
-								if(ret != 1) err_str("failed to receive byte (2)\n");
-							}
-						}while(1);
-						packet[len] = 0;
-						
-						memmove(packet, packet + 1, len);
-						len -= 4;
-						packet[len] = 0;
-						ret = interpPacket(p = strdup(packet), packet, ss);
-					//	if(ret == 0) printf("how do i respond to packet <<%s>>\n", p);
-						if(ret == -1){	//ack it anyways
-							char c = '+';
-							send(sock, &c, 1, 0);
-							running = 1;
-						}
-						else sendpacket(sock, packet, 1);
-						
-						free(p);
+					in += 23;
+					addr = htoi(&in);
+					if (*in++ != ',')
+						goto fail;
+					len = htoi(&in);
+					if (len > GDB_MAX_PACKET - 1)
+						len = GDB_MAX_PACKET - 1;
+					if (addr >= mapLen)
+						strcpy(out, "l");
+					else {
+						if (len > mapLen - addr)
+							len = mapLen - addr;
+						out[0] = (addr + len == mapLen) ? 'l' : 'm';
+						memcpy(out + 1, map + addr, len);
+						gdbPrvSendPacket(out, len + 1);
+						return;
 					}
 				}
-			}while(!running);
+				break;
+			
+			default:
+				break;
+		}
+		
+		gdbPrvSendStr(out);
+		return;
+	
+	fail:
+		gdbPrvSendStr("E01");
+	}
+	
+	static void gdbPrvStopped(void)
+	{
+		static uint8_t pkt[GDB_MAX_PACKET + 1];
+		int32_t len;
+		
+		mDebugStop = false;
+		
+		if (mGdbSock == -1)		//socStop() with no debugger around
+			return;
+		
+		if (mGdbRunning) {
+			gdbPrvSendStopReply();
+			mGdbRunning = false;
+		}
+		
+		while (!mGdbRunning && mGdbSock != -1) {
+			
+			if ((len = gdbPrvRecvPacket(pkt)) < 0)
+				gdbPrvDetach();
+			else
+				gdbPrvHandlePacket(pkt, len);
 		}
 	}
 
@@ -0,0 +1,124 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "timeline.h"
+#include "cpu.h"
+
+
+struct TimelineMark {
+	uint32_t id;
+	char name[TIMELINE_NAME_LEN];
+	uint64_t nsec;			//since timelineInit()
+	uint64_t instrs;
+	uint64_t excs;
+};
+
+static struct TimelineMark mMarks[TIMELINE_MAX_MARKS];
+static uint32_t mNumMarks, mNumLost;
+static uint64_t mStartNsec;
+static int64_t mExitAt;
+
+
+static uint64_t timelinePrvNsec(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void timelinePrvAtExit(void)
+{
+	timelinePrint();
+}
+
+void timelineInit(bool print, int64_t exitAt)
+{
+	mStartNsec = timelinePrvNsec();
+	mExitAt = exitAt;
+	
+	if (print || exitAt >= 0)
+		atexit(timelinePrvAtExit);
+}
+
+bool timelineMark(uint32_t id, const char *name)
+{
+	uint64_t counts[CpuPerfNumEvents];
+	struct TimelineMark *m;
+	
+	if (mNumMarks == TIMELINE_MAX_MARKS)
+		mNumLost++;
+	else {
+		
+		m = &mMarks[mNumMarks++];
+		cpuGetPerfCounts(counts);
+		
+		m->id = id;
+		m->nsec = timelinePrvNsec() - mStartNsec;
+		m->instrs = counts[CpuPerfInstrs];
+		m->excs = counts[CpuPerfExceptions];
+		strncpy(m->name, name, sizeof(m->name) - 1);
+		m->name[sizeof(m->name) - 1] = 0;
+	}
+	
+	return id != mExitAt;
+}
+
+//the terminal may still be raw when this runs at exit, hence the explicit CRs
+void timelinePrint(void)
+{
+	static const struct TimelineMark start = {.name = "(emulator start)", };
+	const struct TimelineMark *prev = &start, *m;
+	uint32_t i;
+	
+	fprintf(stderr, "\r\nboot timeline, each phase ends at its mark:\r\n");
+	fprintf(stderr, "  %-10s %-*s %11s %11s %12s %9s %7s\r\n", "id", TIMELINE_NAME_LEN - 1, "mark", "at ms", "phase ms", "phase instrs", "phase exc", "MIPS");
+	
+	for (i = 0; i < mNumMarks; i++, prev = m) {
+		
+		uint64_t nsec, instrs;
+		
+		m = &mMarks[i];
+		nsec = m->nsec - prev->nsec;
+		instrs = m->instrs - prev->instrs;
+		
+		fprintf(stderr, "  0x%08x %-*s %11.3f %11.3f %12llu %9llu %7.2f\r\n", (unsigned)m->id, TIMELINE_NAME_LEN - 1, m->name,
+			m->nsec / 1e6, nsec / 1e6, (unsigned long long)instrs, (unsigned long long)(m->excs - prev->excs),
+			nsec ? instrs * 1e3 / nsec : 0.);
+	}
+	
+	if (!mNumMarks)
+		fprintf(stderr, "  (no marks were made)\r\n");
+	if (mNumLost)
+		fprintf(stderr, "  (%u later marks not kept)\r\n", (unsigned)mNumLost);
+}
+
+void timelineJson(FILE *f)
+{
+	const char *ch;
+	uint32_t i;
+	
+	fprintf(f, "[");
+	for (i = 0; i < mNumMarks; i++) {
+		
+		fprintf(f, "%s\n\t\t{\"id\": %u, \"name\": \"", i ? "," : "", (unsigned)mMarks[i].id);
+		for (ch = mMarks[i].name; *ch; ch++) {		//guest made these up, keep them valid JSON
+			if (*ch == '"' || *ch == '\\')
+				fprintf(f, "\\%c", *ch);
+			else if ((uint8_t)*ch < 0x20 || (uint8_t)*ch >= 0x7f)
+				fprintf(f, "\\u%04x", (uint8_t)*ch);
+			else
+				fputc(*ch, f);
+		}
+		fprintf(f, "\", \"ms\": %.3f, \"instrs\": %llu, \"exceptions\": %llu}", mMarks[i].nsec / 1e6,
+			(unsigned long long)mMarks[i].instrs, (unsigned long long)mMarks[i].excs);
+	}
+	fprintf(f, "%s]", mNumMarks ? "\n\t" : "");
+}
@@ -0,0 +1,26 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//boot timeline. guest code marks the end of each phase of its boot with H_MARK, we note host time, instrs and
+//exceptions at each mark and at exit print how much of each went into each phase
+
+#define TIMELINE_MAX_MARKS		64		//later ones are still counted, and still end emulation if asked, but are not shown
+#define TIMELINE_NAME_LEN		40		//incl NUL, longer names are cut short
+
+
+void timelineInit(bool print, int64_t exitAt);			//exitAt: id of the mark after which to end emulation, -1 for none
+bool timelineMark(uint32_t id, const char *name);		//false if emulation is to end now
+void timelinePrint(void);
+void timelineJson(FILE *f);							//marks kept, as a JSON array
+
+
+#endif
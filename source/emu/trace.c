@@ -0,0 +1,242 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include "trace.h"
+#include "cpu.h"
+
+
+//single producer (the cpu), any number of dumpers. a record is only visible to dumpers once the head moves past it,
+//so dumpers never see a half-written record. the oldest slot might be getting overwritten while we dump, so it is skipped.
+//dumpers only read: they may be signal handlers that cut into the producer, so the pending record is not theirs to touch
+
+
+volatile bool gTraceActive = false;
+
+static struct TraceRecord *mRing;
+static uint32_t mMask;
+static _Atomic uint64_t mHead;		//total records ever committed
+static struct TraceConfig mCfg;
+static bool mStarted;
+static uint32_t mCurSeq;			//seq of the instr being executed, traced or not
+
+static struct TraceRecord mPending;	//instr record being built, committed when the next event comes in
+static bool mHavePending;
+static const uint32_t *mRegs;		//cpu regs, to see what the pending instr changed
+static uint32_t mShadowRegs[MIPS_NUM_REGS];
+
+
+static void tracePrvCommit(const struct TraceRecord *rec)
+{
+	uint64_t head = atomic_load_explicit(&mHead, memory_order_relaxed);
+	
+	mRing[head & mMask] = *rec;
+	atomic_store_explicit(&mHead, head + 1, memory_order_release);
+}
+
+static void tracePrvFlushPending(void)
+{
+	uint_fast8_t i;
+	
+	if (!mHavePending)
+		return;
+	
+	mHavePending = false;
+	
+	//at most one GPR changes per instr, find it (JAL & friends change $ra, that is fine too)
+	for (i = 1; i < MIPS_NUM_REGS; i++) {
+		
+		if (mRegs[i] != mShadowRegs[i]) {
+			
+			mPending.reg = i;
+			mPending.regVal = mRegs[i];
+			break;
+		}
+	}
+	
+	tracePrvCommit(&mPending);
+}
+
+void traceInstr(uint64_t instrCnt, uint32_t pc, uint32_t instr, uint_fast8_t asid, const uint32_t *regs)
+{
+	mRegs = regs;
+	mCurSeq = instrCnt;
+	tracePrvFlushPending();
+	
+	if (!mStarted) {
+		
+		if (mCfg.startOnExc >= 0 || instrCnt < mCfg.startAfter)
+			return;
+		mStarted = true;
+	}
+	
+	if (pc < mCfg.pcLo || pc > mCfg.pcHi)
+		return;
+	
+	if (mCfg.asid >= 0 && asid != mCfg.asid)
+		return;
+	
+	memcpy(mShadowRegs, regs, sizeof(mShadowRegs));
+	memset(&mPending, 0, sizeof(mPending));
+	mPending.seq = instrCnt;
+	mPending.pc = pc;
+	mPending.instr = instr;
+	mPending.type = TRACE_REC_INSTR;
+	mPending.asid = asid;
+	mHavePending = true;
+}
+
+void traceMem(uint32_t va, const void *buf, uint_fast8_t sz, bool write)
+{
+	uint32_t val = 0;
+	
+	if (!mHavePending)
+		return;
+	
+	memcpy(&val, buf, sz > sizeof(val) ? sizeof(val) : sz);
+	mPending.memSz = sz | (write ? TRACE_MEM_WRITE : 0);
+	mPending.memAddr = va;
+	mPending.memVal = val;
+}
+
+void traceExc(uint32_t pc, uint32_t cause, uint32_t vector, uint32_t badva)
+{
+	struct TraceRecord rec = {};
+	
+	tracePrvFlushPending();
+	
+	if (!mStarted) {
+		
+		if (mCfg.startOnExc < 0 || (int)((cause >> 2) & 0x1f) != mCfg.startOnExc)
+			return;
+		mStarted = true;
+	}
+	
+	rec.seq = mCurSeq;
+	rec.pc = pc;
+	rec.instr = cause;
+	rec.type = TRACE_REC_EXC;
+	rec.reg = (cause >> 2) & 0x1f;
+	rec.regVal = vector;
+	rec.memAddr = badva;
+	
+	tracePrvCommit(&rec);
+}
+
+static void tracePrvWriteAll(int fd, const void *buf, size_t len)
+{
+	const uint8_t *src = (const uint8_t*)buf;
+	ssize_t now;
+	
+	while (len) {
+		
+		now = write(fd, src, len);
+		if (now <= 0)
+			break;
+		src += now;
+		len -= now;
+	}
+}
+
+void traceDumpNow(void)
+{
+	uint64_t head, first, numRecs = mMask + 1ULL;
+	struct TraceFileHdr hdr = {};
+	uint32_t firstIdx, lastIdx;
+	int fd;
+	
+	if (!mRing || !mCfg.dumpPath)
+		return;
+	
+	head = atomic_load_explicit(&mHead, memory_order_acquire);
+	first = head >= numRecs ? head - numRecs + 1 : 0;
+	
+	fd = open(mCfg.dumpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	
+	hdr.magic = TRACE_FILE_MAGIC;
+	hdr.version = TRACE_FILE_VERSION;
+	hdr.recSz = sizeof(struct TraceRecord);
+	hdr.numRecs = head - first;
+	hdr.numLost = first;
+	tracePrvWriteAll(fd, &hdr, sizeof(hdr));
+	
+	if (head != first) {
+		
+		firstIdx = first & mMask;
+		lastIdx = (head - 1) & mMask;
+		
+		if (firstIdx <= lastIdx)
+			tracePrvWriteAll(fd, mRing + firstIdx, sizeof(struct TraceRecord) * (lastIdx - firstIdx + 1));
+		else {
+			tracePrvWriteAll(fd, mRing + firstIdx, sizeof(struct TraceRecord) * (mMask + 1 - firstIdx));
+			tracePrvWriteAll(fd, mRing, sizeof(struct TraceRecord) * (lastIdx + 1));
+		}
+	}
+	close(fd);
+}
+
+static void tracePrvCrashHandler(int sig)
+{
+	static const char msg[] = "\r\nemulator crashed, dumping trace\r\n";
+	
+	tracePrvWriteAll(2, msg, sizeof(msg) - 1);
+	traceDumpNow();
+	raise(sig);		//SA_RESETHAND put the default handler back
+}
+
+static void tracePrvDumpReqHandler(int sig)
+{
+	(void)sig;
+	
+	traceDumpNow();
+}
+
+static void tracePrvAtExit(void)
+{
+	tracePrvFlushPending();		//the cpu is done, so the last instr may as well be in there
+	traceDumpNow();
+}
+
+bool traceInit(const struct TraceConfig *cfg)
+{
+	static const int crashSigs[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+	struct sigaction sa = {};
+	uint32_t numRecs = 1;
+	uint_fast8_t i;
+	
+	while (numRecs < cfg->numRecs && numRecs < 0x80000000UL)
+		numRecs *= 2;
+	
+	mRing = calloc(numRecs, sizeof(struct TraceRecord));
+	if (!mRing)
+		return false;
+	
+	mCfg = *cfg;
+	mMask = numRecs - 1;
+	mStarted = false;
+	
+	sa.sa_handler = tracePrvCrashHandler;
+	sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+	for (i = 0; i < sizeof(crashSigs) / sizeof(*crashSigs); i++)
+		sigaction(crashSigs[i], &sa, NULL);
+	
+	sa.sa_handler = tracePrvDumpReqHandler;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+	
+	atexit(tracePrvAtExit);
+	
+	gTraceActive = true;
+	
+	return true;
+}
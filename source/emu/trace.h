@@ -0,0 +1,67 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+//binary instruction trace. records go into a power-of-two ring, newest overwrite oldest. the ring is dumped to a file on
+//request, at exit, and on emulator crash. "traceDump" decodes the file offline. file format is shared with that tool
+
+#define TRACE_FILE_MAGIC		0x52544d75	//'uMTR'
+#define TRACE_FILE_VERSION		1
+
+#define TRACE_REC_INSTR			0	//an instruction was executed
+#define TRACE_REC_EXC			1	//an exception was taken (irq included)
+
+#define TRACE_MEM_WRITE			0x80	//in memSz
+#define TRACE_MEM_SZ_MASK		0x0f
+
+struct TraceRecord {
+	uint32_t seq;		//low bits of the instruction counter
+	uint32_t pc;		//for TRACE_REC_EXC: pc of the faulting instr
+	uint32_t instr;		//for TRACE_REC_EXC: cause register as it was set
+	uint8_t type;		//TRACE_REC_*
+	uint8_t asid;
+	uint8_t reg;		//register changed by this instr (0 = none). for TRACE_REC_EXC: ExcCode
+	uint8_t memSz;		//size of memory access | TRACE_MEM_WRITE. 0 if none
+	uint32_t regVal;	//new value of "reg". for TRACE_REC_EXC: vector
+	uint32_t memAddr;	//VA. for TRACE_REC_EXC: BadVA
+	uint32_t memVal;	//low 32 bits of the value transferred
+	uint32_t rfu;
+};
+
+struct TraceFileHdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recSz;
+	uint32_t numRecs;	//records that follow, oldest first
+	uint32_t numLost;	//records overwritten before the dump
+};
+
+struct TraceConfig {
+	uint32_t numRecs;			//rounded up to a power of two
+	uint64_t startAfter;		//instructions to skip before tracing starts
+	uint32_t pcLo, pcHi;		//only record instrs in [pcLo, pcHi]
+	int16_t asid;				//only record instrs run with this ASID (-1 for any)
+	int16_t startOnExc;			//do not start till this ExcCode is taken (-1 for no such condition)
+	const char *dumpPath;
+};
+
+
+bool traceInit(const struct TraceConfig *cfg);
+void traceDumpNow(void);		//async-signal-safe, has committed records only (not the instr still being traced)
+
+//used by the cpu core. not to be called unless gTraceActive is set
+extern volatile bool gTraceActive;
+void traceInstr(uint64_t instrCnt, uint32_t pc, uint32_t instr, uint_fast8_t asid, const uint32_t *regs);
+void traceMem(uint32_t va, const void *buf, uint_fast8_t sz, bool write);
+void traceExc(uint32_t pc, uint32_t cause, uint32_t vector, uint32_t badva);
+
+
+#endif
@@ -0,0 +1,84 @@
+/*
+	(c) 2021 Dmitry Grinberg   https://dmitry.gr
+	Non-commercial use only OR licensing@dmitry.gr
+*/
+
+//offline decoder for trace files written by the emulator (see trace.h)
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "mipsDis.h"
+#include "trace.h"
+
+
+static const char *mExcNames[32] = {
+	[0] = "Int", [1] = "Mod", [2] = "TLBL", [3] = "TLBS", [4] = "AdEL", [5] = "AdES", [6] = "IBE", [7] = "DBE",
+	[8] = "Sys", [9] = "Bp", [10] = "RI", [11] = "CpU", [12] = "Ov", [13] = "Tr", [15] = "FPE", [23] = "WATCH",
+};
+
+static void traceDumpPrint(const struct TraceRecord *rec)
+{
+	char dis[64];
+	
+	if (rec->type == TRACE_REC_EXC) {
+		
+		printf("%10u  ---- EXC %-5s @ 0x%08x -> 0x%08x  cause=0x%08x badva=0x%08x\n", (unsigned)rec->seq,
+			mExcNames[rec->reg & 31] ? mExcNames[rec->reg & 31] : "???", (unsigned)rec->pc, (unsigned)rec->regVal,
+			(unsigned)rec->instr, (unsigned)rec->memAddr);
+		return;
+	}
+	
+	mipsDisasm(dis, sizeof(dis), rec->instr, rec->pc);
+	printf("%10u  %02x [%08x] %08x  %-34s", (unsigned)rec->seq, rec->asid, (unsigned)rec->pc, (unsigned)rec->instr, dis);
+	
+	if (rec->reg)
+		printf(" %s=%08x", mipsRegName(rec->reg), (unsigned)rec->regVal);
+	
+	if (rec->memSz)
+		printf(" %s%u[%08x]=%0*x", (rec->memSz & TRACE_MEM_WRITE) ? "W" : "R", rec->memSz & TRACE_MEM_SZ_MASK,
+			(unsigned)rec->memAddr, (rec->memSz & TRACE_MEM_SZ_MASK) >= 4 ? 8 : (rec->memSz & TRACE_MEM_SZ_MASK) * 2, (unsigned)rec->memVal);
+	
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t i, tail = 0xffffffff;
+	struct TraceFileHdr hdr;
+	struct TraceRecord rec;
+	FILE *f;
+	
+	if (argc != 2 && !(argc == 4 && !strcmp(argv[2], "--tail"))) {
+		fprintf(stderr, "USAGE: %s <trace.bin> [--tail <num_records>]\n", argv[0]);
+		return -1;
+	}
+	if (argc == 4)
+		tail = strtoul(argv[3], NULL, 0);
+	
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open '%s'\n", argv[1]);
+		return -1;
+	}
+	
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_FILE_MAGIC || hdr.version != TRACE_FILE_VERSION || hdr.recSz != sizeof(struct TraceRecord)) {
+		fprintf(stderr, "not a trace file we understand\n");
+		fclose(f);
+		return -2;
+	}
+	
+	printf("%u records, %u older ones lost\n", (unsigned)hdr.numRecs, (unsigned)hdr.numLost);
+	
+	if (tail < hdr.numRecs && fseek(f, (long)sizeof(rec) * (hdr.numRecs - tail), SEEK_CUR)) {
+		fclose(f);
+		return -3;
+	}
+	
+	for (i = 0; i < hdr.numRecs && fread(&rec, sizeof(rec), 1, f) == 1; i++)
+		traceDumpPrint(&rec);
+	
+	fclose(f);
+	
+	return 0;
+}
@@ -13,6 +13,129 @@
 #define H_STOR_READ			3
 #define H_STOR_WRITE		4
 #define H_TERM				5
+#define H_GET_FEATURES		6
+#define H_PV_GET_DEV		7
+#define H_PV_GET_CFG		8
+#define H_PV_QUEUE_SETUP	9
+#define H_PV_KICK			10
+#define H_PV_IRQ_ACK		11
+#define H_PAGE_ZERO			12
+#define H_PAGE_COPY			13
+#define H_MEM_SET			14
+#define H_MEM_COPY			15
+#define H_GET_ISA			16
+#define H_GET_TLB_SIZE		17
+#define H_MARK				18
+#define H_STOR_READ_MULTI	19
+#define H_PROM_BASE			0x100	//+ DecPromVectors offset / 4. only used by direct kernel boot
+
+//H_GET_FEATURES bits
+#define H_FEAT_RTC_ONESHOT	0x00000001	//8192Hz counter and one-shot timer at RTC base + 0x200, see ds1287.c
+#define H_FEAT_CP0_TIMER	0x00000002	//CP0 Count/Compare tick at CP0_COUNT_HZ of guest time, Compare match raises IP7
+#define H_FEAT_PV_RING		0x00000004	//H_PV_* calls and the shared memory ring devices below exist
+#define H_FEAT_PAGE_OPS		0x00000008	//H_PAGE_* and H_MEM_* calls exist
+#define H_FEAT_ISA			0x00000010	//H_GET_ISA call exists
+#define H_FEAT_TLB_SIZE		0x00000020	//H_GET_TLB_SIZE call exists, Index and Random carry TLB indices in bits 17..8
+#define H_FEAT_PMU			0x00000040	//perf counters at PMU_BASE, below
+#define H_FEAT_MARK			0x00000080	//H_MARK call exists
+#define H_FEAT_STOR_MULTI	0x00000100	//H_STOR_READ_MULTI call exists
+
+//H_GET_ISA bits: MIPS32 instrs the cpu runs natively, beyond what an R3000 has. the rest are reserved instrs
+#define H_ISA_MOVCC			0x00000001	//MOVN, MOVZ
+#define H_ISA_MUL			0x00000002	//MUL
+#define H_ISA_MAC			0x00000004	//MADD, MADDU, MSUB, MSUBU
+#define H_ISA_CLZ			0x00000008	//CLZ, CLO
+#define H_ISA_BITFIELD		0x00000010	//EXT, INS
+#define H_ISA_EXTEND		0x00000020	//SEB, SEH
+#define H_ISA_BYTESWAP		0x00000040	//WSBH
+
+//H_MARK ids of the marks our own guest code makes, in boot order. others are free for ad-hoc use
+#define MARK_LOADER_START	0x0100	//loader is running
+#define MARK_LOADER_MOUNTED	0x0101	//boot partition found and mounted
+#define MARK_LOADER_LOADED	0x0102	//kernel loaded, about to jump to it
+#define MARK_KERNEL_EARLY	0x0200	//kernel ran its early initcalls
+#define MARK_KERNEL_INIT	0x0201	//kernel ran all initcalls, about to start init
+#define MARK_USER			0x0300	//from userland via /proc/umips_mark, ids 0x300+ are left to it. 0x300 is "shell up"
+
+#define CP0_COUNT_HZ		(8192 * 1024)	//Count ticks once per instr, and the RTC ticks once per 1024 of them
+
+#define H_PAGE_SIZE			4096	//what H_PAGE_* work on, PAs must be aligned to it
+
+//paravirtual ring devices. guest posts requests into a ring in its RAM, host completes them in order and raises the device's irq
+#define PV_DEV_NONE			0
+#define PV_DEV_BLOCK		1		//queue 0. cfg[0] = size in 512-byte sectors. irq 6
+#define PV_DEV_NET			2		//queue 0 rx, 1 tx, one frame per entry. cfg[0] = mac[0..3], cfg[1] = mac[4..5], cfg[2] = max frame size. irq 3
+#define PV_DEV_9P			3		//host directory, 9P2000.L. one 9P connection per queue, one message per entry. cfg[0] = max msize,
+									//cfg[1..4] = mount tag, NUL padded. irq 6
+#define PV_MAX_DEVS			16
+#define PV_MAX_QUEUES		4		//per device
+#define PV_MAX_RING_SZ		1024	//entries, power of two
+
+#define PV_RING_F_NO_IRQ	0x0001	//guest flag: do not raise the irq when completing requests in this ring
+#define PV_RING_F_POLL		0x0002	//guest flag: guest will not kick, host looks at the ring periodically
+
+#define PV_ST_OK			0
+#define PV_ST_ERR			1		//i/o error
+#define PV_ST_INVAL			2		//bad op, arg or buffer
+
+#define PV_BLK_OP_READ		0		//arg = first sector, into the "in" buffer
+#define PV_BLK_OP_WRITE		1		//arg = first sector, from the "out" buffer
+#define PV_BLK_OP_FLUSH		2
+
+#define PV_NET_MAX_FRAME	1514	//no FCS
+
+#define PV_9P_OP_MSG		0		//"out" is a whole T-message, the R-message goes into "in"
+#define PV_9P_OP_ZC			1		//Tread, Treaddir or Twrite with the payload in guest pages: "out" is the first arg bytes of the
+									//T-message followed by struct Pv9pSeg list of the payload, "in" gets the R-message minus payload
+#define PV_9P_TAG_LEN		16		//incl NUL
+
+//perf counters, H_FEAT_PMU. 32-bit regs, word accesses only. all counters count in all modes
+#define PMU_BASE			0x15000000UL	//PA, one page
+#define PMU_IRQ				2		//cpu irq line, the SCSI one, which we do not have
+#define PMU_REG_INFO		0x000	//RO: num counters << 8 | num events
+#define PMU_REG_OVF			0x004	//RW: bit n set when counter n wrapped past 0xffffffff. write 1 to clear. drives the irq for
+									//counters with PMU_CFG_IRQ set. checked once per up to 1024 instrs, so it may skid that much
+#define PMU_REG_CFG(n)		(0x100 + 8 * (n))	//RW: PMU_CFG_*
+#define PMU_REG_COUNT(n)	(0x104 + 8 * (n))	//RW: counts up while enabled, write to start at any value
+#define PMU_NUM_CTRS		4
+
+#define PMU_CFG_EVT_MASK	0x000000ff	//PMU_EVT_*. others never count
+#define PMU_CFG_ENABLE		0x00000100
+#define PMU_CFG_IRQ			0x00000200	//raise PMU_IRQ on overflow
+
+#define PMU_EVT_INSTRS		0		//also cycles, they are the same to us
+#define PMU_EVT_EXCEPTIONS	1		//all, including irqs and tlb refills
+#define PMU_EVT_TLB_REFILLS	2
+#define PMU_EVT_ICACHE_MISS	3
+#define PMU_EVT_HYPERCALLS	4
+#define PMU_NUM_EVTS		5
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+struct PvReq {						//one ring entry, little endian like the guest
+	uint32_t outPa, outLen;			//guest -> host data, if any
+	uint32_t inPa, inLen;			//host -> guest buffer, if any. host sets inLen to how much it wrote
+	uint32_t arg;					//device specific
+	uint16_t op;					//device specific
+	uint16_t status;				//PV_ST_*, set by host
+};
+
+struct PvRing {						//at a word aligned, physically contiguous PA
+	uint32_t avail;					//guest: requests posted so far. entry avail % num is the next one it will fill
+	uint32_t used;					//host: requests completed so far
+	uint16_t flags;					//PV_RING_F_*
+	uint16_t rfu0;
+	uint32_t rfu1;
+	struct PvReq req[];
+};
+
+struct Pv9pSeg {					//PV_9P_OP_ZC payload piece
+	uint32_t pa, len;
+};
+
+#endif
 
 /*
 calls:
@@ -22,7 +145,39 @@ calls:
 	2	STOR_GET_SZ						return u32 stor_sz_in_512B_blocks
 	3	STOR_READ(u32 block, u32 pa)	reada a storage block to a given PA. result is a bool
 	4	STOR_WRITE(u32 block, u32 pa)	writes a block to disk from a given PA. result is a bool
-	5	TERM							terminate emulation
+	5	TERM(u8 status)					terminate emulation, the emulator exits with this status
+	6	GET_FEATURES					ret: u32 bitmask of H_FEAT_* emulator extensions present. older emulators lack
+										this call entirely, so guests must only make it where that is acceptable
+	7	PV_GET_DEV(u32 idx)				ret: PV_DEV_* type of device idx in bits 0..15, its number of queues in bits
+										16..23 and the cpu irq line it raises in bits 24..31
+	8	PV_GET_CFG(u32 idx, u32 word)	ret: word-th u32 of that device's config, meaning depends on the device type
+	9	PV_QUEUE_SETUP(u32 idx << 8 | queue, u32 ringPa, u32 numEntries)
+										give the host a struct PvRing with numEntries entries (0 to tear down). both
+										counters must be zero. result is a bool
+	10	PV_KICK(u32 idx << 8 | queue)	host completes all it can of what was posted to that ring before returning. the
+										rest (eg: network rx waiting for packets) is completed later, raising the irq
+	11	PV_IRQ_ACK(u32 irq)				ret: bitmask of devices on that cpu irq line that completed requests since the
+										last ack. lowers the line
+	12	PAGE_ZERO(u32 pa)				zero the H_PAGE_SIZE bytes at pa. result is a bool
+	13	PAGE_COPY(u32 dstPa, u32 srcPa)	copy H_PAGE_SIZE bytes from srcPa to dstPa. result is a bool
+	14	MEM_SET(u32 pa, u8 val, u32 len)
+										fill len bytes at pa with val. no alignment needed. result is a bool
+	15	MEM_COPY(u32 dstPa, u32 srcPa, u32 len)
+										copy len bytes, ranges may overlap (as memmove). no alignment needed. result is a bool
+		12..15 write RAM the way the cpu's own stores would: caches are not touched, so a guest that puts code there
+		flushes its icache after, same as it would after a store loop or DMA. all ranges must be entirely in RAM
+	16	GET_ISA							ret: u32 bitmask of H_ISA_* instrs the cpu runs. PRID still says R3000
+	17	GET_TLB_SIZE					ret: u32 number of TLB entries, 64..1024. the first 8 are wired as on any R3000, Random
+										spans the rest. PRID still says R3000
+	18	MARK(u32 id, u32 pa)			note that boot got to the point named id, with a NUL-terminated name for it at pa
+										(0 for none). the emulator keeps host time, instrs and exceptions at each mark
+										for its boot timeline and may end emulation right after one. result is a bool
+	19	STOR_READ_MULTI(u32 block, u32 pa, u32 num)
+										read num consecutive blocks to consecutive PAs from pa on, as num STOR_READs
+										would, but in one call. result is a bool
+
+	0x100 + n							PROM callback at DecPromVectors offset n * 4. the emulator places stubs that make these
+										calls when it boots a kernel directly (--kernel), params and return are as per the PROM
 */
 
 
@@ -14,8 +14,11 @@ void start(void);
 uint32_t getMemMap(uint32_t index);
 void consoleWrite(char ch);
 uint32_t getStoreSz(void);							//in 512-byte blocks
+uint32_t getFeatures(void);							//H_FEAT_*
 bool readblock(uint32_t blkNo, void *dst);
+bool readblocks(uint32_t firstBlk, void *dst, uint32_t num);	//only if getFeatures() says H_FEAT_STOR_MULTI
 bool writeblock(uint32_t blkNo, const void *src);
+void mark(uint32_t id, const void *name);			//boot timeline, name is a PA. only if getFeatures() says H_FEAT_MARK
 
 
 
@@ -4,6 +4,7 @@
 
 #define MAX_VOLUMES				1
 #define MAX_FILES				1
+#define FAT_CACHE_SECS			2		//two, so a FAT12 entry that straddles sectors needs no reread
 
 struct FatVolume {
 	FatReadSecProc readSecF;
@@ -61,6 +62,11 @@ static struct FatFile mFiles[MAX_FILES];
 static uint8_t *mBuffer;
 static struct FatVolume *mBufVol;
 static uint32_t mBufSec;
+//FAT sectors, apart from mBuffer so data reads do not evict them. align is as for readSecF's buffers elsewhere
+static uint8_t __attribute__((aligned(FAT_SECTOR_SIZE))) mFatCache[FAT_CACHE_SECS][FAT_SECTOR_SIZE];
+static struct FatVolume *mFatCacheVol[FAT_CACHE_SECS];
+static uint32_t mFatCacheSec[FAT_CACHE_SECS];
+static uint8_t mFatCacheNext;
 
 
 static int_fast8_t fatPrvFindFreeStruct(uint8_t *maskP)
@@ -79,10 +85,21 @@ static int_fast8_t fatPrvFindFreeStruct(uint8_t *maskP)
 	return -1;
 }
 
+static void fatPrvFatCacheDrop(struct FatVolume *vol)		//NULL for all
+{
+	uint_fast8_t i;
+	
+	for (i = 0; i < FAT_CACHE_SECS; i++) {
+		if (!vol || mFatCacheVol[i] == vol)
+			mFatCacheVol[i] = NULL;
+	}
+}
+
 void fatInit(void *tmpBuf)
 {
 	mBuffer = tmpBuf;
 	mBufVol = 0;
+	fatPrvFatCacheDrop(NULL);
 }
 
 static bool fatPrvVolReadEx(struct FatVolume *vol, uint32_t sec, void* dst)		//read a sector to a buffer. consider cache. 
@@ -95,7 +112,7 @@ static bool fatPrvVolReadEx(struct FatVolume *vol, uint32_t sec, void* dst)		//r
 		return true;
 	}
 
-	return vol->readSecF(vol->readSecD, sec, dst);
+	return vol->readSecF(vol->readSecD, sec, 1, dst);
 }
 
 static bool fatPrvVolRead(struct FatVolume *vol, uint32_t sec)
@@ -138,8 +155,30 @@ static bool fatPrvIsValidClusNo(struct FatVolume *vol, uint32_t clus)
 	return clus >= 2 && clus < fatPrvGetFirstInvalClusNo(vol) && clus < vol->numClusters;
 }
 
+static const uint8_t* fatPrvFatSecRead(struct FatVolume *vol, uint32_t sec)	//sec is in the FAT
+{
+	uint_fast8_t i;
+	
+	for (i = 0; i < FAT_CACHE_SECS; i++) {
+		if (mFatCacheVol[i] == vol && mFatCacheSec[i] == sec)
+			return mFatCache[i];
+	}
+	
+	i = mFatCacheNext;
+	mFatCacheNext = (i + 1) % FAT_CACHE_SECS;
+	
+	mFatCacheVol[i] = NULL;
+	if (!vol->readSecF(vol->readSecD, vol->fatSec + sec, 1, mFatCache[i]))
+		return NULL;
+	mFatCacheVol[i] = vol;
+	mFatCacheSec[i] = sec;
+	
+	return mFatCache[i];
+}
+
 static uint32_t fatPrvWalkFat(struct FatVolume *vol, uint32_t curClus)
 {
+	const uint8_t *fat;
 	uint32_t ret, sec, idx;
 	
 	if (!fatPrvIsValidClusNo(vol, curClus))
@@ -151,17 +190,17 @@ static uint32_t fatPrvWalkFat(struct FatVolume *vol, uint32_t curClus)
 			sec = idx / FAT_SECTOR_SIZE;
 			idx %= FAT_SECTOR_SIZE;
 			
-			if (!fatPrvVolRead(vol, vol->fatSec + sec))
+			if (!(fat = fatPrvFatSecRead(vol, sec)))
 				return 0;
-			ret = mBuffer[idx];
+			ret = fat[idx];
 			if (idx != FAT_SECTOR_SIZE - 1)
-				ret += ((uint16_t)mBuffer[idx + 1]) << 8;
+				ret += ((uint16_t)fat[idx + 1]) << 8;
 			else {
 				
-				if (!fatPrvVolRead(vol, vol->fatSec + sec + 1))
+				if (!(fat = fatPrvFatSecRead(vol, sec + 1)))
 					return 0;
 				
-				ret += ((uint16_t)mBuffer[0]) << 8;
+				ret += ((uint16_t)fat[0]) << 8;
 			}
 			if (curClus & 1)
 				ret >>= 4;
@@ -170,18 +209,18 @@ static uint32_t fatPrvWalkFat(struct FatVolume *vol, uint32_t curClus)
 		
 		case 16:
 			idx = curClus * 2;
-			if (!fatPrvVolRead(vol, vol->fatSec + idx / FAT_SECTOR_SIZE))
+			if (!(fat = fatPrvFatSecRead(vol, idx / FAT_SECTOR_SIZE)))
 				return 0;
 			
-			ret = *(uint16_t*)(mBuffer + idx % FAT_SECTOR_SIZE);
+			ret = *(uint16_t*)(fat + idx % FAT_SECTOR_SIZE);
 			break;
 		
 		case 32:
 			idx = curClus * 4;
-			if (!fatPrvVolRead(vol, vol->fatSec + idx / FAT_SECTOR_SIZE))
+			if (!(fat = fatPrvFatSecRead(vol, idx / FAT_SECTOR_SIZE)))
 				return 0;
 			
-			ret = *(uint32_t*)(mBuffer + idx % FAT_SECTOR_SIZE);
+			ret = *(uint32_t*)(fat + idx % FAT_SECTOR_SIZE);
 			break;
 			
 		default:
@@ -342,6 +381,7 @@ fail:
 
 void fatUnmount(struct FatVolume *vol)
 {
+	fatPrvFatCacheDrop(vol);
 	mVolumesUsed &=~ (1 << (vol - mVolumes));
 }
 
@@ -430,6 +470,34 @@ void fatFileClose(struct FatFile* file)
 	mFilesUsed &=~ (1 << (file - mFiles));
 }
 
+//whole sectors of a normal file, from secNo on, which is where f is at: to the end of this cluster and on into the
+//ones after it for as long as the chain goes to the next cluster number, as that is all one run on disk, in one
+//readSecF call. f moves only if it all was read. returns bytes read, 0 on error
+static uint32_t fatPrvReadRun(struct FatFile *f, uint32_t secNo, uint8_t *dst, uint32_t len)
+{
+	struct FatVolume *vol = f->vol;
+	uint32_t clusSz = fatPrvGetClusSz(vol), clus = f->normal.curClus, numClus = 0;
+	uint32_t now = clusSz - f->normal.inClusOfst;
+	
+	len -= len % FAT_SECTOR_SIZE;
+	while (now < len && fatPrvWalkFat(vol, clus) == clus + 1) {
+		clus++;
+		numClus++;
+		now += clusSz;
+	}
+	if (now > len)
+		now = len;
+	
+	if (!vol->readSecF(vol->readSecD, secNo, now / FAT_SECTOR_SIZE, dst))
+		return 0;
+	
+	f->normal.curClus = clus;
+	f->normal.clusIdx += numClus;
+	f->normal.inClusOfst += now - numClus * clusSz;
+	
+	return now;
+}
+
 static uint32_t fatPrvRead(struct FatFile *f, void *dstP, uint32_t len, bool forDir)
 {
 	uint32_t wantedOrig = len;
@@ -510,6 +578,14 @@ static uint32_t fatPrvRead(struct FatFile *f, void *dstP, uint32_t len, bool for
 		
 		if (secOfst == 0 && now >= FAT_SECTOR_SIZE) {		//fast path
 			
+			if (dst && !f->isSpecialRootDir) {		//as many sectors as are in one run on disk
+				
+				if (!(now = fatPrvReadRun(f, secNo, dst, len)))
+					break;
+				dst += now;
+				len -= now;
+				continue;
+			}
 			if (dst) {
 				if (!fatPrvVolReadEx(f->vol, secNo, dst))
 					break;
@@ -517,15 +593,13 @@ static uint32_t fatPrvRead(struct FatFile *f, void *dstP, uint32_t len, bool for
 			}
 			now = FAT_SECTOR_SIZE;
 		}
-		else {
+		else if (dst) {		//skipping needs no reads
 			
 			if (!fatPrvVolRead(f->vol, secNo))
 				break;
 			
-			if (dst) {
-				memcpy(dst, mBuffer + secOfst, now);
-				dst += now;
-			}
+			memcpy(dst, mBuffer + secOfst, now);
+			dst += now;
 		}
 		
 		len -= now;
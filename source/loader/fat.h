@@ -6,7 +6,7 @@
 
 #define FAT_SECTOR_SIZE		(512)
 
-typedef bool (*FatReadSecProc)(void *userData, uint32_t sec, void *dst);
+typedef bool (*FatReadSecProc)(void *userData, uint32_t sec, uint32_t num, void *dst);	//num consecutive sectors
 
 struct FatDirEntry;
 struct FatVolume;
@@ -5,6 +5,7 @@
 #include "printf.h"
 #include "entry.h"
 #include "fat.h"
+#include "../hypercall.h"
 
 #define MY_SYS_TYPE			0x00010000	//DS2100/3100
 #define STRINGIFY2(x)		#x
@@ -139,11 +140,28 @@ static void* v2p(void* addr)
 	return (void*)(((uintptr_t)addr) & 0x1fffffff);	//assumes a lot of things :D
 }
 
-static bool loaderPrvFatReadSecProc(void *userData, uint32_t sec, void *dst)
+static uint32_t mFeatures;		//H_FEAT_*
+
+
+static bool loaderPrvFatReadSecProc(void *userData, uint32_t sec, uint32_t num, void *dst)
 {
 	uint32_t startSec = *(const uint32_t*)userData;
 	
-	return readblock(sec + startSec, v2p(dst));
+	if (mFeatures & H_FEAT_STOR_MULTI)
+		return readblocks(sec + startSec, v2p(dst), num);
+	
+	for (; num; num--, sec++, dst = (char*)dst + FAT_SECTOR_SIZE) {
+		if (!readblock(sec + startSec, v2p(dst)))
+			return false;
+	}
+	
+	return true;
+}
+
+static void loaderPrvMark(uint32_t id, const char *name)
+{
+	if (mFeatures & H_FEAT_MARK)
+		mark(id, v2p((void*)name));
 }
 
 static void fatal(const char *str)
@@ -256,6 +274,9 @@ void start(void)
 	char fName[13];
 	
 	
+	//we ship with the emulator (see readme.txt), so it is one that has H_GET_FEATURES
+	mFeatures = getFeatures();
+	loaderPrvMark(MARK_LOADER_START, "loader start");
 	pr("hello, world\n");
 
 	if (!readblock(0, v2p(mbr)))
@@ -296,6 +317,7 @@ void start(void)
 	vol = fatMount(loaderPrvFatReadSecProc, &startSec);
 	if (!vol)
 		fatal("mount failed\n");
+	loaderPrvMark(MARK_LOADER_MOUNTED, "fat mounted");
 	
 	dir = fatOpenRoot(vol);
 	if (!dir)
@@ -372,8 +394,10 @@ void start(void)
 			pr("LOADED\n");
 		}
 	}
-	else if (
+	else
+		fatal("Kernel is not an ELF file\n");
 	
+	loaderPrvMark(MARK_LOADER_LOADED, "kernel loaded");
 	pr("jumping. Kernel boot should take a couple of minutes...\n");
 	((KernelEntry)entryPt)(sizeof(argv) / sizeof(*argv), argv, 0x30464354, &vecs);
 	